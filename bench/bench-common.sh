@@ -0,0 +1,70 @@
+# Shared by the benchmark scripts: run on a private session bus with
+# a printerd of our own.
+
+top_srcdir=`cd ${top_srcdir-.}; pwd`
+top_builddir=`cd ${top_builddir-.}; pwd`
+export top_srcdir top_builddir
+
+# Files and directories to remove on exit
+PD_BENCH_CLEANUP=()
+
+# Call with the script's arguments. Re-runs the script on a bus of
+# its own, then sets up the same variables as the tests use.
+pd_bench_init () {
+    if [ -z "$PD_BENCH_BUS" ]; then
+	export PD_BENCH_BUS=1
+	exec dbus-run-session -- bash "$0" "$@"
+    fi
+
+    # Don't let tests/common.sh pick up the test suite's bus.
+    local bus="$DBUS_SESSION_BUS_ADDRESS"
+    BOOKMARK=/dev/null SESSION_LOG=/dev/null . "${top_srcdir}"/tests/common.sh
+    DBUS_SESSION_BUS_ADDRESS="$bus"
+    export DBUS_SESSION_BUS_ADDRESS
+
+    PD_BENCH_LOG="${top_builddir}"/printerd-bench.log
+    PD_BENCH_LABEL="$(git -C "${top_srcdir}" describe --always --dirty 2>/dev/null)"
+    trap pd_bench_finish EXIT
+}
+
+# Start printerd and wait for it to own its name. Sets PD_BENCH_PID.
+pd_bench_start_daemon () {
+    "${PRINTERD}" --session -r &> "$PD_BENCH_LOG" &
+    PD_BENCH_PID=$!
+
+    for i in 0.1 0.2 0.3 0.5 1 1 1 1; do
+	if gdbus call --session \
+		 --dest org.freedesktop.DBus \
+		 --object-path /org/freedesktop/DBus \
+		 --method org.freedesktop.DBus.NameHasOwner \
+		 "$PD_DEST" 2>/dev/null | grep -q true; then
+	    return 0
+	fi
+	sleep $i
+    done
+
+    printf "printerd did not start:\n" >&2
+    cat "$PD_BENCH_LOG" >&2
+    return 1
+}
+
+pd_bench_stop_daemon () {
+    if [ -n "$PD_BENCH_PID" ]; then
+	kill -INT "$PD_BENCH_PID" 2>/dev/null && wait "$PD_BENCH_PID"
+	PD_BENCH_PID=
+    fi
+}
+
+pd_bench_finish () {
+    pd_bench_stop_daemon
+
+    if [ "${#PD_BENCH_CLEANUP[@]}" -gt 0 ]; then
+	rm -rf "${PD_BENCH_CLEANUP[@]}"
+    fi
+}
+
+# Show the daemon's output, e.g. after a failure
+pd_bench_show_log () {
+    printf "printerd output:\n" >&2
+    cat "$PD_BENCH_LOG" >&2
+}
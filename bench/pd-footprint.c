@@ -0,0 +1,383 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Memory footprint probe for printerd. Creates a number of printers,
+ * or a number of jobs on one printer, and reports how much the
+ * daemon's resident set size and heap grew per object as JSON. The
+ * objects are left in place: the daemon is expected to be stopped
+ * afterwards.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <printerd/printerd.h>
+
+typedef struct
+{
+	GMainLoop	*loop;
+	PdManager	*manager;
+	PdPrinter	*printer;	/* for jobs */
+	gboolean	 jobs;
+	guint		 created;
+	guint		 in_flight;
+	guint		 done;
+	guint		 failed;
+} PdFootprint;
+
+static gchar *opt_kind = NULL;
+static gint opt_count = 1000;
+static gint opt_concurrency = 64;
+static gint opt_timeout = 600;
+static gint opt_daemon_pid = 0;
+
+static void pd_footprint_create (PdFootprint *footprint);
+
+/* Resident set size of a process, in bytes */
+static guint64
+pd_footprint_process_rss (gint pid)
+{
+	gchar *path = g_strdup_printf ("/proc/%d/status", pid);
+	gchar *contents = NULL;
+	guint64 ret = 0;
+	gchar *p;
+
+	if (g_file_get_contents (path, &contents, NULL, NULL) &&
+	    (p = strstr (contents, "VmRSS:")) != NULL)
+		ret = g_ascii_strtoull (p + strlen ("VmRSS:"), NULL, 10) * 1024;
+
+	g_free (contents);
+	g_free (path);
+	return ret;
+}
+
+/* Bytes the daemon has allocated, or -1 if it can't say. This is
+ * also a round trip, so the daemon has finished handling anything
+ * sent before it. */
+static gint64
+pd_footprint_heap_in_use (PdFootprint *footprint)
+{
+	GVariantBuilder options;
+	GVariant *metrics = NULL;
+	GError *error = NULL;
+	guint64 heap;
+	gint64 ret = -1;
+
+	g_variant_builder_init (&options, G_VARIANT_TYPE ("a{sv}"));
+	if (!pd_manager_call_get_metrics_sync (footprint->manager,
+					       g_variant_builder_end (&options),
+					       &metrics,
+					       NULL,
+					       &error)) {
+		g_printerr ("Error getting metrics: %s\n", error->message);
+		g_error_free (error);
+		goto out;
+	}
+
+	if (g_variant_lookup (metrics, "heap-in-use", "t", &heap))
+		ret = heap;
+
+	g_variant_unref (metrics);
+ out:
+	return ret;
+}
+
+static void
+pd_footprint_created (PdFootprint *footprint,
+		      gboolean ok)
+{
+	if (ok)
+		footprint->done++;
+	else
+		footprint->failed++;
+
+	footprint->in_flight--;
+	pd_footprint_create (footprint);
+}
+
+static void
+pd_footprint_create_printer_cb (GObject *source,
+				GAsyncResult *result,
+				gpointer user_data)
+{
+	PdFootprint *footprint = user_data;
+	GError *error = NULL;
+	gchar *printer_path = NULL;
+	gboolean ok;
+
+	ok = pd_manager_call_create_printer_finish (PD_MANAGER (source),
+						    &printer_path,
+						    result,
+						    &error);
+	if (!ok) {
+		g_printerr ("Error creating printer: %s\n", error->message);
+		g_error_free (error);
+	}
+
+	g_free (printer_path);
+	pd_footprint_created (footprint, ok);
+}
+
+static void
+pd_footprint_create_job_cb (GObject *source,
+			    GAsyncResult *result,
+			    gpointer user_data)
+{
+	PdFootprint *footprint = user_data;
+	GError *error = NULL;
+	gchar *job_path = NULL;
+	GVariant *unsupported = NULL;
+	gboolean ok;
+
+	ok = pd_printer_call_create_job_finish (PD_PRINTER (source),
+						&job_path,
+						&unsupported,
+						result,
+						&error);
+	if (ok)
+		g_variant_unref (unsupported);
+	else {
+		g_printerr ("Error creating job: %s\n", error->message);
+		g_error_free (error);
+	}
+
+	g_free (job_path);
+	pd_footprint_created (footprint, ok);
+}
+
+static void
+pd_footprint_create (PdFootprint *footprint)
+{
+	while (footprint->in_flight < (guint) opt_concurrency &&
+	       footprint->created < (guint) opt_count) {
+		GVariantBuilder options;
+		GVariantBuilder attributes;
+
+		g_variant_builder_init (&options, G_VARIANT_TYPE ("a{sv}"));
+		g_variant_builder_init (&attributes, G_VARIANT_TYPE ("a{sv}"));
+		if (footprint->jobs)
+			pd_printer_call_create_job (footprint->printer,
+						    g_variant_builder_end (&options),
+						    "footprint",
+						    g_variant_builder_end (&attributes),
+						    NULL, /* cancellable */
+						    pd_footprint_create_job_cb,
+						    footprint);
+		else {
+			const gchar *device_uris[] = { "file:///dev/null",
+						       NULL };
+			gchar *name = g_strdup_printf ("footprint-%u",
+						       footprint->created);
+
+			pd_manager_call_create_printer (footprint->manager,
+							g_variant_builder_end (&options),
+							name,
+							"Footprint printer",
+							"",
+							device_uris,
+							g_variant_builder_end (&attributes),
+							NULL, /* cancellable */
+							pd_footprint_create_printer_cb,
+							footprint);
+			g_free (name);
+		}
+
+		footprint->created++;
+		footprint->in_flight++;
+	}
+
+	if (footprint->in_flight == 0)
+		g_main_loop_quit (footprint->loop);
+}
+
+static gboolean
+pd_footprint_timeout_cb (gpointer user_data)
+{
+	PdFootprint *footprint = user_data;
+
+	g_printerr ("Timed out with %u of %d created\n",
+		    footprint->done, opt_count);
+	g_main_loop_quit (footprint->loop);
+	return G_SOURCE_REMOVE;
+}
+
+/* The printer that jobs are created on */
+static gboolean
+pd_footprint_create_job_printer (PdFootprint *footprint,
+				 GDBusConnection *connection)
+{
+	GVariantBuilder options, defaults;
+	const gchar *device_uris[] = { "file:///dev/null", NULL };
+	gchar *printer_path = NULL;
+	GError *error = NULL;
+
+	g_variant_builder_init (&options, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_init (&defaults, G_VARIANT_TYPE ("a{sv}"));
+	if (!pd_manager_call_create_printer_sync (footprint->manager,
+						  g_variant_builder_end (&options),
+						  "footprint",
+						  "Footprint printer",
+						  "",
+						  device_uris,
+						  g_variant_builder_end (&defaults),
+						  &printer_path,
+						  NULL,
+						  &error))
+		goto out;
+
+	footprint->printer = pd_printer_proxy_new_sync (connection,
+							G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
+							"org.freedesktop.printerd",
+							printer_path,
+							NULL,
+							&error);
+	g_free (printer_path);
+ out:
+	if (error) {
+		g_printerr ("Error creating printer: %s\n", error->message);
+		g_error_free (error);
+	}
+
+	return footprint->printer != NULL;
+}
+
+int
+main (int argc, char **argv)
+{
+	GError *error = NULL;
+	GOptionContext *opt_context;
+	GDBusConnection *connection = NULL;
+	PdFootprint footprint;
+	guint64 rss_before, rss_after;
+	gint64 heap_before, heap_after;
+	gint64 started;
+	gdouble elapsed;
+	gint ret = 1;
+	GOptionEntry opt_entries[] = {
+		{ "kind", 'k', 0, G_OPTION_ARG_STRING, &opt_kind,
+		  "What to create: jobs or printers", "KIND" },
+		{ "count", 'n', 0, G_OPTION_ARG_INT, &opt_count,
+		  "Number of objects to create", "N" },
+		{ "concurrency", 'c', 0, G_OPTION_ARG_INT, &opt_concurrency,
+		  "Number of calls in flight at once", "C" },
+		{ "daemon-pid", 0, 0, G_OPTION_ARG_INT, &opt_daemon_pid,
+		  "Process ID of printerd", "PID" },
+		{ "timeout", 't', 0, G_OPTION_ARG_INT, &opt_timeout,
+		  "Give up after this many seconds", "SECONDS" },
+		{ NULL }
+	};
+
+#if !GLIB_CHECK_VERSION(2,36,0)
+	g_type_init ();
+#endif /* glib < 2.36 */
+
+	memset (&footprint, 0, sizeof (footprint));
+	opt_context = g_option_context_new ("- printerd memory footprint");
+	g_option_context_add_main_entries (opt_context, opt_entries, NULL);
+	if (!g_option_context_parse (opt_context, &argc, &argv, &error)) {
+		g_printerr ("Error parsing options: %s\n", error->message);
+		g_error_free (error);
+		goto out;
+	}
+
+	if (g_strcmp0 (opt_kind, "jobs") == 0)
+		footprint.jobs = TRUE;
+	else if (g_strcmp0 (opt_kind, "printers") != 0) {
+		g_printerr ("Kind must be jobs or printers\n");
+		goto out;
+	}
+
+	if (!opt_daemon_pid || opt_count < 1 || opt_concurrency < 1) {
+		g_printerr ("A daemon PID and positive counts are required\n");
+		goto out;
+	}
+
+	connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+	if (!connection) {
+		g_printerr ("Error connecting to session bus: %s\n",
+			    error->message);
+		g_error_free (error);
+		goto out;
+	}
+
+	footprint.manager = pd_manager_proxy_new_sync (connection,
+						       G_DBUS_PROXY_FLAGS_NONE,
+						       "org.freedesktop.printerd",
+						       "/org/freedesktop/printerd/Manager",
+						       NULL,
+						       &error);
+	if (!footprint.manager) {
+		g_printerr ("Error getting manager: %s\n", error->message);
+		g_error_free (error);
+		goto out;
+	}
+
+	if (footprint.jobs &&
+	    !pd_footprint_create_job_printer (&footprint, connection))
+		goto out;
+
+	heap_before = pd_footprint_heap_in_use (&footprint);
+	rss_before = pd_footprint_process_rss (opt_daemon_pid);
+
+	footprint.loop = g_main_loop_new (NULL, FALSE);
+	started = g_get_monotonic_time ();
+	g_timeout_add_seconds (opt_timeout, pd_footprint_timeout_cb,
+			       &footprint);
+	pd_footprint_create (&footprint);
+	if (footprint.in_flight)
+		g_main_loop_run (footprint.loop);
+
+	elapsed = (g_get_monotonic_time () - started) / 1000000.0;
+	heap_after = pd_footprint_heap_in_use (&footprint);
+	rss_after = pd_footprint_process_rss (opt_daemon_pid);
+	if (footprint.done == 0)
+		goto out;
+
+	g_print ("{ \"kind\": \"%s\", \"count\": %u, "
+		 "\"elapsed-seconds\": %.3f, "
+		 "\"rss-bytes\": %" G_GINT64_FORMAT ", "
+		 "\"rss-per-object\": %.0f, ",
+		 opt_kind, footprint.done, elapsed,
+		 (gint64) (rss_after - rss_before),
+		 ((gdouble) rss_after - rss_before) / footprint.done);
+	if (heap_before >= 0 && heap_after >= 0)
+		g_print ("\"heap-bytes\": %" G_GINT64_FORMAT ", "
+			 "\"heap-per-object\": %.0f }\n",
+			 heap_after - heap_before,
+			 (gdouble) (heap_after - heap_before) / footprint.done);
+	else
+		g_print ("\"heap-bytes\": null, \"heap-per-object\": null }\n");
+
+	ret = (footprint.failed || footprint.in_flight) ? 1 : 0;
+ out:
+	if (footprint.printer)
+		g_object_unref (footprint.printer);
+	if (footprint.manager)
+		g_object_unref (footprint.manager);
+	if (footprint.loop)
+		g_main_loop_unref (footprint.loop);
+	if (connection)
+		g_object_unref (connection);
+	g_option_context_free (opt_context);
+	return ret;
+}
@@ -0,0 +1,627 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Load generator for printerd. Creates a number of printers with
+ * file: device URIs (or a given device URI, such as a sim: one),
+ * keeps a fixed number of SubmitJob calls in flight until enough
+ * jobs have been submitted, and reports throughput and
+ * submit-to-finished latency as JSON.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gio/gunixfdlist.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <printerd/printerd.h>
+
+#define PD_JOB_INTERFACE	"org.freedesktop.printerd.Job"
+
+typedef struct
+{
+	gint64		 submitted;
+	gint64		 finished;
+	guint		 state;
+} PdLoadJob;
+
+typedef struct
+{
+	GMainLoop	*loop;
+	GDBusConnection	*connection;
+	PdPrinter	**printers;
+	gchar		**targets;	/* file: output for each printer */
+
+	/* Jobs we have an object path for, by path */
+	GHashTable	*jobs;
+
+	/* Jobs which finished before SubmitJob returned, by path */
+	GHashTable	*early;
+
+	guint		 submitted;
+	guint		 in_flight;
+	guint		 completed;
+	guint		 failed;
+	GArray		*latencies;	/* of gint64, microseconds */
+	gint64		 started;
+	gint64		 ended;
+} PdLoad;
+
+static gint opt_printers = 4;
+static gint opt_jobs = 200;
+static gint opt_concurrency = 16;
+static gint opt_timeout = 300;
+static gint opt_daemon_pid = 0;
+static gchar *opt_document = NULL;
+static gchar *opt_output = NULL;
+static gchar *opt_label = NULL;
+static gchar *opt_device_uri = NULL;
+
+static void pd_load_submit (PdLoad *load);
+
+static gint
+pd_load_compare_usec (gconstpointer a,
+		      gconstpointer b)
+{
+	gint64 x = *(const gint64 *) a;
+	gint64 y = *(const gint64 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of sorted latencies, in milliseconds */
+static gdouble
+pd_load_percentile (GArray *sorted,
+		    gdouble percent)
+{
+	guint rank;
+
+	if (sorted->len == 0)
+		return 0.0;
+
+	rank = (guint) (percent / 100.0 * sorted->len + 0.999999);
+	rank = CLAMP (rank, 1, sorted->len);
+	return g_array_index (sorted, gint64, rank - 1) / 1000.0;
+}
+
+/* CPU time (user + system) used by a process so far, in seconds */
+static gdouble
+pd_load_process_cpu (gint pid)
+{
+	gchar *path = g_strdup_printf ("/proc/%d/stat", pid);
+	gchar *contents = NULL;
+	gchar **fields = NULL;
+	gdouble ret = 0.0;
+	gchar *p;
+
+	if (!g_file_get_contents (path, &contents, NULL, NULL))
+		goto out;
+
+	/* Fields after the command name, which may contain spaces;
+	 * utime and stime are the 12th and 13th of these */
+	p = strrchr (contents, ')');
+	if (!p)
+		goto out;
+
+	fields = g_strsplit (p + 2, " ", 0);
+	if (g_strv_length (fields) < 13)
+		goto out;
+
+	ret = (g_ascii_strtoull (fields[11], NULL, 10) +
+	       g_ascii_strtoull (fields[12], NULL, 10)) /
+		(gdouble) sysconf (_SC_CLK_TCK);
+ out:
+	g_strfreev (fields);
+	g_free (contents);
+	g_free (path);
+	return ret;
+}
+
+/* Peak resident set size of a process, in kB */
+static guint64
+pd_load_process_peak_rss (gint pid)
+{
+	gchar *path = g_strdup_printf ("/proc/%d/status", pid);
+	gchar *contents = NULL;
+	guint64 ret = 0;
+	gchar *p;
+
+	if (g_file_get_contents (path, &contents, NULL, NULL) &&
+	    (p = strstr (contents, "VmHWM:")) != NULL)
+		ret = g_ascii_strtoull (p + strlen ("VmHWM:"), NULL, 10);
+
+	g_free (contents);
+	g_free (path);
+	return ret;
+}
+
+static void
+pd_load_finish_job (PdLoad *load,
+		    PdLoadJob *job)
+{
+	if (job->state == PD_JOB_STATE_COMPLETED) {
+		gint64 latency = job->finished - job->submitted;
+		g_array_append_val (load->latencies, latency);
+		load->completed++;
+	} else
+		load->failed++;
+
+	load->in_flight--;
+	pd_load_submit (load);
+}
+
+static void
+pd_load_properties_changed (GDBusConnection *connection,
+			    const gchar *sender_name,
+			    const gchar *object_path,
+			    const gchar *interface_name,
+			    const gchar *signal_name,
+			    GVariant *parameters,
+			    gpointer user_data)
+{
+	PdLoad *load = user_data;
+	GVariant *changed = NULL;
+	PdLoadJob *job;
+	guint state;
+
+	g_variant_get (parameters, "(&s@a{sv}@as)", NULL, &changed, NULL);
+	if (!g_variant_lookup (changed, "State", "u", &state) ||
+	    state < PD_JOB_STATE_CANCELED)
+		goto out;
+
+	job = g_hash_table_lookup (load->jobs, object_path);
+	if (job) {
+		if (job->finished)
+			goto out;
+
+		job->finished = g_get_monotonic_time ();
+		job->state = state;
+		pd_load_finish_job (load, job);
+	} else {
+		/* SubmitJob hasn't returned yet */
+		job = g_new0 (PdLoadJob, 1);
+		job->finished = g_get_monotonic_time ();
+		job->state = state;
+		g_hash_table_insert (load->early,
+				     g_strdup (object_path), job);
+	}
+ out:
+	if (changed)
+		g_variant_unref (changed);
+}
+
+static void
+pd_load_submit_cb (GObject *source,
+		   GAsyncResult *result,
+		   gpointer user_data)
+{
+	PdLoadJob *job = user_data;
+	PdLoad *load = g_object_get_data (source, "pd-load");
+	GError *error = NULL;
+	gchar *job_path = NULL;
+	GVariant *unsupported = NULL;
+	PdLoadJob *early;
+
+	if (!pd_printer_call_submit_job_finish (PD_PRINTER (source),
+						&job_path,
+						&unsupported,
+						NULL, /* out_fd_list */
+						result,
+						&error)) {
+		g_printerr ("Error submitting job: %s\n", error->message);
+		g_error_free (error);
+		g_free (job);
+		load->failed++;
+		load->in_flight--;
+		pd_load_submit (load);
+		return;
+	}
+
+	g_variant_unref (unsupported);
+	early = g_hash_table_lookup (load->early, job_path);
+	if (early) {
+		job->finished = early->finished;
+		job->state = early->state;
+		g_hash_table_remove (load->early, job_path);
+	}
+
+	g_hash_table_insert (load->jobs, job_path, job);
+	if (job->finished)
+		pd_load_finish_job (load, job);
+}
+
+static void
+pd_load_submit (PdLoad *load)
+{
+	while (load->in_flight < (guint) opt_concurrency &&
+	       load->submitted < (guint) opt_jobs) {
+		PdPrinter *printer = load->printers[load->submitted %
+						    opt_printers];
+		GUnixFDList *fd_list;
+		GVariantBuilder options;
+		GVariantBuilder attributes;
+		PdLoadJob *job;
+		gint fd;
+
+		/* Each job needs its own file offset */
+		fd = open (opt_document, O_RDONLY);
+		if (fd == -1) {
+			g_printerr ("Error opening %s: %s\n", opt_document,
+				    g_strerror (errno));
+			g_main_loop_quit (load->loop);
+			return;
+		}
+
+		fd_list = g_unix_fd_list_new_from_array (&fd, 1);
+		g_variant_builder_init (&options, G_VARIANT_TYPE ("a{sv}"));
+		g_variant_builder_init (&attributes, G_VARIANT_TYPE ("a{sv}"));
+
+		job = g_new0 (PdLoadJob, 1);
+		job->submitted = g_get_monotonic_time ();
+		pd_printer_call_submit_job (printer,
+					    g_variant_builder_end (&options),
+					    "bench",
+					    g_variant_builder_end (&attributes),
+					    g_variant_new_handle (0),
+					    fd_list,
+					    NULL, /* cancellable */
+					    pd_load_submit_cb,
+					    job);
+		g_object_unref (fd_list);
+		load->submitted++;
+		load->in_flight++;
+	}
+
+	if (load->in_flight == 0) {
+		load->ended = g_get_monotonic_time ();
+		g_main_loop_quit (load->loop);
+	}
+}
+
+static gboolean
+pd_load_timeout_cb (gpointer user_data)
+{
+	PdLoad *load = user_data;
+
+	g_printerr ("Timed out with %u jobs unfinished\n", load->in_flight);
+	load->ended = g_get_monotonic_time ();
+	g_main_loop_quit (load->loop);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean
+pd_load_create_printers (PdLoad *load)
+{
+	PdManager *manager;
+	GError *error = NULL;
+	gboolean ret = FALSE;
+	gint i;
+
+	manager = pd_manager_proxy_new_sync (load->connection,
+					     G_DBUS_PROXY_FLAGS_NONE,
+					     "org.freedesktop.printerd",
+					     "/org/freedesktop/printerd/Manager",
+					     NULL,
+					     &error);
+	if (!manager) {
+		g_printerr ("Error getting manager: %s\n", error->message);
+		g_error_free (error);
+		return FALSE;
+	}
+
+	load->printers = g_new0 (PdPrinter *, opt_printers);
+	load->targets = g_new0 (gchar *, opt_printers + 1);
+	for (i = 0; i < opt_printers; i++) {
+		GVariantBuilder options, defaults;
+		const gchar *device_uris[2];
+		gchar *name = g_strdup_printf ("bench-%d-%d", getpid (), i);
+		gchar *printer_path = NULL;
+		gchar *uri;
+		gint fd;
+
+		if (opt_device_uri)
+			uri = g_strdup (opt_device_uri);
+		else {
+			fd = g_file_open_tmp ("printerd-bench.XXXXXX",
+					      &load->targets[i], &error);
+			if (fd == -1) {
+				g_printerr ("Error creating output file: %s\n",
+					    error->message);
+				g_error_free (error);
+				g_free (name);
+				goto out;
+			}
+
+			close (fd);
+			uri = g_filename_to_uri (load->targets[i], NULL, NULL);
+		}
+
+		device_uris[0] = uri;
+		device_uris[1] = NULL;
+		g_variant_builder_init (&options, G_VARIANT_TYPE ("a{sv}"));
+		g_variant_builder_init (&defaults, G_VARIANT_TYPE ("a{sv}"));
+		if (!pd_manager_call_create_printer_sync (manager,
+							  g_variant_builder_end (&options),
+							  name,
+							  "Benchmark printer",
+							  "",
+							  device_uris,
+							  g_variant_builder_end (&defaults),
+							  &printer_path,
+							  NULL,
+							  &error)) {
+			g_printerr ("Error creating printer: %s\n",
+				    error->message);
+			g_error_free (error);
+			g_free (name);
+			g_free (uri);
+			goto out;
+		}
+
+		load->printers[i] = pd_printer_proxy_new_sync (load->connection,
+							       G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
+							       "org.freedesktop.printerd",
+							       printer_path,
+							       NULL,
+							       &error);
+		g_free (printer_path);
+		g_free (name);
+		g_free (uri);
+		if (!load->printers[i]) {
+			g_printerr ("Error getting printer: %s\n",
+				    error->message);
+			g_error_free (error);
+			goto out;
+		}
+
+		g_object_set_data (G_OBJECT (load->printers[i]),
+				   "pd-load", load);
+	}
+
+	ret = TRUE;
+ out:
+	g_object_unref (manager);
+	return ret;
+}
+
+static void
+pd_load_delete_printers (PdLoad *load)
+{
+	PdManager *manager;
+	gint i;
+
+	manager = pd_manager_proxy_new_sync (load->connection,
+					     G_DBUS_PROXY_FLAGS_NONE,
+					     "org.freedesktop.printerd",
+					     "/org/freedesktop/printerd/Manager",
+					     NULL,
+					     NULL);
+	for (i = 0; i < opt_printers; i++) {
+		GVariantBuilder options;
+
+		if (!load->printers || !load->printers[i])
+			continue;
+
+		g_variant_builder_init (&options, G_VARIANT_TYPE ("a{sv}"));
+		if (manager)
+			pd_manager_call_delete_printer_sync (manager,
+							     g_variant_builder_end (&options),
+							     g_dbus_proxy_get_object_path (G_DBUS_PROXY (load->printers[i])),
+							     NULL,
+							     NULL);
+		g_object_unref (load->printers[i]);
+	}
+
+	for (i = 0; load->targets && load->targets[i]; i++)
+		g_unlink (load->targets[i]);
+
+	g_free (load->printers);
+	g_strfreev (load->targets);
+	if (manager)
+		g_object_unref (manager);
+}
+
+static gchar *
+pd_load_report (PdLoad *load,
+		gdouble cpu,
+		guint64 peak_rss)
+{
+	GString *json = g_string_new ("{\n");
+	gdouble elapsed = (load->ended - load->started) / 1000000.0;
+	gchar *label;
+	gchar *device_uri;
+	struct stat st;
+
+	g_array_sort (load->latencies, pd_load_compare_usec);
+	if (g_stat (opt_document, &st) != 0)
+		st.st_size = 0;
+
+	label = g_strescape (opt_label ? opt_label : "", NULL);
+	g_string_append_printf (json, "  \"label\": \"%s\",\n", label);
+	device_uri = g_strescape (opt_device_uri ? opt_device_uri : "file:", NULL);
+	g_string_append_printf (json, "  \"device-uri\": \"%s\",\n", device_uri);
+	g_string_append_printf (json, "  \"printers\": %d,\n", opt_printers);
+	g_string_append_printf (json, "  \"jobs\": %d,\n", opt_jobs);
+	g_string_append_printf (json, "  \"concurrency\": %d,\n",
+				opt_concurrency);
+	g_string_append_printf (json,
+				"  \"document-bytes\": %" G_GUINT64_FORMAT ",\n",
+				(guint64) st.st_size);
+	g_string_append_printf (json, "  \"completed\": %u,\n",
+				load->completed);
+	g_string_append_printf (json, "  \"failed\": %u,\n", load->failed);
+	g_string_append_printf (json, "  \"unfinished\": %u,\n",
+				load->in_flight);
+	g_string_append_printf (json, "  \"elapsed-seconds\": %.3f,\n",
+				elapsed);
+	g_string_append_printf (json, "  \"jobs-per-second\": %.2f,\n",
+				elapsed > 0 ? load->completed / elapsed : 0.0);
+	g_string_append_printf (json,
+				"  \"latency-ms\": { \"p50\": %.2f, \"p95\": %.2f,"
+				" \"p99\": %.2f, \"max\": %.2f },\n",
+				pd_load_percentile (load->latencies, 50),
+				pd_load_percentile (load->latencies, 95),
+				pd_load_percentile (load->latencies, 99),
+				pd_load_percentile (load->latencies, 100));
+	g_string_append_printf (json, "  \"daemon-cpu-seconds\": %.3f,\n",
+				cpu);
+	g_string_append_printf (json,
+				"  \"daemon-peak-rss-kb\": %" G_GUINT64_FORMAT "\n",
+				peak_rss);
+	g_string_append (json, "}\n");
+	g_free (label);
+	g_free (device_uri);
+	return g_string_free (json, FALSE);
+}
+
+int
+main (int argc, char **argv)
+{
+	GError *error = NULL;
+	GOptionContext *opt_context;
+	PdLoad load;
+	gdouble cpu_before = 0.0;
+	gdouble cpu = 0.0;
+	guint64 peak_rss = 0;
+	guint signal_id = 0;
+	gchar *report = NULL;
+	gint ret = 1;
+	GOptionEntry opt_entries[] = {
+		{ "printers", 'p', 0, G_OPTION_ARG_INT, &opt_printers,
+		  "Number of printers to create", "N" },
+		{ "jobs", 'j', 0, G_OPTION_ARG_INT, &opt_jobs,
+		  "Number of jobs to submit", "M" },
+		{ "concurrency", 'c', 0, G_OPTION_ARG_INT, &opt_concurrency,
+		  "Number of submissions in flight at once", "C" },
+		{ "document", 'd', 0, G_OPTION_ARG_FILENAME, &opt_document,
+		  "Document to print", "FILE" },
+		{ "daemon-pid", 0, 0, G_OPTION_ARG_INT, &opt_daemon_pid,
+		  "Process ID of printerd, for CPU and memory usage", "PID" },
+		{ "timeout", 't', 0, G_OPTION_ARG_INT, &opt_timeout,
+		  "Give up after this many seconds", "SECONDS" },
+		{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output,
+		  "Also write the JSON report to this file", "FILE" },
+		{ "label", 'l', 0, G_OPTION_ARG_STRING, &opt_label,
+		  "Label for the report, e.g. a commit ID", "LABEL" },
+		{ "device-uri", 'u', 0, G_OPTION_ARG_STRING, &opt_device_uri,
+		  "Device URI for the printers instead of a file", "URI" },
+		{ NULL }
+	};
+
+#if !GLIB_CHECK_VERSION(2,36,0)
+	g_type_init ();
+#endif /* glib < 2.36 */
+
+	memset (&load, 0, sizeof (load));
+	opt_context = g_option_context_new ("- printerd load generator");
+	g_option_context_add_main_entries (opt_context, opt_entries, NULL);
+	if (!g_option_context_parse (opt_context, &argc, &argv, &error)) {
+		g_printerr ("Error parsing options: %s\n", error->message);
+		g_error_free (error);
+		goto out;
+	}
+
+	if (!opt_document || opt_printers < 1 || opt_jobs < 1 ||
+	    opt_concurrency < 1) {
+		g_printerr ("A document and positive counts are required\n");
+		goto out;
+	}
+
+	load.connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+	if (!load.connection) {
+		g_printerr ("Error connecting to session bus: %s\n",
+			    error->message);
+		g_error_free (error);
+		goto out;
+	}
+
+	load.loop = g_main_loop_new (NULL, FALSE);
+	load.jobs = g_hash_table_new_full (g_str_hash, g_str_equal,
+					   g_free, g_free);
+	load.early = g_hash_table_new_full (g_str_hash, g_str_equal,
+					    g_free, g_free);
+	load.latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+	if (!pd_load_create_printers (&load))
+		goto out;
+
+	signal_id = g_dbus_connection_signal_subscribe (load.connection,
+							"org.freedesktop.printerd",
+							"org.freedesktop.DBus.Properties",
+							"PropertiesChanged",
+							NULL, /* object path */
+							PD_JOB_INTERFACE,
+							G_DBUS_SIGNAL_FLAGS_NONE,
+							pd_load_properties_changed,
+							&load,
+							NULL);
+
+	if (opt_daemon_pid)
+		cpu_before = pd_load_process_cpu (opt_daemon_pid);
+
+	load.started = g_get_monotonic_time ();
+	g_timeout_add_seconds (opt_timeout, pd_load_timeout_cb, &load);
+	pd_load_submit (&load);
+	if (load.in_flight)
+		g_main_loop_run (load.loop);
+
+	if (opt_daemon_pid) {
+		cpu = pd_load_process_cpu (opt_daemon_pid) - cpu_before;
+		peak_rss = pd_load_process_peak_rss (opt_daemon_pid);
+	}
+
+	report = pd_load_report (&load, cpu, peak_rss);
+	g_print ("%s", report);
+	if (opt_output &&
+	    !g_file_set_contents (opt_output, report, -1, &error)) {
+		g_printerr ("Error writing %s: %s\n", opt_output,
+			    error->message);
+		g_error_free (error);
+		goto out;
+	}
+
+	ret = (load.failed || load.in_flight) ? 1 : 0;
+ out:
+	if (signal_id)
+		g_dbus_connection_signal_unsubscribe (load.connection,
+						      signal_id);
+	if (load.connection)
+		pd_load_delete_printers (&load);
+	if (load.jobs)
+		g_hash_table_unref (load.jobs);
+	if (load.early)
+		g_hash_table_unref (load.early);
+	if (load.latencies)
+		g_array_free (load.latencies, TRUE);
+	if (load.loop)
+		g_main_loop_unref (load.loop);
+	if (load.connection)
+		g_object_unref (load.connection);
+	g_option_context_free (opt_context);
+	g_free (report);
+	return ret;
+}
@@ -0,0 +1,385 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Micro-benchmarks for helpers the daemon calls for every job or
+ * every line of filter output. Each case is run for long enough to
+ * give a stable time, and the time and number of heap allocations
+ * per call are reported as JSON.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "src/pd-common.h"
+#include "src/pd-job-impl.h"
+#include "src/pd-printer-impl.h"
+
+typedef void (*PdBenchFunc) (gpointer data, guint64 i);
+
+static gint opt_min_time = 200;		/* milliseconds per case */
+static gchar *opt_filter = NULL;
+
+/*
+ * Allocations are counted by wrapping the C library's allocator.
+ * GLib uses it for g_malloc(); run with G_SLICE=always-malloc so
+ * that g_slice_alloc() is counted as well. The benchmarks are
+ * single-threaded so the counter needs no locking.
+ */
+static guint64 allocations;
+static guint n_results;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+void *
+malloc (size_t size)
+{
+	allocations++;
+	return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+	allocations++;
+	return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+	allocations++;
+	return __libc_realloc (ptr, size);
+}
+#endif /* __GLIBC__ */
+
+static void
+pd_bench_run (GString *json,
+	      const gchar *name,
+	      PdBenchFunc func,
+	      gpointer data)
+{
+	guint64 iterations = 1;
+	guint64 allocs;
+	gint64 elapsed;
+	guint64 i;
+
+	if (opt_filter && !strstr (name, opt_filter))
+		return;
+
+	/* Warm up */
+	func (data, 0);
+
+	/* Double the iterations until the run is long enough */
+	for (;;) {
+		gint64 start;
+
+		allocs = allocations;
+		start = g_get_monotonic_time ();
+		for (i = 0; i < iterations; i++)
+			func (data, i);
+
+		elapsed = g_get_monotonic_time () - start;
+		allocs = allocations - allocs;
+		if (elapsed >= opt_min_time * 1000 ||
+		    iterations >= G_GUINT64_CONSTANT (1) << 32)
+			break;
+
+		iterations *= 2;
+	}
+
+	if (n_results++)
+		g_string_append (json, ",\n");
+
+	g_string_append_printf (json,
+				"    { \"name\": \"%s\", \"iterations\": %"
+				G_GUINT64_FORMAT ", \"ns-per-op\": %.1f, ",
+				name, iterations,
+				elapsed * 1000.0 / iterations);
+#ifdef __GLIBC__
+	g_string_append_printf (json, "\"allocs-per-op\": %.2f }",
+				(gdouble) allocs / iterations);
+#else
+	g_string_append (json, "\"allocs-per-op\": null }");
+#endif /* __GLIBC__ */
+}
+
+/* IEEE 1284 Device IDs as reported by real printers */
+static const gchar *device_ids[] = {
+	"MFG:HP;MDL:HP LaserJet 4250;CMD:PJL,MLC,PCL,PCLXL,POSTSCRIPT;"
+	"CLS:PRINTER;DES:Hewlett-Packard LaserJet 4250;",
+
+	"MFG:EPSON;CMD:ESCPL2,BDC,D4,D4PX,ESCPR7,END4,GENEP,URF;"
+	"MDL:XP-630 Series;CLS:PRINTER;DES:EPSON XP-630 Series;"
+	"CID:EpsonRGB;FID:FXN,DPA,WFA,ETN,AFN,DAN,WRA;RID:40;DDS:022500;"
+	"ELG:1263;SN:503258463338303931;URF:CP1,PQ4-5,OB9,OFU0,RS360,"
+	"SRGB24,W8,DM3,IS1-7-6,V1.4,MT1-3-7-8-10-11-12;",
+
+	"MANUFACTURER:Brother;COMMAND SET:PJL,PCL,PCLXL,URF;"
+	"MODEL:HL-L2340D series;CLASS:PRINTER;CID:Brother Laser Type1;"
+	"URF:W8,CP1,IS4-1,MT1-3-4-5-8,OB10,PQ4,RS300-600,V1.3,DM1;",
+
+	"MFG:Canon;CMD:BJL,BJRaster3,BSCCe,NCCe,IVEC,IVECPLI;"
+	"SOJ:BJNP2,BJNPe;MDL:MG5200 series;CLS:PRINTER;"
+	"DES:Canon MG5200 series;VER:1.070;STA:10;FSI:03;HRI:ON;MSI:E3,HD;"
+	"PDR:4;PSE:HCCDG;",
+};
+
+static void
+bench_parse_ieee1284_id (gpointer data,
+			 guint64 i)
+{
+	GHashTable *fields;
+
+	fields = pd_parse_ieee1284_id (device_ids[i % G_N_ELEMENTS (device_ids)]);
+	g_hash_table_unref (fields);
+}
+
+static const gchar *state_reasons[] = {
+	"media-low",
+	"toner-low",
+	"cover-open",
+	"other",
+	NULL
+};
+
+static void
+bench_add_state_reason (gpointer data,
+			guint64 i)
+{
+	g_strfreev (add_or_remove_state_reason (state_reasons, '+',
+						"media-empty"));
+}
+
+static void
+bench_remove_state_reason (gpointer data,
+			   guint64 i)
+{
+	g_strfreev (add_or_remove_state_reason (state_reasons, '-',
+						"cover-open"));
+}
+
+typedef struct
+{
+	GVariant	*attributes;
+	GVariant	*updates;
+	gchar		*last_key;
+	PdJobImpl	*job;
+} BenchAttributes;
+
+static BenchAttributes *
+bench_attributes_new (guint n)
+{
+	BenchAttributes *attrs = g_new0 (BenchAttributes, 1);
+	GVariantBuilder builder;
+	GHashTable *defaults;
+	guint i;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	for (i = 0; i < n; i++) {
+		gchar *key = g_strdup_printf ("attribute-%u", i);
+		gchar *value = g_strdup_printf ("value-%u", i);
+		g_variant_builder_add (&builder, "{sv}", key,
+				       g_variant_new_string (value));
+		g_free (key);
+		g_free (value);
+	}
+
+	attrs->attributes = g_variant_ref_sink (g_variant_builder_end (&builder));
+	attrs->last_key = g_strdup_printf ("attribute-%u", n - 1);
+
+	/* One replacement and two new attributes */
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (&builder, "{sv}", "attribute-0",
+			       g_variant_new_string ("replaced"));
+	g_variant_builder_add (&builder, "{sv}", "media",
+			       g_variant_new_string ("iso-a4"));
+	g_variant_builder_add (&builder, "{sv}", "job-originating-user-name",
+			       g_variant_new_string ("user"));
+	attrs->updates = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+	/* A job created with the updates, over the attributes as
+	 * printer defaults */
+	defaults = pd_attribute_table_new (attrs->attributes);
+	attrs->job = g_object_new (PD_TYPE_JOB_IMPL,
+				   "defaults", defaults,
+				   "attributes", attrs->updates,
+				   NULL);
+	g_hash_table_unref (defaults);
+	return attrs;
+}
+
+static void
+bench_attributes_free (BenchAttributes *attrs)
+{
+	g_variant_unref (attrs->attributes);
+	g_variant_unref (attrs->updates);
+	g_free (attrs->last_key);
+	g_free (attrs);
+
+	/* The job is left alone, as the jobs in main() are */
+}
+
+static void
+bench_update_attributes (gpointer data,
+			 guint64 i)
+{
+	BenchAttributes *attrs = data;
+
+	g_variant_unref (g_variant_ref_sink (update_attributes (attrs->attributes,
+								attrs->updates)));
+}
+
+/* Nothing else uses the job, so its lock is not needed */
+static void
+bench_job_get_attribute (gpointer data,
+			 guint64 i)
+{
+	BenchAttributes *attrs = data;
+
+	pd_job_impl_get_attribute (attrs->job, attrs->last_key);
+}
+
+typedef struct
+{
+	PdPrinterImpl	*printer;
+	GVariant	*value;
+} BenchSupported;
+
+static const gchar *supported_media[] = {
+	"iso-a5", "iso-a4", "iso-a3", "na-letter", "na-legal",
+	"na-ledger", "jis-b5", "iso-b5", "om-small-photo", "na-index-4x6",
+	NULL
+};
+
+static void
+bench_attribute_value_is_supported (gpointer data,
+				    guint64 i)
+{
+	BenchSupported *supported = data;
+
+	pd_printer_impl_attribute_value_is_supported (supported->printer,
+						      "media",
+						      supported->value);
+}
+
+static const gchar *stderr_lines[] = {
+	"STATE: +media-low",
+	"STATE: -media-low",
+	"STATE: +toner-low-warning,cover-open-warning",
+	"STATE: -toner-low-warning,cover-open-warning",
+	"DEBUG: not a state line",
+};
+
+static void
+bench_parse_stderr (gpointer data,
+		    guint64 i)
+{
+	pd_job_impl_parse_stderr (data,
+				  stderr_lines[i % G_N_ELEMENTS (stderr_lines)]);
+}
+
+int
+main (int argc, char **argv)
+{
+	GError *error = NULL;
+	GOptionContext *opt_context;
+	GString *json;
+	BenchSupported supported;
+	GVariantBuilder builder;
+	PdJobImpl *job;
+	guint sizes[] = { 10, 100, 1000 };
+	guint i;
+	gint ret = 1;
+	GOptionEntry opt_entries[] = {
+		{ "min-time", 't', 0, G_OPTION_ARG_INT, &opt_min_time,
+		  "Run each case for at least this long", "MS" },
+		{ "filter", 'f', 0, G_OPTION_ARG_STRING, &opt_filter,
+		  "Only run cases whose names contain this", "TEXT" },
+		{ NULL }
+	};
+
+#if !GLIB_CHECK_VERSION(2,36,0)
+	g_type_init ();
+#endif /* glib < 2.36 */
+
+	opt_context = g_option_context_new ("- printerd micro-benchmarks");
+	g_option_context_add_main_entries (opt_context, opt_entries, NULL);
+	if (!g_option_context_parse (opt_context, &argc, &argv, &error)) {
+		g_printerr ("Error parsing options: %s\n", error->message);
+		g_error_free (error);
+		goto out;
+	}
+
+	json = g_string_new ("{\n  \"results\": [\n");
+
+	pd_bench_run (json, "parse-ieee1284-id",
+		      bench_parse_ieee1284_id, NULL);
+	pd_bench_run (json, "add-state-reason",
+		      bench_add_state_reason, NULL);
+	pd_bench_run (json, "remove-state-reason",
+		      bench_remove_state_reason, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS (sizes); i++) {
+		BenchAttributes *attrs = bench_attributes_new (sizes[i]);
+		gchar *name;
+
+		name = g_strdup_printf ("update-attributes-%u", sizes[i]);
+		pd_bench_run (json, name, bench_update_attributes, attrs);
+		g_free (name);
+
+		name = g_strdup_printf ("job-get-attribute-%u", sizes[i]);
+		pd_bench_run (json, name, bench_job_get_attribute, attrs);
+		g_free (name);
+
+		bench_attributes_free (attrs);
+	}
+
+	/* The printer and job are never exported, and are left
+	 * alone at exit as they have no daemon */
+	supported.printer = g_object_new (PD_TYPE_PRINTER_IMPL, NULL);
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (&builder, "{sv}", "media",
+			       g_variant_new_strv (supported_media, -1));
+	pd_printer_set_supported (PD_PRINTER (supported.printer),
+				  g_variant_builder_end (&builder));
+	supported.value = g_variant_ref_sink (g_variant_new_string ("na-index-4x6"));
+	pd_bench_run (json, "attribute-value-is-supported",
+		      bench_attribute_value_is_supported, &supported);
+	g_variant_unref (supported.value);
+
+	job = g_object_new (PD_TYPE_JOB_IMPL, NULL);
+	pd_bench_run (json, "parse-stderr", bench_parse_stderr, job);
+
+	g_string_append (json, "\n  ]\n}\n");
+	g_print ("%s", json->str);
+	g_string_free (json, TRUE);
+	ret = 0;
+ out:
+	g_option_context_free (opt_context);
+	return ret;
+}
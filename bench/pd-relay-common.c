@@ -0,0 +1,97 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "pd-relay-common.h"
+
+/**
+ * pd_relay_uri_string_option:
+ * @uri: (allow-none): A device URI such as "sink:/?rate=1048576".
+ * @name: Option name.
+ *
+ * Returns: The unescaped value of option @name in the query part of
+ * @uri, or %NULL. Free with g_free().
+ */
+gchar *
+pd_relay_uri_string_option (const gchar *uri,
+			    const gchar *name)
+{
+	const gchar *query;
+	gchar **options = NULL;
+	gchar **option;
+	gchar *ret = NULL;
+	gsize len = strlen (name);
+
+	if (uri == NULL || (query = strchr (uri, '?')) == NULL)
+		goto out;
+
+	options = g_strsplit (query + 1, "&", 0);
+	for (option = options; *option; option++)
+		if (!strncmp (*option, name, len) && (*option)[len] == '=') {
+			ret = g_uri_unescape_string (*option + len + 1, NULL);
+			break;
+		}
+ out:
+	g_strfreev (options);
+	return ret;
+}
+
+/**
+ * pd_relay_uri_option:
+ * @uri: (allow-none): A device URI.
+ * @name: Option name.
+ * @default_value: Value to use if the option is not given.
+ *
+ * Returns: The numeric value of option @name in @uri. The suffixes
+ * K, M and G multiply it by 1024, 1024^2 and 1024^3.
+ */
+guint64
+pd_relay_uri_option (const gchar *uri,
+		     const gchar *name,
+		     guint64 default_value)
+{
+	gchar *value = pd_relay_uri_string_option (uri, name);
+	guint64 ret = default_value;
+	gchar *end;
+
+	if (value == NULL)
+		return ret;
+
+	ret = g_ascii_strtoull (value, &end, 10);
+	switch (*end) {
+	case 'G':
+		ret *= 1024;
+		/* fall through */
+	case 'M':
+		ret *= 1024;
+		/* fall through */
+	case 'K':
+		ret *= 1024;
+		break;
+	}
+
+	g_free (value);
+	return ret;
+}
@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __PD_RELAY_COMMON_H__
+#define __PD_RELAY_COMMON_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Size of each read and write by the relay benchmark's filter and
+ * backend */
+#define PD_RELAY_CHUNK	65536
+
+guint64	 pd_relay_uri_option		(const gchar *uri,
+					 const gchar *name,
+					 guint64 default_value);
+gchar	*pd_relay_uri_string_option	(const gchar *uri,
+					 const gchar *name);
+
+G_END_DECLS
+
+#endif /* __PD_RELAY_COMMON_H__ */
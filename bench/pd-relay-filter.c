@@ -0,0 +1,71 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Synthetic last filter for the relay benchmark. It discards the
+ * document and instead writes as many bytes as the "size" option in
+ * the device URI asks for, as fast as the daemon will take them.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "pd-relay-common.h"
+
+int
+main (int argc, char **argv)
+{
+	static gchar buffer[PD_RELAY_CHUNK];
+	guint64 size;
+	guint64 left;
+	ssize_t got;
+
+	size = pd_relay_uri_option (g_getenv ("DEVICE_URI"), "size",
+				    1024 * 1024);
+
+	/* Consume the document */
+	do
+		got = read (STDIN_FILENO, buffer, sizeof (buffer));
+	while (got > 0 || (got == -1 && errno == EINTR));
+
+	memset (buffer, 'x', sizeof (buffer));
+	for (left = size; left > 0; ) {
+		ssize_t wrote = write (STDOUT_FILENO, buffer,
+				       MIN (left, sizeof (buffer)));
+		if (wrote == -1) {
+			if (errno == EINTR)
+				continue;
+
+			fprintf (stderr, "ERROR: write: %s\n",
+				 g_strerror (errno));
+			return 1;
+		}
+
+		left -= wrote;
+	}
+
+	return 0;
+}
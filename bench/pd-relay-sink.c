@@ -0,0 +1,106 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Sink backend for the relay benchmark. Reads everything it is sent,
+ * no faster than the "rate" option in the device URI (bytes per
+ * second, 0 for no limit), then writes what it received and how long
+ * that took to the file named by the "report" option.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "pd-relay-common.h"
+
+int
+main (int argc, char **argv)
+{
+	static gchar buffer[PD_RELAY_CHUNK];
+	const gchar *uri = g_getenv ("DEVICE_URI");
+	guint64 rate;
+	gchar *report;
+	guint64 total = 0;
+	guint64 reads = 0;
+	gint64 first = 0;
+	gint64 last = 0;
+	FILE *f;
+
+	/* Run with no arguments: no devices to report */
+	if (argc == 1)
+		return 0;
+
+	rate = pd_relay_uri_option (uri, "rate", 0);
+	report = pd_relay_uri_string_option (uri, "report");
+
+	for (;;) {
+		ssize_t got = read (STDIN_FILENO, buffer, sizeof (buffer));
+		gint64 now = g_get_monotonic_time ();
+
+		if (got == -1 && errno == EINTR)
+			continue;
+
+		if (got == -1) {
+			fprintf (stderr, "ERROR: read: %s\n",
+				 g_strerror (errno));
+			return 1;
+		}
+
+		if (got == 0)
+			break;
+
+		if (!first)
+			first = now;
+
+		last = now;
+		total += got;
+		reads++;
+
+		/* Don't get ahead of the configured rate */
+		if (rate) {
+			gint64 due = first + total * G_USEC_PER_SEC / rate;
+			if (due > now)
+				g_usleep (due - now);
+		}
+	}
+
+	if (report) {
+		f = fopen (report, "w");
+		if (f == NULL) {
+			fprintf (stderr, "ERROR: %s: %s\n", report,
+				 g_strerror (errno));
+			return 1;
+		}
+
+		fprintf (f, "bytes=%" G_GUINT64_FORMAT
+			 " reads=%" G_GUINT64_FORMAT
+			 " usec=%" G_GINT64_FORMAT "\n",
+			 total, reads, last - first);
+		fclose (f);
+		g_free (report);
+	}
+
+	return 0;
+}
@@ -0,0 +1,156 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Simulated printer backend, for "sim:" device URIs. It behaves like
+ * a slow printer: it consumes job data at a limited rate and reports
+ * progress with STATE:, INFO: and PAGE: messages. Options are given
+ * in the query part of the URI, e.g.
+ *
+ *   sim:/?rate=256K&page-size=128K&stall-at=1M&stall=5000
+ *
+ * Sizes may use the suffixes K, M and G; times are in milliseconds.
+ *
+ *   rate        bytes per second accepted, 0 for no limit (default 1M)
+ *   page-size   bytes per page for PAGE: messages (default 64K)
+ *   connect     time spent connecting before accepting data (100)
+ *   stall-at    stall once this many bytes have been read
+ *   stall       how long to stall for (default 0)
+ *   error-at    fail once this many bytes have been read
+ *   error-code  exit code to fail with (default 1, CUPS_BACKEND_FAILED)
+ *   exit-delay  time to wait after the last byte before exiting (0)
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "pd-relay-common.h"
+
+/* From <cups/backend.h> */
+#define CUPS_BACKEND_OK		0
+
+static void
+sim_sleep_ms (guint64 ms)
+{
+	if (ms)
+		g_usleep (ms * 1000);
+}
+
+int
+main (int argc, char **argv)
+{
+	static gchar buffer[PD_RELAY_CHUNK];
+	const gchar *uri = g_getenv ("DEVICE_URI");
+	guint64 rate, page_size, connect_ms, stall_at, stall, error_at;
+	guint64 error_code, exit_delay;
+	guint64 total = 0;
+	guint64 page_bytes = 0;
+	guint page = 0;
+	gboolean stalled = FALSE;
+	gint64 started = 0;
+
+	/* Run with no arguments: list the one device */
+	if (argc == 1) {
+		printf ("direct sim \"Unknown\" \"Simulated printer\"\n");
+		return CUPS_BACKEND_OK;
+	}
+
+	rate = pd_relay_uri_option (uri, "rate", 1024 * 1024);
+	page_size = MAX (1, pd_relay_uri_option (uri, "page-size", 64 * 1024));
+	connect_ms = pd_relay_uri_option (uri, "connect", 100);
+	stall_at = pd_relay_uri_option (uri, "stall-at", G_MAXUINT64);
+	stall = pd_relay_uri_option (uri, "stall", 0);
+	error_at = pd_relay_uri_option (uri, "error-at", G_MAXUINT64);
+	error_code = pd_relay_uri_option (uri, "error-code", 1);
+	exit_delay = pd_relay_uri_option (uri, "exit-delay", 0);
+
+	fprintf (stderr, "STATE: +connecting-to-device\n");
+	fprintf (stderr, "INFO: Connecting to simulated printer\n");
+	sim_sleep_ms (connect_ms);
+	fprintf (stderr, "STATE: -connecting-to-device\n");
+
+	for (;;) {
+		ssize_t got = read (STDIN_FILENO, buffer, sizeof (buffer));
+		gint64 now = g_get_monotonic_time ();
+
+		if (got == -1 && errno == EINTR)
+			continue;
+
+		if (got == -1) {
+			fprintf (stderr, "ERROR: read: %s\n",
+				 g_strerror (errno));
+			return error_code;
+		}
+
+		if (got == 0)
+			break;
+
+		if (!started)
+			started = now;
+
+		total += got;
+		page_bytes += got;
+		while (page_bytes >= page_size) {
+			page_bytes -= page_size;
+			fprintf (stderr, "PAGE: %u 1\n", ++page);
+			fprintf (stderr, "INFO: Printed page %u\n", page);
+		}
+
+		if (total >= error_at) {
+			fprintf (stderr, "STATE: +other\n");
+			fprintf (stderr, "ERROR: Simulated printer error "
+				 "after %" G_GUINT64_FORMAT " bytes\n", total);
+			return error_code;
+		}
+
+		if (!stalled && total >= stall_at) {
+			stalled = TRUE;
+			fprintf (stderr, "STATE: +offline-report\n");
+			fprintf (stderr, "INFO: Printer not responding\n");
+			sim_sleep_ms (stall);
+			fprintf (stderr, "STATE: -offline-report\n");
+
+			/* Don't make up for lost time */
+			started += stall * 1000;
+		}
+
+		/* Don't get ahead of the configured rate */
+		if (rate) {
+			gint64 due = started + total * G_USEC_PER_SEC / rate;
+			if (due > now)
+				g_usleep (due - now);
+		}
+	}
+
+	if (page_bytes > 0 || page == 0)
+		fprintf (stderr, "PAGE: %u 1\n", ++page);
+
+	fprintf (stderr, "STATE: +cups-waiting-for-job-completed\n");
+	sim_sleep_ms (exit_delay);
+	fprintf (stderr, "STATE: -cups-waiting-for-job-completed\n");
+	fprintf (stderr, "INFO: Printed %u pages, %" G_GUINT64_FORMAT
+		 " bytes\n", page, total);
+	return CUPS_BACKEND_OK;
+}
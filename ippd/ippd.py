@@ -266,6 +266,7 @@ class PdIPPServer(IPPServer):
 
     IPP_METHODS = {
         cups.IPP_OP_CUPS_GET_PRINTERS:  "ipp_CUPS_Get_Printers",
+        cups.IPP_OP_PRINT_JOB:          "ipp_Print_Job",
         cups.IPP_OP_CREATE_JOB:         "ipp_Create_Job",
         cups.IPP_OP_SEND_DOCUMENT:      "ipp_Send_Document",
         cups.IPP_OP_CANCEL_JOB:         "ipp_Cancel_Job",
@@ -300,6 +301,53 @@ class PdIPPServer(IPPServer):
 
         self.send_ipp_response (req)
 
+    def ipp_Print_Job (self):
+        attrs = Attributes (self.ipprequest.attributes)
+        uri = attrs.get_value ('printer-uri')
+        if not uri:
+            self.send_error (400, "No printer-uri attribute")
+            return
+
+        objpath = PrinterAddress (uri=uri).get_path ()
+        self.get_printerd ()
+        try:
+            printer = self.printerd.get_printer (objpath)
+        except AttributeError:
+            self.send_ipp_statuscode (cups.IPP_STATUS_ERROR_NOT_FOUND,
+                                      "Specified printer does not exist")
+            return
+
+        self.log_message ("printer-uri: %s" % attrs.get ('printer-uri'))
+        name = attrs.get_value ('job-name', d='')
+        jobattrs = GLib.Variant ("a{sv}", {})
+        with TemporaryFile (prefix='ippd') as tmpfile:
+            tmpfile.write (self.request_file.read ())
+            tmpfile.seek (0)
+            options = GLib.Variant ("a{sv}", {})
+            file_descriptor = GLib.Variant ("h", 0)
+            fd_list = Gio.UnixFDList.new_from_array ([tmpfile.fileno ()])
+            try:
+                (jobpath,
+                 unsupported,
+                 out_fd_list) = printer.call_submit_job_sync (options,
+                                                              name,
+                                                              jobattrs,
+                                                              file_descriptor,
+                                                              fd_list,
+                                                              None)
+            except GLib.Error as e:
+                self.send_ipp_statuscode (cups.IPP_STATUS_ERROR_NOT_POSSIBLE,
+                                          e.message)
+                return
+
+        req = cups.IPPRequest ()
+        jobid = JobAddress (path=jobpath).get_id ()
+        req.add (cups.IPPAttribute (cups.IPP_TAG_JOB,
+                                    cups.IPP_TAG_INTEGER,
+                                    "job-id",
+                                    jobid))
+        self.send_ipp_response (req)
+
     def ipp_Create_Job (self):
         attrs = Attributes (self.ipprequest.attributes)
         uri = attrs.get_value ('printer-uri')
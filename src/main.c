@@ -27,10 +27,17 @@
 
 #include "pd-daemontypes.h"
 #include "pd-daemon.h"
+#include "pd-job-impl.h"
+#include "pd-lock.h"
+#include "pd-log.h"
+#include "pd-spawn-helper.h"
+#include "pd-watchdog.h"
 
 static gboolean opt_no_sigint = FALSE;
 static gboolean opt_replace = FALSE;
 static gboolean opt_session = FALSE;
+static gboolean opt_file_output = FALSE;
+static gboolean opt_spawn_helper = FALSE;
 static GMainLoop *loop = NULL;
 static PdDaemon *the_daemon = NULL;
 
@@ -75,6 +82,13 @@ on_sigint (gpointer user_data)
 	return G_SOURCE_CONTINUE;
 }
 
+static gboolean
+on_sigusr1 (gpointer user_data)
+{
+	pd_lock_stats_dump ();
+	return G_SOURCE_CONTINUE;
+}
+
 static void
 pd_log_ignore_cb (const gchar *log_domain, GLogLevelFlags log_level,
 		  const gchar *message, gpointer user_data)
@@ -118,6 +132,7 @@ main (int argc, char **argv)
 	GOptionContext *opt_context = NULL;
 	guint name_owner_id = 0;
 	guint sigint_id = 0;
+	guint sigusr1_id = 0;
 	gboolean verbose = FALSE;
 	GOptionEntry opt_entries[] = {
 		{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
@@ -128,6 +143,14 @@ main (int argc, char **argv)
 			"Do not handle SIGINT for controlled shutdown", NULL},
 		{ "session", 'S', 0, G_OPTION_ARG_NONE, &opt_session,
 			_("Use the session D-Bus (for testing)"), NULL},
+		{ "file-output", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE,
+			&opt_file_output,
+			"Copy standard input to DEVICE_URI (used internally)",
+			NULL},
+		{ "spawn-helper", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE,
+			&opt_spawn_helper,
+			"Start processes for the daemon (used internally)",
+			NULL},
 		{NULL }
 	};
 
@@ -149,8 +172,21 @@ main (int argc, char **argv)
 		goto out;
 	}
 
+	/* Run as the backend for file: URIs */
+	if (opt_file_output) {
+		ret = pd_job_impl_file_output ();
+		goto out;
+	}
+
+	/* Run as the spawn helper */
+	if (opt_spawn_helper) {
+		ret = pd_spawn_helper_main ();
+		goto out;
+	}
+
 	/* verbose? */
 	if (verbose) {
+		pd_log_set_level (LOG_DEBUG);
 		g_log_set_fatal_mask (NULL, G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL);
 		g_log_set_handler ("printerd",
 				   G_LOG_LEVEL_ERROR |
@@ -164,8 +200,21 @@ main (int argc, char **argv)
 				   pd_log_ignore_cb, NULL);
 	}
 
+	/* Write log records from a separate thread */
+	pd_log_init (verbose);
+
+	/* Start filters and backends from a separate process */
+	if (!pd_spawn_helper_start (&error)) {
+		g_warning ("Failed to start spawn helper: %s",
+			   error->message);
+		g_clear_error (&error);
+	}
+
 	loop = g_main_loop_new (NULL, FALSE);
 
+	/* Keep an eye on main loop responsiveness */
+	pd_watchdog_start ();
+
 	if (!opt_no_sigint) {
 		sigint_id = g_unix_signal_add_full (G_PRIORITY_DEFAULT,
 						    SIGINT,
@@ -174,6 +223,9 @@ main (int argc, char **argv)
 						    NULL); /* GDestroyNotify */
 	}
 
+	/* Dump lock statistics on request */
+	sigusr1_id = g_unix_signal_add (SIGUSR1, on_sigusr1, NULL);
+
 	name_owner_id = g_bus_own_name (opt_session ?
 					G_BUS_TYPE_SESSION : G_BUS_TYPE_SYSTEM,
 					"org.freedesktop.printerd",
@@ -192,6 +244,8 @@ main (int argc, char **argv)
  out:
 	if (sigint_id > 0)
 		g_source_remove (sigint_id);
+	if (sigusr1_id > 0)
+		g_source_remove (sigusr1_id);
 	if (the_daemon != NULL)
 		g_object_unref (the_daemon);
 	if (name_owner_id != 0)
@@ -201,5 +255,8 @@ main (int argc, char **argv)
 	if (opt_context != NULL)
 		g_option_context_free (opt_context);
 	g_debug ("printerd daemon version %s exiting", PACKAGE_VERSION);
+	pd_watchdog_stop ();
+	pd_spawn_helper_stop ();
+	pd_log_shutdown ();
 	return ret;
 }
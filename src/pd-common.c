@@ -22,10 +22,17 @@
 
 #include <errno.h>
 #include <pwd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include <glib.h>
+#include <glib-unix.h>
 
 #include "pd-common.h"
 #include "pd-job-impl.h"
@@ -114,69 +121,22 @@ pd_printer_state_as_string (guint printer_state)
 	return text[printer_state - PD_PRINTER_STATE_IDLE];
 }
 
+/* Look up the name of a user, or NULL if there is none */
 gchar *
-pd_get_unix_user (GDBusMethodInvocation *invocation)
+pd_get_user_name (guint32 uid)
 {
-	GError *error = NULL;
-	gchar *ret;
-	GDBusConnection *connection;
-	GDBusProxy *dbus_proxy = NULL;
-	GVariant *uid_reply = NULL;
-	GVariantIter iter_uid;
-	GVariant *uid = NULL;
 	struct passwd pwd, *result;
 	gchar *buf = NULL;
+	gchar *ret;
 	long bufsize;
 	int err;
-	const gchar *sender;
-
-	connection = g_dbus_method_invocation_get_connection (invocation);
-	dbus_proxy = g_dbus_proxy_new_sync (connection,
-					    G_DBUS_PROXY_FLAGS_NONE,
-					    NULL,
-					    "org.freedesktop.DBus",
-					    "/org/freedesktop/DBus",
-					    "org.freedesktop.DBus",
-					    NULL,
-					    &error);
-	if (dbus_proxy == NULL) {
-		g_warning ("Unable to get DBus proxy: %s", error->message);
-		g_error_free (error);
-		goto out;
-	}
-
-	sender = g_dbus_method_invocation_get_sender (invocation);
-	uid_reply = g_dbus_proxy_call_sync (dbus_proxy,
-					    "GetConnectionUnixUser",
-					    g_variant_new ("(s)", sender),
-					    G_DBUS_CALL_FLAGS_NONE,
-					    -1,
-					    NULL,
-					    &error);
-	if (uid_reply == NULL) {
-		g_warning ("GetConnectionUnixUser failed: %s", error->message);
-		g_error_free (error);
-		goto out;
-	}
-
-	if (g_variant_iter_init (&iter_uid, uid_reply) != 1) {
-		g_warning ("Bad reply from GetConnectionUnixUser");
-		goto out;
-	}
-
-	uid = g_variant_iter_next_value (&iter_uid);
-	if (!uid ||
-	    !g_variant_is_of_type (uid, G_VARIANT_TYPE_UINT32)) {
-		g_warning ("Bad value type from GetConnectionUnixUser");
-		goto out;
-	}
 
 	bufsize = sysconf (_SC_GETPW_R_SIZE_MAX);
 	if (bufsize == -1)
 		bufsize = 16384;
 
 	buf = g_malloc (bufsize);
-	err = getpwuid_r (g_variant_get_uint32 (uid),
+	err = getpwuid_r (uid,
 			  &pwd,
 			  buf,
 			  bufsize,
@@ -187,23 +147,11 @@ pd_get_unix_user (GDBusMethodInvocation *invocation)
 				   g_strerror (errno));
 
 		g_free (buf);
-		buf = NULL;
+		return NULL;
 	}
 
- out:
-	if (dbus_proxy)
-		g_object_unref (dbus_proxy);
-	if (uid_reply)
-		g_variant_unref (uid_reply);
-	if (uid)
-		g_variant_unref (uid);
-
-	if (buf) {
-		ret = g_strdup (pwd.pw_name);
-		g_free (buf);
-	} else
-		ret = g_strdup (":unknown:");
-
+	ret = g_strdup (pwd.pw_name);
+	g_free (buf);
 	return ret;
 }
 
@@ -247,3 +195,458 @@ add_or_remove_state_reason (const gchar *const *reasons,
 out:
 	return strv;
 }
+
+/**
+ * pd_get_serverbin:
+ *
+ * Returns: The directory containing CUPS filters and backends, as
+ * reported by cups-config when printerd was configured. Like CUPS
+ * itself this can be overridden with the CUPS_SERVERBIN environment
+ * variable.
+ */
+const gchar *
+pd_get_serverbin (void)
+{
+	const gchar *serverbin = g_getenv ("CUPS_SERVERBIN");
+
+	return serverbin && *serverbin ? serverbin : CUPS_SERVERBIN;
+}
+
+/**
+ * update_attributes:
+ * @attributes: An a{sv} #GVariant.
+ * @updates: An a{sv} #GVariant.
+ *
+ * Returns: (transfer floating): @attributes with values from
+ * @updates added or replaced.
+ */
+GVariant *
+update_attributes (GVariant *attributes, GVariant *updates)
+{
+	GVariantBuilder builder;
+	GVariantIter iter;
+	gchar *dkey;
+	GVariant *dvalue;
+
+	/* Add any values from attributes that are not in updates */
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_iter_init (&iter, attributes);
+	while (g_variant_iter_loop (&iter, "{sv}", &dkey, &dvalue))
+		if (!g_variant_lookup_value (updates, dkey, NULL))
+			g_variant_builder_add (&builder, "{sv}",
+					       dkey, dvalue);
+
+	/* Now add in the updates */
+	g_variant_iter_init (&iter, updates);
+	while (g_variant_iter_loop (&iter, "{sv}", &dkey, &dvalue))
+		g_variant_builder_add (&builder, "{sv}", dkey, dvalue);
+
+	return g_variant_builder_end (&builder);
+}
+
+/**
+ * pd_attribute_table_new:
+ * @attributes: (allow-none): An a{sv} #GVariant.
+ *
+ * Returns: (transfer full): A #GHashTable mapping attribute names to
+ * #GVariant values, holding the entries of @attributes.
+ */
+GHashTable *
+pd_attribute_table_new (GVariant *attributes)
+{
+	GHashTable *table;
+
+	table = g_hash_table_new_full (g_str_hash,
+				       g_str_equal,
+				       g_free,
+				       (GDestroyNotify) g_variant_unref);
+	if (attributes)
+		pd_attribute_table_update (table, attributes);
+
+	return table;
+}
+
+/**
+ * pd_attribute_table_update:
+ * @table: A #GHashTable from pd_attribute_table_new().
+ * @attributes: An a{sv} #GVariant.
+ *
+ * Add the entries of @attributes to @table, replacing any with the
+ * same names.
+ */
+void
+pd_attribute_table_update (GHashTable *table,
+			   GVariant *attributes)
+{
+	GVariantIter iter;
+	const gchar *key;
+	GVariant *value;
+
+	g_variant_iter_init (&iter, attributes);
+	while (g_variant_iter_next (&iter, "{&sv}", &key, &value))
+		g_hash_table_insert (table, g_strdup (key), value);
+}
+
+/* Append @text to @options, escaping the characters that
+ * cupsParseOptions() would otherwise treat specially, as cupsd does.
+ * Braces would start a collection value. Within lists, commas
+ * separate values so they are escaped too. */
+static void
+pd_append_cups_option_text (GString *options,
+			    const gchar *text,
+			    gboolean in_list)
+{
+	const gchar *p;
+
+	if (*text == '\0') {
+		g_string_append (options, "''");
+		return;
+	}
+
+	for (p = text; *p; p++) {
+		if (strchr (" \t\n\r\\'\"{}", *p) ||
+		    (in_list && *p == ','))
+			g_string_append_c (options, '\\');
+
+		g_string_append_c (options, *p);
+	}
+}
+
+static void
+pd_append_cups_option_value (GString *options,
+			     GVariant *value,
+			     gboolean in_list)
+{
+	gchar *text;
+
+	switch (g_variant_classify (value)) {
+	case G_VARIANT_CLASS_STRING:
+	case G_VARIANT_CLASS_OBJECT_PATH:
+	case G_VARIANT_CLASS_SIGNATURE:
+		pd_append_cups_option_text (options,
+					    g_variant_get_string (value, NULL),
+					    in_list);
+		break;
+
+	case G_VARIANT_CLASS_BOOLEAN:
+		g_string_append (options,
+				 g_variant_get_boolean (value) ?
+				 "true" : "false");
+		break;
+
+	case G_VARIANT_CLASS_BYTE:
+	case G_VARIANT_CLASS_INT16:
+	case G_VARIANT_CLASS_UINT16:
+	case G_VARIANT_CLASS_INT32:
+	case G_VARIANT_CLASS_UINT32:
+	case G_VARIANT_CLASS_INT64:
+	case G_VARIANT_CLASS_UINT64:
+		/* No type annotations or quoting needed */
+		text = g_variant_print (value, FALSE);
+		g_string_append (options, text);
+		g_free (text);
+		break;
+
+	case G_VARIANT_CLASS_DOUBLE:
+		text = g_malloc (G_ASCII_DTOSTR_BUF_SIZE);
+		g_ascii_dtostr (text, G_ASCII_DTOSTR_BUF_SIZE,
+				g_variant_get_double (value));
+		g_string_append (options, text);
+		g_free (text);
+		break;
+
+	case G_VARIANT_CLASS_VARIANT:
+		value = g_variant_get_variant (value);
+		pd_append_cups_option_value (options, value, in_list);
+		g_variant_unref (value);
+		break;
+
+	case G_VARIANT_CLASS_ARRAY:
+		if (!in_list &&
+		    g_variant_type_is_basic (g_variant_type_element (
+						     g_variant_get_type (value)))) {
+			GVariantIter iter;
+			GVariant *element;
+			gboolean first = TRUE;
+
+			/* Comma-separated list of values */
+			g_variant_iter_init (&iter, value);
+			while ((element = g_variant_iter_next_value (&iter))) {
+				if (!first)
+					g_string_append_c (options, ',');
+
+				pd_append_cups_option_value (options, element,
+							     TRUE);
+				g_variant_unref (element);
+				first = FALSE;
+			}
+
+			if (first)
+				g_string_append (options, "''");
+
+			break;
+		}
+		/* fall through */
+
+	default:
+		text = g_variant_print (value, FALSE);
+		pd_append_cups_option_text (options, text, in_list);
+		g_free (text);
+		break;
+	}
+}
+
+/**
+ * pd_append_cups_option:
+ * @options: A #GString holding a CUPS options string.
+ * @name: Option name.
+ * @value: Option value.
+ *
+ * Append name=value to @options, separated from any options already
+ * there, encoded so that filters parsing it with cupsParseOptions()
+ * get back the same value. Arrays of basic types become
+ * comma-separated lists.
+ *
+ * Returns: %FALSE, leaving @options unchanged, if @name cannot be
+ * represented in an options string.
+ */
+gboolean
+pd_append_cups_option (GString *options,
+		       const gchar *name,
+		       GVariant *value)
+{
+	const gchar *p;
+
+	if (*name == '\0')
+		return FALSE;
+
+	for (p = name; *p; p++)
+		if (!g_ascii_isgraph (*p) || strchr ("=\\'\"", *p))
+			return FALSE;
+
+	if (options->len > 0)
+		g_string_append_c (options, ' ');
+
+	g_string_append_printf (options, "%s=", name);
+	pd_append_cups_option_value (options, value, FALSE);
+	return TRUE;
+}
+
+typedef struct
+{
+	GPid		 pid;
+	gint		 pidfd;
+	PdChildWatchFunc function;
+	gpointer	 user_data;
+} PdChildWatch;
+
+static void
+pd_child_watch_free (gpointer data)
+{
+	PdChildWatch *watch = data;
+
+	if (watch->pidfd != -1)
+		close (watch->pidfd);
+
+	g_free (watch);
+}
+
+/* Fallback when there is no pidfd: GLib reaps the child */
+static void
+pd_child_watch_cb (GPid pid,
+		   gint status,
+		   gpointer user_data)
+{
+	PdChildWatch *watch = user_data;
+
+	watch->function (pid, status, NULL, watch->user_data);
+}
+
+/* The pidfd is readable, so the child has exited */
+static gboolean
+pd_child_watch_pidfd_cb (gint fd,
+			 GIOCondition condition,
+			 gpointer user_data)
+{
+	PdChildWatch *watch = user_data;
+	struct rusage usage;
+	gint status;
+	pid_t ret;
+
+	do
+		ret = wait4 (watch->pid, &status, WNOHANG, &usage);
+	while (ret == -1 && errno == EINTR);
+
+	if (ret == 0)
+		/* Not really finished yet */
+		return G_SOURCE_CONTINUE;
+
+	if (ret == -1) {
+		g_warning ("Failed to reap PID %d: %s",
+			   watch->pid, g_strerror (errno));
+		watch->function (watch->pid, 255 << 8, NULL,
+				 watch->user_data);
+	} else
+		watch->function (watch->pid, status, &usage,
+				 watch->user_data);
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * pd_child_watch_add:
+ * @pid: A child process that is not reaped automatically, such as
+ *   one from pd_spawn().
+ * @function: Function to call when @pid exits.
+ * @user_data: Data to pass to @function.
+ *
+ * Like g_child_watch_add(), but reaps @pid with wait4() so that
+ * @function is told the resources it used. This needs pidfd
+ * support; without it @function is given %NULL usage.
+ *
+ * Returns: The ID of the event source, for g_source_remove().
+ */
+guint
+pd_child_watch_add (GPid pid,
+		    PdChildWatchFunc function,
+		    gpointer user_data)
+{
+	PdChildWatch *watch = g_new0 (PdChildWatch, 1);
+	guint id;
+
+	watch->pid = pid;
+	watch->pidfd = -1;
+	watch->function = function;
+	watch->user_data = user_data;
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	watch->pidfd = syscall (SYS_pidfd_open, pid, 0);
+	if (watch->pidfd != -1)
+		id = g_unix_fd_add_full (G_PRIORITY_DEFAULT,
+					 watch->pidfd,
+					 G_IO_IN,
+					 pd_child_watch_pidfd_cb,
+					 watch,
+					 pd_child_watch_free);
+	else
+#endif /* pidfd */
+		id = g_child_watch_add_full (G_PRIORITY_DEFAULT,
+					     pid,
+					     pd_child_watch_cb,
+					     watch,
+					     pd_child_watch_free);
+
+	g_source_set_name_by_id (id, "[printerd] child watch");
+	return id;
+}
+
+/**
+ * pd_spawn:
+ * @path: Program to run.
+ * @argv: Its arguments, starting with argv[0].
+ * @envp: Its environment.
+ * @child_fds: File descriptors to give the program: @child_fds[i]
+ *   becomes its descriptor i, and -1 leaves i alone.
+ * @n_fds: Number of entries in @child_fds.
+ * @child_pid: (out): Return location for the process ID.
+ * @error: Return location for error or %NULL.
+ *
+ * Start @path using posix_spawn(), which does not copy the daemon's
+ * page tables as fork() does, so it takes the same time however
+ * large the daemon grows. The child is not reaped automatically;
+ * use pd_child_watch_add().
+ *
+ * The descriptors in @child_fds should be close-on-exec so that no
+ * other process inherits them. The child gets its own copies without
+ * that flag.
+ *
+ * Returns: %TRUE if the program was started.
+ */
+gboolean
+pd_spawn (const gchar *path,
+	  gchar **argv,
+	  gchar **envp,
+	  const gint *child_fds,
+	  gint n_fds,
+	  GPid *child_pid,
+	  GError **error)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	pid_t pid;
+	gint base = n_fds;
+	gint err = 0;
+	gint i;
+
+	posix_spawn_file_actions_init (&actions);
+	posix_spawnattr_init (&attr);
+
+	/* Run with default signal handling, as the daemon's own
+	 * dispositions and mask are no concern of filters */
+	sigfillset (&mask);
+	posix_spawnattr_setsigdefault (&attr, &mask);
+	sigemptyset (&mask);
+	posix_spawnattr_setsigmask (&attr, &mask);
+	posix_spawnattr_setflags (&attr,
+#ifdef POSIX_SPAWN_USEVFORK
+				  POSIX_SPAWN_USEVFORK |
+#endif /* POSIX_SPAWN_USEVFORK */
+				  POSIX_SPAWN_SETSIGDEF |
+				  POSIX_SPAWN_SETSIGMASK);
+
+	/* Copy each descriptor somewhere above all of them first, so
+	 * that none is overwritten before it has been copied */
+	for (i = 0; i < n_fds; i++)
+		if (child_fds[i] >= base)
+			base = child_fds[i] + 1;
+
+	for (i = 0; i < n_fds && !err; i++)
+		if (child_fds[i] != -1)
+			err = posix_spawn_file_actions_adddup2 (&actions,
+								child_fds[i],
+								base + i);
+
+	/* Then into place. Descriptors made by dup2() are never
+	 * close-on-exec. */
+	for (i = 0; i < n_fds && !err; i++)
+		if (child_fds[i] != -1)
+			err = posix_spawn_file_actions_adddup2 (&actions,
+								base + i,
+								i);
+
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+	/* Like g_spawn_async(), leave nothing else open */
+	if (!err)
+		err = posix_spawn_file_actions_addclosefrom_np (&actions,
+								n_fds);
+#else
+	for (i = 0; i < n_fds && !err; i++)
+		if (child_fds[i] != -1)
+			err = posix_spawn_file_actions_addclose (&actions,
+								 base + i);
+#endif /* HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP */
+
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+	if (!err)
+		err = posix_spawn_file_actions_addchdir_np (&actions, "/");
+#endif /* HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP */
+
+	if (!err)
+		err = posix_spawn (&pid, path, &actions, &attr, argv, envp);
+
+	posix_spawnattr_destroy (&attr);
+	posix_spawn_file_actions_destroy (&actions);
+
+	if (err) {
+		g_set_error (error,
+			     PD_ERROR,
+			     PD_ERROR_FAILED,
+			     "Failed to execute %s: %s",
+			     path, g_strerror (err));
+		return FALSE;
+	}
+
+	*child_pid = pid;
+	return TRUE;
+}
@@ -21,17 +21,53 @@
 #ifndef __PD_COMMON_H__
 #define __PD_COMMON_H__
 
+#include <sys/resource.h>
+
 #include "pd-daemontypes.h"
 
 G_BEGIN_DECLS
 
+/* This program, for running it again in another role */
+#define PD_SELF_EXE	"/proc/self/exe"
+
+/**
+ * PdChildWatchFunc:
+ * @pid: The process that exited.
+ * @status: Its wait status.
+ * @usage: (allow-none): Resources it used, or %NULL if unknown.
+ * @user_data: Data passed to pd_child_watch_add().
+ */
+typedef void (*PdChildWatchFunc) (GPid pid,
+				  gint status,
+				  const struct rusage *usage,
+				  gpointer user_data);
+
 GHashTable	*pd_parse_ieee1284_id		(const gchar *idstring);
 const gchar	*pd_job_state_as_string		(guint job_state);
 const gchar	*pd_printer_state_as_string	(guint printer_state);
-gchar		*pd_get_unix_user		(GDBusMethodInvocation *invocation);
+gchar		*pd_get_user_name		(guint32 uid);
+const gchar	*pd_get_serverbin		(void);
+guint		 pd_child_watch_add		(GPid pid,
+						 PdChildWatchFunc function,
+						 gpointer user_data);
+gboolean	 pd_spawn			(const gchar *path,
+						 gchar **argv,
+						 gchar **envp,
+						 const gint *child_fds,
+						 gint n_fds,
+						 GPid *child_pid,
+						 GError **error);
 gchar **	add_or_remove_state_reason	(const gchar *const *reasons,
 						 gchar add_or_remove,
 						 const gchar *reason);
+GVariant	*update_attributes		(GVariant *attributes,
+						 GVariant *updates);
+GHashTable	*pd_attribute_table_new		(GVariant *attributes);
+void		 pd_attribute_table_update	(GHashTable *table,
+						 GVariant *attributes);
+gboolean	 pd_append_cups_option		(GString *options,
+						 const gchar *name,
+						 GVariant *value);
 
 G_END_DECLS
 
@@ -21,8 +21,11 @@
 #include "config.h"
 #include <glib/gi18n-lib.h>
 
+#include "pd-common.h"
 #include "pd-daemon.h"
 #include "pd-engine.h"
+#include "pd-lock.h"
+#include "pd-trace.h"
 
 /**
  * SECTION:printerddaemon
@@ -34,6 +37,16 @@
 
 typedef struct _PdDaemonClass	PdDaemonClass;
 
+/* How long a positive polkit result is remembered for */
+#define PD_DAEMON_AUTH_CACHE_TTL	(5 * G_USEC_PER_SEC)
+
+/* How long a bus name is remembered after it leaves the bus, so that
+ * results arriving late for it are not cached */
+#define PD_DAEMON_DEPARTED_TTL		(60 * G_USEC_PER_SEC)
+
+/* How long a user name looked up from a uid is remembered for */
+#define PD_DAEMON_USER_NAME_TTL		(60 * G_USEC_PER_SEC)
+
 /**
  * PdDaemon:
  *
@@ -48,8 +61,35 @@ struct _PdDaemon
 	GDBusObjectManagerServer *object_manager;
 	PdEngine *engine;
 	PolkitAuthority *authority;
+
+	/* Authorization cache: bus name -> (action id -> expiry) */
+	GHashTable *auth_cache;
+	guint64 auth_cache_hits;
+	guint64 auth_cache_misses;
+	gint64 auth_cache_swept;
+	guint name_owner_changed_id;
+	GMutex auth_lock;
+
+	/* Unique names that have recently left the bus, oldest first */
+	GHashTable *departed;
+	GQueue departed_queue;
+
+	/* Caller identity: bus name -> uid, and uid -> user name */
+	GHashTable *sender_uids;
+	GHashTable *user_names;
+	GMutex identity_lock;
 };
 
+typedef struct {
+	gchar *name;
+	gint64 expiry;
+} PdDaemonUserName;
+
+typedef struct {
+	gchar *name;
+	gint64 time;
+} PdDaemonDeparted;
+
 struct _PdDaemonClass
 {
 	GObjectClass parent_class;
@@ -83,8 +123,28 @@ pd_daemon_finalize (GObject *object)
 	PdDaemon *daemon = PD_DAEMON (object);
 
 	g_debug ("[Daemon] Finalize");
-	if (daemon->authority)
+	if (daemon->name_owner_changed_id)
+		g_dbus_connection_signal_unsubscribe (daemon->connection,
+						      daemon->name_owner_changed_id);
+
+	if (daemon->authority) {
+		g_debug ("[Daemon] Authorization cache: %" G_GUINT64_FORMAT
+			 " hits, %" G_GUINT64_FORMAT " misses",
+			 daemon->auth_cache_hits,
+			 daemon->auth_cache_misses);
+		g_signal_handlers_disconnect_by_data (daemon->authority,
+						      daemon);
 		g_object_unref (daemon->authority);
+	}
+
+	g_hash_table_unref (daemon->auth_cache);
+	g_hash_table_unref (daemon->departed);
+	g_queue_foreach (&daemon->departed_queue, (GFunc) g_free, NULL);
+	g_queue_clear (&daemon->departed_queue);
+	g_mutex_clear (&daemon->auth_lock);
+	g_hash_table_unref (daemon->sender_uids);
+	g_hash_table_unref (daemon->user_names);
+	g_mutex_clear (&daemon->identity_lock);
 
 	g_object_unref (daemon->object_manager);
 	g_object_unref (daemon->connection);
@@ -138,9 +198,117 @@ pd_daemon_set_property (GObject *object,
 	}
 }
 
+static void
+pd_daemon_user_name_free (PdDaemonUserName *user_name)
+{
+	g_free (user_name->name);
+	g_free (user_name);
+}
+
 static void
 pd_daemon_init (PdDaemon *daemon)
 {
+	daemon->auth_cache = g_hash_table_new_full (g_str_hash,
+						    g_str_equal,
+						    g_free,
+						    (GDestroyNotify) g_hash_table_unref);
+	g_mutex_init (&daemon->auth_lock);
+	daemon->departed = g_hash_table_new_full (g_str_hash,
+						  g_str_equal,
+						  g_free,
+						  NULL);
+	g_queue_init (&daemon->departed_queue);
+	daemon->sender_uids = g_hash_table_new_full (g_str_hash,
+						     g_str_equal,
+						     g_free,
+						     NULL);
+	daemon->user_names = g_hash_table_new_full (g_direct_hash,
+						    g_direct_equal,
+						    NULL,
+						    (GDestroyNotify) pd_daemon_user_name_free);
+	g_mutex_init (&daemon->identity_lock);
+}
+
+static void
+on_authority_changed (PolkitAuthority *authority,
+		      gpointer user_data)
+{
+	PdDaemon *daemon = PD_DAEMON (user_data);
+
+	/* Policy or authorizations changed: forget everything */
+	g_debug ("[Daemon] Authority changed, flushing authorization cache");
+	pd_mutex_lock (&daemon->auth_lock, PD_LOCK_AUTH);
+	g_hash_table_remove_all (daemon->auth_cache);
+	pd_mutex_unlock (&daemon->auth_lock, PD_LOCK_AUTH);
+}
+
+/* Must be called while holding the daemon's auth_lock */
+static void
+pd_daemon_add_departed (PdDaemon *daemon,
+			const gchar *name)
+{
+	PdDaemonDeparted *departed;
+	gint64 now = g_get_monotonic_time ();
+
+	/* Forget names that left long enough ago */
+	while ((departed = g_queue_peek_head (&daemon->departed_queue)) &&
+	       departed->time + PD_DAEMON_DEPARTED_TTL < now) {
+		g_queue_pop_head (&daemon->departed_queue);
+		g_hash_table_remove (daemon->departed, departed->name);
+		g_free (departed);
+	}
+
+	if (g_hash_table_contains (daemon->departed, name))
+		return;
+
+	departed = g_new (PdDaemonDeparted, 1);
+	departed->name = g_strdup (name);
+	departed->time = now;
+	g_hash_table_add (daemon->departed, departed->name);
+	g_queue_push_tail (&daemon->departed_queue, departed);
+}
+
+/* Must be called while holding the daemon's auth_lock */
+static gboolean
+pd_daemon_has_departed (PdDaemon *daemon,
+			const gchar *name)
+{
+	return g_hash_table_contains (daemon->departed, name);
+}
+
+static void
+on_name_owner_changed (GDBusConnection *connection,
+		       const gchar *sender_name,
+		       const gchar *object_path,
+		       const gchar *interface_name,
+		       const gchar *signal_name,
+		       GVariant *parameters,
+		       gpointer user_data)
+{
+	PdDaemon *daemon = PD_DAEMON (user_data);
+	const gchar *name;
+	const gchar *old_owner;
+	const gchar *new_owner;
+
+	if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sss)")))
+		return;
+
+	g_variant_get (parameters, "(&s&s&s)", &name, &old_owner, &new_owner);
+
+	/* Only interested in unique names going away */
+	if (name[0] != ':' || new_owner[0] != '\0')
+		return;
+
+	/* Unique names are never reused, so anything cached for this
+	 * one from now on would never be removed */
+	pd_mutex_lock (&daemon->auth_lock, PD_LOCK_AUTH);
+	pd_daemon_add_departed (daemon, name);
+	g_hash_table_remove (daemon->auth_cache, name);
+	pd_mutex_unlock (&daemon->auth_lock, PD_LOCK_AUTH);
+
+	pd_mutex_lock (&daemon->identity_lock, PD_LOCK_IDENTITY);
+	g_hash_table_remove (daemon->sender_uids, name);
+	pd_mutex_unlock (&daemon->identity_lock, PD_LOCK_IDENTITY);
 }
 
 static void
@@ -158,7 +326,26 @@ pd_daemon_constructed (GObject *object)
 				 error->message, g_quark_to_string (error->domain), error->code);
 			g_error_free (error);
 		}
+
+		g_signal_connect (daemon->authority,
+				  "changed",
+				  G_CALLBACK (on_authority_changed),
+				  daemon);
 	}
+
+	/* Drop cached authorizations and identities for clients that
+	 * disconnect */
+	daemon->name_owner_changed_id =
+		g_dbus_connection_signal_subscribe (daemon->connection,
+						    "org.freedesktop.DBus",
+						    "org.freedesktop.DBus",
+						    "NameOwnerChanged",
+						    "/org/freedesktop/DBus",
+						    NULL,
+						    G_DBUS_SIGNAL_FLAGS_NONE,
+						    on_name_owner_changed,
+						    daemon,
+						    NULL);
 	daemon->object_manager = g_dbus_object_manager_server_new ("/org/freedesktop/printerd");
 	daemon->engine = pd_engine_new (daemon);
 	pd_engine_start (daemon->engine);
@@ -326,6 +513,453 @@ pd_daemon_get_engine (PdDaemon *daemon)
 	return daemon->engine;
 }
 
+/* Looks up the uid of a bus name, if known */
+static gboolean
+pd_daemon_lookup_sender_uid (PdDaemon *daemon,
+			     const gchar *sender,
+			     guint32 *uid)
+{
+	gpointer value;
+	gboolean found;
+
+	pd_mutex_lock (&daemon->identity_lock, PD_LOCK_IDENTITY);
+	found = g_hash_table_lookup_extended (daemon->sender_uids,
+					      sender,
+					      NULL,
+					      &value);
+	if (found)
+		*uid = GPOINTER_TO_UINT (value);
+	pd_mutex_unlock (&daemon->identity_lock, PD_LOCK_IDENTITY);
+
+	return found;
+}
+
+/* Remembers the uid from a GetConnectionCredentials reply */
+static gboolean
+pd_daemon_store_credentials (PdDaemon *daemon,
+			     const gchar *sender,
+			     GVariant *reply,
+			     guint32 *uid)
+{
+	GVariant *credentials;
+	gboolean found;
+
+	g_variant_get (reply, "(@a{sv})", &credentials);
+	found = g_variant_lookup (credentials, "UnixUserID", "u", uid);
+	g_variant_unref (credentials);
+	if (!found) {
+		g_warning ("[Daemon] No UnixUserID in credentials for %s",
+			   sender);
+		return FALSE;
+	}
+
+	/* Don't remember the uid if the client has already gone, as
+	 * nothing would remove it */
+	pd_mutex_lock (&daemon->auth_lock, PD_LOCK_AUTH);
+	if (!pd_daemon_has_departed (daemon, sender)) {
+		pd_mutex_lock (&daemon->identity_lock, PD_LOCK_IDENTITY);
+		g_hash_table_insert (daemon->sender_uids,
+				     g_strdup (sender),
+				     GUINT_TO_POINTER (*uid));
+		pd_mutex_unlock (&daemon->identity_lock, PD_LOCK_IDENTITY);
+	}
+	pd_mutex_unlock (&daemon->auth_lock, PD_LOCK_AUTH);
+	return TRUE;
+}
+
+/* Returns the user name for @uid, or NULL if it is not cached */
+static gchar *
+pd_daemon_lookup_user_name (PdDaemon *daemon,
+			    guint32 uid)
+{
+	PdDaemonUserName *user_name;
+	gchar *ret = NULL;
+
+	pd_mutex_lock (&daemon->identity_lock, PD_LOCK_IDENTITY);
+	user_name = g_hash_table_lookup (daemon->user_names,
+					 GUINT_TO_POINTER (uid));
+	if (user_name) {
+		if (user_name->expiry < g_get_monotonic_time ())
+			g_hash_table_remove (daemon->user_names,
+					     GUINT_TO_POINTER (uid));
+		else
+			ret = g_strdup (user_name->name);
+	}
+	pd_mutex_unlock (&daemon->identity_lock, PD_LOCK_IDENTITY);
+
+	return ret;
+}
+
+/* Returns the user name for @uid, consulting the user database if
+ * necessary. This may block. */
+static gchar *
+pd_daemon_resolve_user_name (PdDaemon *daemon,
+			     guint32 uid)
+{
+	PdDaemonUserName *user_name;
+	gchar *ret;
+
+	ret = pd_daemon_lookup_user_name (daemon, uid);
+	if (ret)
+		return ret;
+
+	ret = pd_get_user_name (uid);
+	if (ret == NULL)
+		return g_strdup (":unknown:");
+
+	user_name = g_new0 (PdDaemonUserName, 1);
+	user_name->name = g_strdup (ret);
+	user_name->expiry = g_get_monotonic_time () + PD_DAEMON_USER_NAME_TTL;
+	pd_mutex_lock (&daemon->identity_lock, PD_LOCK_IDENTITY);
+	g_hash_table_insert (daemon->user_names,
+			     GUINT_TO_POINTER (uid),
+			     user_name);
+	pd_mutex_unlock (&daemon->identity_lock, PD_LOCK_IDENTITY);
+
+	return ret;
+}
+
+/**
+ * pd_daemon_get_unix_user:
+ * @daemon: A #PdDaemon.
+ * @invocation: A #GDBusMethodInvocation.
+ *
+ * Gets the name of the user who made the method call. The caller's
+ * credentials are cached until it disconnects from the bus, so this
+ * is usually just a hash lookup.
+ *
+ * Returns: The user name, or ":unknown:". Free with g_free().
+ */
+gchar *
+pd_daemon_get_unix_user (PdDaemon *daemon,
+			 GDBusMethodInvocation *invocation)
+{
+	GError *error = NULL;
+	GVariant *reply;
+	const gchar *sender;
+	guint32 uid;
+
+	sender = g_dbus_method_invocation_get_sender (invocation);
+	if (!pd_daemon_lookup_sender_uid (daemon, sender, &uid)) {
+		reply = g_dbus_connection_call_sync (g_dbus_method_invocation_get_connection (invocation),
+						     "org.freedesktop.DBus",
+						     "/org/freedesktop/DBus",
+						     "org.freedesktop.DBus",
+						     "GetConnectionCredentials",
+						     g_variant_new ("(s)", sender),
+						     G_VARIANT_TYPE ("(a{sv})"),
+						     G_DBUS_CALL_FLAGS_NONE,
+						     -1,
+						     NULL,
+						     &error);
+		if (reply == NULL) {
+			g_warning ("[Daemon] GetConnectionCredentials failed: %s",
+				   error->message);
+			g_error_free (error);
+			return g_strdup (":unknown:");
+		}
+
+		if (!pd_daemon_store_credentials (daemon, sender, reply, &uid)) {
+			g_variant_unref (reply);
+			return g_strdup (":unknown:");
+		}
+
+		g_variant_unref (reply);
+	}
+
+	return pd_daemon_resolve_user_name (daemon, uid);
+}
+
+/* runs in a worker thread: user database lookups may block */
+static void
+pd_daemon_get_unix_user_thread (GTask *task,
+				gpointer source_object,
+				gpointer task_data,
+				GCancellable *cancellable)
+{
+	PdDaemon *daemon = PD_DAEMON (source_object);
+	guint32 uid = GPOINTER_TO_UINT (task_data);
+
+	g_task_return_pointer (task,
+			       pd_daemon_resolve_user_name (daemon, uid),
+			       g_free);
+}
+
+static void
+pd_daemon_get_unix_user_resolve (GTask *task,
+				 guint32 uid)
+{
+	PdDaemon *daemon = g_task_get_source_object (task);
+	gchar *name;
+
+	name = pd_daemon_lookup_user_name (daemon, uid);
+	if (name) {
+		g_task_return_pointer (task, name, g_free);
+		return;
+	}
+
+	g_task_set_task_data (task, GUINT_TO_POINTER (uid), NULL);
+	g_task_run_in_thread (task, pd_daemon_get_unix_user_thread);
+}
+
+static void
+pd_daemon_get_unix_user_cb (GObject *source_object,
+			    GAsyncResult *res,
+			    gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	PdDaemon *daemon = g_task_get_source_object (task);
+	const gchar *sender = g_task_get_task_data (task);
+	GError *error = NULL;
+	GVariant *reply;
+	guint32 uid;
+
+	reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+					       res,
+					       &error);
+	if (reply == NULL) {
+		g_warning ("[Daemon] GetConnectionCredentials failed: %s",
+			   error->message);
+		g_error_free (error);
+		g_task_return_pointer (task, g_strdup (":unknown:"), g_free);
+		goto out;
+	}
+
+	if (!pd_daemon_store_credentials (daemon, sender, reply, &uid))
+		g_task_return_pointer (task, g_strdup (":unknown:"), g_free);
+	else
+		pd_daemon_get_unix_user_resolve (task, uid);
+
+	g_variant_unref (reply);
+ out:
+	g_object_unref (task);
+}
+
+/**
+ * pd_daemon_get_unix_user_async:
+ * @daemon: A #PdDaemon.
+ * @invocation: A #GDBusMethodInvocation.
+ * @callback: Function to call when the user name is known.
+ * @user_data: Data to pass to @callback.
+ *
+ * Asynchronous version of pd_daemon_get_unix_user(), for method
+ * handlers that run in the main thread.
+ */
+void
+pd_daemon_get_unix_user_async (PdDaemon *daemon,
+			       GDBusMethodInvocation *invocation,
+			       GAsyncReadyCallback callback,
+			       gpointer user_data)
+{
+	GTask *task;
+	const gchar *sender;
+	guint32 uid;
+
+	task = g_task_new (daemon, NULL, callback, user_data);
+	sender = g_dbus_method_invocation_get_sender (invocation);
+	if (pd_daemon_lookup_sender_uid (daemon, sender, &uid)) {
+		pd_daemon_get_unix_user_resolve (task, uid);
+		g_object_unref (task);
+		return;
+	}
+
+	g_task_set_task_data (task, g_strdup (sender), g_free);
+	g_dbus_connection_call (g_dbus_method_invocation_get_connection (invocation),
+				"org.freedesktop.DBus",
+				"/org/freedesktop/DBus",
+				"org.freedesktop.DBus",
+				"GetConnectionCredentials",
+				g_variant_new ("(s)", sender),
+				G_VARIANT_TYPE ("(a{sv})"),
+				G_DBUS_CALL_FLAGS_NONE,
+				-1,
+				NULL,
+				pd_daemon_get_unix_user_cb,
+				task);
+}
+
+/**
+ * pd_daemon_get_unix_user_finish:
+ * @daemon: A #PdDaemon.
+ * @result: The #GAsyncResult passed to the callback.
+ *
+ * Finishes an operation started with pd_daemon_get_unix_user_async().
+ *
+ * Returns: The user name, or ":unknown:". Free with g_free().
+ */
+gchar *
+pd_daemon_get_unix_user_finish (PdDaemon *daemon,
+				GAsyncResult *result)
+{
+	gchar *ret;
+
+	g_return_val_if_fail (g_task_is_valid (result, daemon), NULL);
+
+	ret = g_task_propagate_pointer (G_TASK (result), NULL);
+	if (ret == NULL)
+		ret = g_strdup (":unknown:");
+
+	return ret;
+}
+
+/**
+ * pd_daemon_get_auth_cache_stats:
+ * @daemon: A #PdDaemon.
+ * @hits: (out): Return location for the number of cache hits.
+ * @misses: (out): Return location for the number of cache misses.
+ *
+ * Gets the authorization cache hit and miss counters.
+ */
+void
+pd_daemon_get_auth_cache_stats (PdDaemon *daemon,
+				guint64 *hits,
+				guint64 *misses)
+{
+	g_return_if_fail (PD_IS_DAEMON (daemon));
+
+	pd_mutex_lock (&daemon->auth_lock, PD_LOCK_AUTH);
+	if (hits)
+		*hits = daemon->auth_cache_hits;
+	if (misses)
+		*misses = daemon->auth_cache_misses;
+	pd_mutex_unlock (&daemon->auth_lock, PD_LOCK_AUTH);
+}
+
+/* Must be called while holding the daemon's auth_lock */
+static gboolean
+pd_daemon_auth_cache_lookup (PdDaemon *daemon,
+			     const gchar *sender,
+			     const gchar *action_id)
+{
+	GHashTable *actions;
+	gint64 *expiry;
+
+	actions = g_hash_table_lookup (daemon->auth_cache, sender);
+	if (actions == NULL)
+		return FALSE;
+
+	expiry = g_hash_table_lookup (actions, action_id);
+	if (expiry == NULL)
+		return FALSE;
+
+	if (*expiry < g_get_monotonic_time ()) {
+		g_hash_table_remove (actions, action_id);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+pd_daemon_auth_cache_expired (gpointer key,
+			      gpointer value,
+			      gpointer user_data)
+{
+	gint64 *expiry = value;
+	gint64 *now = user_data;
+
+	return *expiry < *now;
+}
+
+static gboolean
+pd_daemon_auth_cache_sweep_sender (gpointer key,
+				   gpointer value,
+				   gpointer user_data)
+{
+	GHashTable *actions = value;
+
+	g_hash_table_foreach_remove (actions,
+				     pd_daemon_auth_cache_expired,
+				     user_data);
+	return g_hash_table_size (actions) == 0;
+}
+
+/* Removes expired entries, at most once per TTL. Must be called
+ * while holding the daemon's auth_lock */
+static void
+pd_daemon_auth_cache_sweep (PdDaemon *daemon)
+{
+	gint64 now = g_get_monotonic_time ();
+
+	if (now - daemon->auth_cache_swept < PD_DAEMON_AUTH_CACHE_TTL)
+		return;
+
+	daemon->auth_cache_swept = now;
+	g_hash_table_foreach_remove (daemon->auth_cache,
+				     pd_daemon_auth_cache_sweep_sender,
+				     &now);
+}
+
+/* Must be called while holding the daemon's auth_lock */
+static void
+pd_daemon_auth_cache_insert (PdDaemon *daemon,
+			     const gchar *sender,
+			     const gchar *action_id)
+{
+	GHashTable *actions;
+	gint64 *expiry;
+
+	pd_daemon_auth_cache_sweep (daemon);
+
+	/* The client may have gone while polkit was deciding */
+	if (pd_daemon_has_departed (daemon, sender))
+		return;
+
+	actions = g_hash_table_lookup (daemon->auth_cache, sender);
+	if (actions == NULL) {
+		actions = g_hash_table_new_full (g_str_hash,
+						 g_str_equal,
+						 g_free,
+						 g_free);
+		g_hash_table_insert (daemon->auth_cache,
+				     g_strdup (sender),
+				     actions);
+	}
+
+	expiry = g_new (gint64, 1);
+	*expiry = g_get_monotonic_time () + PD_DAEMON_AUTH_CACHE_TTL;
+	g_hash_table_insert (actions, g_strdup (action_id), expiry);
+}
+
+/* Returns the first of @action_ids the client is known to be
+ * authorized for, or NULL */
+static const gchar *
+pd_daemon_auth_cache_check (PdDaemon *daemon,
+			    const gchar *sender,
+			    gchar **action_ids)
+{
+	gchar **action_id;
+
+	pd_mutex_lock (&daemon->auth_lock, PD_LOCK_AUTH);
+	for (action_id = action_ids; *action_id; action_id++)
+		if (pd_daemon_auth_cache_lookup (daemon, sender, *action_id))
+			break;
+
+	if (*action_id)
+		daemon->auth_cache_hits++;
+	else
+		daemon->auth_cache_misses++;
+	pd_mutex_unlock (&daemon->auth_lock, PD_LOCK_AUTH);
+
+	return *action_id;
+}
+
+static gchar **
+collect_action_ids (const gchar *first_action_id,
+		    va_list va_args)
+{
+	GPtrArray *action_ids = g_ptr_array_new ();
+	const gchar *action_id;
+
+	for (action_id = first_action_id;
+	     action_id;
+	     action_id = va_arg (va_args, const gchar *))
+		g_ptr_array_add (action_ids, g_strdup (action_id));
+
+	g_ptr_array_add (action_ids, NULL);
+	return (gchar **) g_ptr_array_free (action_ids, FALSE);
+}
+
 /**
  * pd_daemon_check_authorization_sync:
  * @daemon: A #PdDaemon.
@@ -334,7 +968,9 @@ pd_daemon_get_engine (PdDaemon *daemon)
  * @description: Description text for the action.
  * @invociation: A #GDBusMethodInvocation.
  *
- * Checks authorization using polkit.
+ * Checks authorization using polkit. Positive results are cached
+ * per bus name and action for a few seconds, except those which
+ * needed the user to authenticate and which polkit does not retain.
  *
  * Returns: True if the subject is authorized.
  */
@@ -347,40 +983,70 @@ pd_daemon_check_authorization_sync (PdDaemon *daemon,
 				    ...)
 {
 	va_list va_args;
-	const gchar *action_id, *next_action_id;
+	gchar **action_ids = NULL;
+	const gchar *action_id;
+	guint i;
 	gboolean ret = FALSE;
 	GError *error = NULL;
 	const gchar *sender;
 	PolkitSubject *subject;
-	PolkitCheckAuthorizationFlags flags = 0;
 	PolkitAuthorizationResult *result = NULL;
+	gboolean cache = TRUE;
+
+	sender = g_dbus_method_invocation_get_sender (invocation);
+	PD_TRACE1 (auth_start, sender);
 
 	if (daemon->is_session) {
 		ret = TRUE;
 		goto out;
 	}
 
-	sender = g_dbus_method_invocation_get_sender (invocation);
+	va_start (va_args, first_action_id);
+	action_ids = collect_action_ids (first_action_id, va_args);
+	va_end (va_args);
+
+	/* Has this client recently been authorized for any of the
+	 * actions? */
+	action_id = pd_daemon_auth_cache_check (daemon, sender, action_ids);
+	if (action_id) {
+		g_debug ("[Daemon] %s authorized for %s (cached)",
+			 sender, action_id);
+		ret = TRUE;
+		goto out;
+	}
+
 	subject = polkit_system_bus_name_new (sender);
 
-	va_start (va_args, first_action_id);
-	action_id = first_action_id;
-	while (action_id) {
-		next_action_id = va_arg (va_args, const gchar *);
-		if (!next_action_id)
-			flags = POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION;
+	for (i = 0; action_ids[i]; i++) {
+		action_id = action_ids[i];
 		g_clear_error (&error);
 		result = polkit_authority_check_authorization_sync (daemon->authority,
 								    subject,
 								    action_id,
 								    NULL,
-								    flags,
+								    0,
 								    NULL,
 								    &error);
 		if (result)
 			break;
+	}
 
-		action_id = next_action_id;
+	/* The last action may be authorized by authenticating. That
+	 * covers only this call unless polkit retains it. */
+	if (result &&
+	    !action_ids[i + 1] &&
+	    !polkit_authorization_result_get_is_authorized (result) &&
+	    polkit_authorization_result_get_is_challenge (result)) {
+		g_clear_object (&result);
+		result = polkit_authority_check_authorization_sync (daemon->authority,
+								    subject,
+								    action_id,
+								    NULL,
+								    POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION,
+								    NULL,
+								    &error);
+		cache = result &&
+			polkit_authorization_result_get_retains_authorization (result);
 	}
 
 	g_object_unref (subject);
@@ -405,11 +1071,253 @@ pd_daemon_check_authorization_sync (PdDaemon *daemon,
 
 	/* Authorized */
 	g_debug ("[Daemon] %s authorized for %s", sender, action_id);
+	if (cache) {
+		pd_mutex_lock (&daemon->auth_lock, PD_LOCK_AUTH);
+		pd_daemon_auth_cache_insert (daemon, sender, action_id);
+		pd_mutex_unlock (&daemon->auth_lock, PD_LOCK_AUTH);
+	}
 	ret = TRUE;
 
+ out:
+	PD_TRACE2 (auth_end, sender, ret);
+	if (result)
+		g_object_unref (result);
+
+	g_strfreev (action_ids);
+	return ret;
+}
+
+typedef struct {
+	gchar *sender;
+	PolkitSubject *subject;
+	gchar **action_ids;
+	guint current;
+	gboolean interactive;	/* asking the user to authenticate */
+	gchar *message;
+} PdDaemonCheckAuthData;
+
+static void
+pd_daemon_check_auth_data_free (PdDaemonCheckAuthData *data)
+{
+	g_free (data->sender);
+	if (data->subject)
+		g_object_unref (data->subject);
+	g_strfreev (data->action_ids);
+	g_free (data->message);
+	g_free (data);
+}
+
+static void pd_daemon_check_authorization_next (GTask *task);
+
+static void
+pd_daemon_check_authorization_cb (GObject *source_object,
+				  GAsyncResult *res,
+				  gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	PdDaemon *daemon = g_task_get_source_object (task);
+	PdDaemonCheckAuthData *data = g_task_get_task_data (task);
+	PolkitAuthorizationResult *result;
+	const gchar *action_id = data->action_ids[data->current];
+	const gchar *sender;
+	GError *error = NULL;
+
+	result = polkit_authority_check_authorization_finish (POLKIT_AUTHORITY (source_object),
+							      res,
+							      &error);
+	if (result == NULL) {
+		if (data->action_ids[data->current + 1]) {
+			/* Try the next action */
+			g_error_free (error);
+			data->current++;
+			pd_daemon_check_authorization_next (task);
+			return;
+		}
+
+		g_warning ("[Daemon] Checking authorization: %s",
+			   error->message);
+		g_task_return_error (task, error);
+		goto out;
+	}
+
+	sender = polkit_system_bus_name_get_name (POLKIT_SYSTEM_BUS_NAME (data->subject));
+
+	/* The last action may be authorized by authenticating */
+	if (!data->interactive &&
+	    !data->action_ids[data->current + 1] &&
+	    !polkit_authorization_result_get_is_authorized (result) &&
+	    polkit_authorization_result_get_is_challenge (result)) {
+		g_object_unref (result);
+		data->interactive = TRUE;
+		pd_daemon_check_authorization_next (task);
+		return;
+	}
+
+	if (!polkit_authorization_result_get_is_authorized (result)) {
+		g_debug ("[Daemon] %s not authorized", sender);
+		g_task_return_new_error (task,
+					 PD_ERROR,
+					 PD_ERROR_FAILED,
+					 "%s", data->message);
+		goto out;
+	}
+
+	/* Authorized. Authenticating covers only this call unless
+	 * polkit retains it. */
+	g_debug ("[Daemon] %s authorized for %s", sender, action_id);
+	if (!data->interactive ||
+	    polkit_authorization_result_get_retains_authorization (result)) {
+		pd_mutex_lock (&daemon->auth_lock, PD_LOCK_AUTH);
+		pd_daemon_auth_cache_insert (daemon, sender, action_id);
+		pd_mutex_unlock (&daemon->auth_lock, PD_LOCK_AUTH);
+	}
+
+	g_task_return_boolean (task, TRUE);
+
  out:
 	if (result)
 		g_object_unref (result);
+	g_object_unref (task);
+}
+
+static void
+pd_daemon_check_authorization_next (GTask *task)
+{
+	PdDaemon *daemon = g_task_get_source_object (task);
+	PdDaemonCheckAuthData *data = g_task_get_task_data (task);
+	PolkitCheckAuthorizationFlags flags = 0;
+
+	/* Check without interaction first, so that only that result
+	 * is cached */
+	if (data->interactive)
+		flags = POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION;
+
+	polkit_authority_check_authorization (daemon->authority,
+					      data->subject,
+					      data->action_ids[data->current],
+					      NULL,
+					      flags,
+					      g_task_get_cancellable (task),
+					      pd_daemon_check_authorization_cb,
+					      task);
+}
+
+static gboolean
+pd_daemon_test_delay_cb (gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+
+	g_task_return_boolean (task, TRUE);
+	g_object_unref (task);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * pd_daemon_check_authorization:
+ * @daemon: A #PdDaemon.
+ * @options: Options (ignored except for testing).
+ * @message: Error message to return if the subject is not authorized.
+ * @invocation: A #GDBusMethodInvocation.
+ * @callback: Function to call when the check is complete.
+ * @user_data: Data to pass to @callback.
+ * @first_action_id: The first polkit action to check.
+ * @...: Further action ids, terminated by %NULL.
+ *
+ * Asynchronous version of pd_daemon_check_authorization_sync(), for
+ * method handlers that run in the main thread. Unlike the synchronous
+ * version this does not complete @invocation; call
+ * pd_daemon_check_authorization_finish() from @callback.
+ */
+void
+pd_daemon_check_authorization (PdDaemon *daemon,
+			       GVariant *options,
+			       const gchar *message,
+			       GDBusMethodInvocation *invocation,
+			       GAsyncReadyCallback callback,
+			       gpointer user_data,
+			       const gchar *first_action_id,
+			       ...)
+{
+	va_list va_args;
+	GTask *task;
+	PdDaemonCheckAuthData *data;
+	const gchar *sender;
+	const gchar *action_id;
+
+	task = g_task_new (daemon, NULL, callback, user_data);
+
+	sender = g_dbus_method_invocation_get_sender (invocation);
+	PD_TRACE1 (auth_start, sender);
+
+	data = g_new0 (PdDaemonCheckAuthData, 1);
+	data->sender = g_strdup (sender);
+	g_task_set_task_data (task,
+			      data,
+			      (GDestroyNotify) pd_daemon_check_auth_data_free);
+
+	if (daemon->is_session) {
+		guint delay = 0;
+
+		/* Allow tests to simulate a slow authentication agent */
+		if (options)
+			g_variant_lookup (options,
+					  "test-authorization-delay",
+					  "u",
+					  &delay);
+
+		if (delay)
+			g_timeout_add (delay, pd_daemon_test_delay_cb, task);
+		else {
+			g_task_return_boolean (task, TRUE);
+			g_object_unref (task);
+		}
+
+		return;
+	}
+
+	va_start (va_args, first_action_id);
+	data->action_ids = collect_action_ids (first_action_id, va_args);
+	va_end (va_args);
+	data->message = g_strdup (message);
+
+	action_id = pd_daemon_auth_cache_check (daemon,
+						sender,
+						data->action_ids);
+	if (action_id) {
+		g_debug ("[Daemon] %s authorized for %s (cached)",
+			 sender, action_id);
+		g_task_return_boolean (task, TRUE);
+		g_object_unref (task);
+		return;
+	}
+
+	data->subject = polkit_system_bus_name_new (sender);
+	pd_daemon_check_authorization_next (task);
+}
+
+/**
+ * pd_daemon_check_authorization_finish:
+ * @daemon: A #PdDaemon.
+ * @result: The #GAsyncResult passed to the callback.
+ * @error: Return location for error.
+ *
+ * Finishes an authorization check started with
+ * pd_daemon_check_authorization().
+ *
+ * Returns: True if the subject is authorized.
+ */
+gboolean
+pd_daemon_check_authorization_finish (PdDaemon *daemon,
+				      GAsyncResult *result,
+				      GError **error)
+{
+	PdDaemonCheckAuthData *data;
+	gboolean ret;
+
+	g_return_val_if_fail (g_task_is_valid (result, daemon), FALSE);
 
+	data = g_task_get_task_data (G_TASK (result));
+	ret = g_task_propagate_boolean (G_TASK (result), error);
+	PD_TRACE2 (auth_end, data->sender, ret);
 	return ret;
 }
@@ -44,6 +44,28 @@ gboolean		 pd_daemon_check_authorization_sync	(PdDaemon	*daemon,
 								 GDBusMethodInvocation *invocation,
 								 const gchar	*action_id,
 								 ...);
+void			 pd_daemon_check_authorization	(PdDaemon	*daemon,
+								 GVariant	*options,
+								 const gchar	*message,
+								 GDBusMethodInvocation *invocation,
+								 GAsyncReadyCallback callback,
+								 gpointer	 user_data,
+								 const gchar	*action_id,
+								 ...);
+gboolean		 pd_daemon_check_authorization_finish	(PdDaemon	*daemon,
+								 GAsyncResult	*result,
+								 GError	**error);
+gchar			*pd_daemon_get_unix_user	(PdDaemon	*daemon,
+								 GDBusMethodInvocation *invocation);
+void			 pd_daemon_get_unix_user_async	(PdDaemon	*daemon,
+								 GDBusMethodInvocation *invocation,
+								 GAsyncReadyCallback callback,
+								 gpointer	 user_data);
+gchar			*pd_daemon_get_unix_user_finish	(PdDaemon	*daemon,
+								 GAsyncResult	*result);
+void			 pd_daemon_get_auth_cache_stats	(PdDaemon	*daemon,
+								 guint64	*hits,
+								 guint64	*misses);
 
 G_END_DECLS
 
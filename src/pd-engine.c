@@ -32,6 +32,7 @@
 #include "pd-printer-impl.h"
 #include "pd-job-impl.h"
 #include "pd-log.h"
+#include "pd-lock.h"
 
 /**
  * SECTION:printerdengine
@@ -292,9 +293,9 @@ on_uevent (GUdevClient *client,
 	   gpointer user_data)
 {
 	PdEngine *engine = PD_ENGINE (user_data);
-	g_mutex_lock (&engine->priv->lock);
+	pd_mutex_lock (&engine->priv->lock, PD_LOCK_ENGINE);
 	pd_engine_handle_uevent (engine, action, udevdevice);
-	g_mutex_unlock (&engine->priv->lock);
+	pd_mutex_unlock (&engine->priv->lock, PD_LOCK_ENGINE);
 }
 
 static void
@@ -634,7 +635,7 @@ pd_engine_add_printer	(PdEngine *engine,
 	}
 
 	/* add it to the hash */
-	g_mutex_lock (&engine->priv->lock);
+	pd_mutex_lock (&engine->priv->lock, PD_LOCK_ENGINE);
 	id = pd_printer_impl_get_id (PD_PRINTER_IMPL (printer));
 	if (g_hash_table_lookup (engine->priv->id_to_printer, id) != NULL) {
 		/* collision so choose another id */
@@ -660,6 +661,7 @@ pd_engine_add_printer	(PdEngine *engine,
 	g_hash_table_insert (engine->priv->id_to_printer,
 			     g_strdup (objid->str),
 			     (gpointer) printer);
+	pd_printer_impl_create_metrics (PD_PRINTER_IMPL (printer));
 	engine_debug (engine, "add printer %s", objid->str);
 
 	/* watch for state changes */
@@ -677,7 +679,7 @@ pd_engine_add_printer	(PdEngine *engine,
 					     G_DBUS_OBJECT_SKELETON (printer_object));
 
  out:
-	g_mutex_unlock (&engine->priv->lock);
+	pd_mutex_unlock (&engine->priv->lock, PD_LOCK_ENGINE);
 	if (driver)
 		g_free (driver);
 	if (printer_object)
@@ -706,7 +708,7 @@ pd_engine_remove_printer	(PdEngine *engine,
 	PdPrinter *printer = NULL;
 	const gchar *id;
 
-	g_mutex_lock (&engine->priv->lock);
+	pd_mutex_lock (&engine->priv->lock, PD_LOCK_ENGINE);
 	obj = pd_daemon_find_object (daemon, printer_path);
 	if (!obj)
 		goto out;
@@ -717,6 +719,7 @@ pd_engine_remove_printer	(PdEngine *engine,
 	g_dbus_object_manager_server_unexport (pd_daemon_get_object_manager (daemon),
 					       printer_path);
 	g_hash_table_remove (engine->priv->id_to_printer, id);
+	pd_metrics_printer_remove (pd_printer_impl_get_metrics (PD_PRINTER_IMPL (printer)));
 	g_signal_handlers_disconnect_by_func (printer,
 					      pd_engine_printer_state_notify,
 					      printer);
@@ -725,7 +728,7 @@ pd_engine_remove_printer	(PdEngine *engine,
 	ret = TRUE;
 
  out:
-	g_mutex_unlock (&engine->priv->lock);
+	pd_mutex_unlock (&engine->priv->lock, PD_LOCK_ENGINE);
 	if (obj)
 		g_object_unref (obj);
 	if (printer) {
@@ -751,20 +754,24 @@ pd_engine_get_printer_by_path	(PdEngine *engine,
 		return NULL;
 
 	printer_id++;
-	g_mutex_lock (&engine->priv->lock);
+	pd_mutex_lock (&engine->priv->lock, PD_LOCK_ENGINE);
 	printer = g_hash_table_lookup (engine->priv->id_to_printer,
 				       printer_id);
 	if (printer)
 		g_object_ref (printer);
 
-	g_mutex_unlock (&engine->priv->lock);
+	pd_mutex_unlock (&engine->priv->lock, PD_LOCK_ENGINE);
 	return printer;
 }
 
 /**
  * pd_engine_add_job:
  * @engine: A #PdEngine.
- * @job: A #PdJob.
+ * @printer_path: Object path of the printer for the job.
+ * @name: Name for the job.
+ * @defaults: Snapshot of the printer's defaults, from
+ * pd_attribute_table_new(), shared by the job.
+ * @attributes: Job attributes given by the client.
  *
  * Creates a new PdJob and exports it on the bus.  Returns the
  * newly-allocated object.
@@ -773,6 +780,7 @@ PdJob *
 pd_engine_add_job	(PdEngine *engine,
 			 const gchar *printer_path,
 			 const gchar *name,
+			 GHashTable *defaults,
 			 GVariant *attributes)
 {
 	PdJob *job = NULL;
@@ -783,7 +791,7 @@ pd_engine_add_job	(PdEngine *engine,
 	g_return_val_if_fail (PD_IS_ENGINE (engine), NULL);
 
 	/* create the job */
-	g_mutex_lock (&engine->priv->lock);
+	pd_mutex_lock (&engine->priv->lock, PD_LOCK_ENGINE);
 	daemon = pd_engine_get_daemon (engine);
 	job_id = engine->priv->next_job_id;
 	engine->priv->next_job_id++;
@@ -791,6 +799,7 @@ pd_engine_add_job	(PdEngine *engine,
 				    "daemon", daemon,
 				    "id", job_id,
 				    "name", name,
+				    "defaults", defaults,
 				    "attributes", attributes,
 				    "printer", printer_path,
 				    NULL));
@@ -810,7 +819,7 @@ pd_engine_add_job	(PdEngine *engine,
 	g_dbus_object_manager_server_export (pd_daemon_get_object_manager (daemon),
 					     G_DBUS_OBJECT_SKELETON (job_object));
 
-	g_mutex_unlock (&engine->priv->lock);
+	pd_mutex_unlock (&engine->priv->lock, PD_LOCK_ENGINE);
 	if (job_object)
 		g_object_unref (job_object);
 	g_free (object_path);
@@ -913,7 +922,7 @@ pd_engine_dup_printer_ids	(PdEngine *engine)
 {
 	GList *copy, *keys;
 	g_return_val_if_fail (PD_IS_ENGINE (engine), NULL);
-	g_mutex_lock (&engine->priv->lock);
+	pd_mutex_lock (&engine->priv->lock, PD_LOCK_ENGINE);
 	keys = g_hash_table_get_keys (engine->priv->id_to_printer);
 #if GLIB_CHECK_VERSION(2,34,0)
 	copy = g_list_copy_deep (keys, (GCopyFunc) g_strdup, NULL);
@@ -925,7 +934,7 @@ pd_engine_dup_printer_ids	(PdEngine *engine)
 	     each = g_list_next (each))
 		copy = g_list_append (copy, g_strdup (each->data));
 #endif /* glib < 2.34 */
-	g_mutex_unlock (&engine->priv->lock);
+	pd_mutex_unlock (&engine->priv->lock, PD_LOCK_ENGINE);
 	g_list_free (keys);
 	return copy;
 }
@@ -942,10 +951,10 @@ pd_engine_get_devices	(PdEngine *engine)
 {
 	GList *devices;
 	g_return_val_if_fail (PD_IS_ENGINE (engine), NULL);
-	g_mutex_lock (&engine->priv->lock);
+	pd_mutex_lock (&engine->priv->lock, PD_LOCK_ENGINE);
 	devices = g_hash_table_get_values (engine->priv->path_to_device);
 	g_list_foreach (devices, (GFunc) g_object_ref, NULL);
-	g_mutex_unlock (&engine->priv->lock);
+	pd_mutex_unlock (&engine->priv->lock, PD_LOCK_ENGINE);
 	return devices;
 }
 
@@ -85,6 +85,7 @@ PdPrinter	*pd_engine_get_printer_by_path	(PdEngine	*engine,
 PdJob		*pd_engine_add_job		(PdEngine	*engine,
 						 const gchar	*printer_path,
 						 const gchar	*name,
+						 GHashTable	*defaults,
 						 GVariant	*attributes);
 gboolean	 pd_engine_remove_job		(PdEngine	*engine,
 						 const gchar	*job_path);
@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -42,6 +43,11 @@
 #include "pd-job-impl.h"
 #include "pd-printer-impl.h"
 #include "pd-log.h"
+#include "pd-lock.h"
+#include "pd-metrics.h"
+#include "pd-spawn-helper.h"
+#include "pd-trace.h"
+#include "pd-watchdog.h"
 
 /**
  * SECTION:pdjob
@@ -71,6 +77,9 @@ struct _PdJobProcess
 	gboolean	 finished;
 	GPid		 pid;
 	guint		 process_watch_source;
+	gint		 exit_status;
+	gboolean	 have_usage;
+	PdMetricsUsage	 usage;
 
 	guint		 io_source[5];
 	GIOChannel	*channel[5];
@@ -82,6 +91,15 @@ struct _PdJobProcess
 	gchar		*final_content_type;
 };
 
+/* What every process for a job is run with. This is made once, when
+ * processing starts, and is not changed afterwards. */
+typedef struct
+{
+	/* argv[0] is the command, filled in for each process */
+	gchar		*argv[8];
+	gchar		*envp[3];
+} PdJobExecContext;
+
 /**
  * PdJobImpl:
  *
@@ -93,12 +111,38 @@ struct _PdJobImpl
 	PdJobSkeleton	 parent_instance;
 	PdDaemon	*daemon;
 
+	/* Job attributes by name, of GVariant: those set for
+	 * this job, over a snapshot of the printer's defaults which is
+	 * shared with other jobs and never modified. The Attributes
+	 * property merges them when it is first read after a change. */
+	GHashTable	*attributes;
+	GHashTable	*defaults;
+	GVariant	*attributes_value;
+
 	gint		 document_fd;
 	gchar		*document_filename;
 	gchar		*document_mimetype;
 
+	/* Set while Start is spooling the document */
+	GCancellable	*spool_cancellable;
+
+	/* Lifecycle timeline, of PdJobImplEvent. The Timeline
+	 * property is built from it when first read after a change. */
+	GArray		*timeline;
+	GVariant	*timeline_value;
+	gboolean	 sent_first_byte;
+
+	/* The printer's metrics, taken when processing starts */
+	PdMetricsPrinter *metrics;
+
+	/* Properties kept here rather than in the skeleton that have
+	 * changed since clients were last told */
+	guint		 invalidated;
+	guint		 invalidated_source;
+
 	GList		*filterchain; /* of _PdJobProcess* */
 	struct _PdJobProcess *backend;
+	PdJobExecContext *exec;
 	gint		 pending_job_state;
 
 	gint		 fd_back[2];
@@ -117,10 +161,26 @@ struct _PdJobImplClass
 	PdJobSkeletonClass parent_class;
 };
 
+typedef struct
+{
+	gchar		*stage;
+	gint64		 time;	/* monotonic, in microseconds */
+} PdJobImplEvent;
+
 enum
 {
 	PROP_0,
 	PROP_DAEMON,
+	PROP_DEFAULTS,
+	PROP_ATTRIBUTES,
+	PROP_TIMELINE,
+};
+
+/* Properties in the invalidated mask */
+enum
+{
+	PD_JOB_IMPL_ATTRIBUTES	= 1 << 0,
+	PD_JOB_IMPL_TIMELINE	= 1 << 1,
 };
 
 enum
@@ -138,6 +198,15 @@ static void pd_job_impl_add_state_reason (PdJobImpl *job,
 static void pd_job_impl_remove_state_reason (PdJobImpl *job,
 					     const gchar *reason);
 static void pd_job_impl_job_state_notify (PdJobImpl *job);
+static void pd_job_impl_update_resource_usage (PdJobImpl *job);
+static void pd_job_impl_foreach_attribute (PdJobImpl *job,
+					   GHFunc func,
+					   gpointer user_data);
+static GVariant *pd_job_impl_peek_attributes (PdJobImpl *job);
+static GVariant *pd_job_impl_peek_timeline (PdJobImpl *job);
+static void pd_job_impl_invalidate (PdJobImpl *job,
+				    guint properties);
+static void pd_job_impl_attributes_changed (PdJobImpl *job);
 static void pd_job_impl_do_cancel_with_reason (PdJobImpl *job,
 					       gint job_state,
 					       const gchar *reason);
@@ -164,7 +233,7 @@ pd_job_impl_finalize_jp (gpointer data)
 		job_debug (PD_JOB (jp->job),
 			   "Sending KILL signal to backend PID %d",
 			   jp->pid);
-		kill (jp->pid, SIGKILL);
+		pd_spawn_helper_kill (jp->pid, SIGKILL);
 		g_spawn_close_pid (jp->pid);
 	}
 
@@ -186,6 +255,22 @@ pd_job_impl_finalize_jp (gpointer data)
 	g_free (jp);
 }
 
+static void
+pd_job_impl_exec_context_free (PdJobExecContext *exec)
+{
+	gint i;
+
+	if (exec == NULL)
+		return;
+
+	for (i = 1; exec->argv[i]; i++)
+		g_free (exec->argv[i]);
+	for (i = 0; exec->envp[i]; i++)
+		g_free (exec->envp[i]);
+
+	g_free (exec);
+}
+
 static void
 pd_job_impl_finalize (GObject *object)
 {
@@ -211,17 +296,29 @@ pd_job_impl_finalize (GObject *object)
 	if (job->fd_side[1] != -1)
 		close (job->fd_side[1]);
 
+	if (job->metrics)
+		pd_metrics_printer_unref (job->metrics);
+
 	/* Shut down filter chain */
 	g_list_free_full (job->filterchain,
 			  pd_job_impl_finalize_jp);
 
 	/* Shut down backend */
 	pd_job_impl_finalize_jp (job->backend);
+	pd_job_impl_exec_context_free (job->exec);
 
 	g_signal_handlers_disconnect_by_func (job,
 					      pd_job_impl_job_state_notify,
 					      job);
 
+	g_array_unref (job->timeline);
+	if (job->timeline_value)
+		g_variant_unref (job->timeline_value);
+	g_hash_table_unref (job->attributes);
+	if (job->attributes_value)
+		g_variant_unref (job->attributes_value);
+	if (job->defaults)
+		g_hash_table_unref (job->defaults);
 	g_mutex_clear (&job->lock);
 	G_OBJECT_CLASS (pd_job_impl_parent_class)->finalize (object);
 }
@@ -238,6 +335,16 @@ pd_job_impl_get_property (GObject *object,
 	case PROP_DAEMON:
 		g_value_set_object (value, job->daemon);
 		break;
+	case PROP_ATTRIBUTES:
+		pd_mutex_lock (&job->lock, PD_LOCK_JOB);
+		g_value_set_variant (value, pd_job_impl_peek_attributes (job));
+		pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
+		break;
+	case PROP_TIMELINE:
+		pd_mutex_lock (&job->lock, PD_LOCK_JOB);
+		g_value_set_variant (value, pd_job_impl_peek_timeline (job));
+		pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -258,12 +365,196 @@ pd_job_impl_set_property (GObject *object,
 		/* we don't take a reference to the daemon */
 		job->daemon = g_value_get_object (value);
 		break;
+	case PROP_DEFAULTS:
+		g_assert (job->defaults == NULL);
+		job->defaults = g_value_dup_boxed (value);
+		break;
+	case PROP_ATTRIBUTES:
+		pd_mutex_lock (&job->lock, PD_LOCK_JOB);
+		g_hash_table_remove_all (job->attributes);
+		if (g_value_get_variant (value))
+			pd_attribute_table_update (job->attributes,
+						   g_value_get_variant (value));
+		pd_job_impl_attributes_changed (job);
+		pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
 	}
 }
 
+static void
+pd_job_impl_clear_event (gpointer data)
+{
+	PdJobImplEvent *event = data;
+
+	g_free (event->stage);
+}
+
+/**
+ * pd_job_impl_mark:
+ * @job: A #PdJobImpl
+ * @format: printf()-style format for the stage name
+ *
+ * Record that @job reached a stage of its lifecycle now. Clients are
+ * told the Timeline property has changed from the main loop.
+ *
+ * This must be called while holding the @job's lock.
+ */
+static void
+pd_job_impl_mark (PdJobImpl *job,
+		  const gchar *format,
+		  ...)
+{
+	PdJobImplEvent event;
+	va_list ap;
+
+	va_start (ap, format);
+	event.stage = g_strdup_vprintf (format, ap);
+	va_end (ap);
+	event.time = g_get_monotonic_time ();
+	g_array_append_val (job->timeline, event);
+
+	if (job->timeline_value) {
+		g_variant_unref (job->timeline_value);
+		job->timeline_value = NULL;
+	}
+
+	pd_job_impl_invalidate (job, PD_JOB_IMPL_TIMELINE);
+}
+
+/* Value for the Timeline property, owned by the job and valid until
+ * the next stage is marked. Must hold the job's lock. */
+static GVariant *
+pd_job_impl_peek_timeline (PdJobImpl *job)
+{
+	GVariantBuilder builder;
+	guint i;
+
+	if (job->timeline_value)
+		return job->timeline_value;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(st)"));
+	for (i = 0; i < job->timeline->len; i++) {
+		PdJobImplEvent *each = &g_array_index (job->timeline,
+						       PdJobImplEvent, i);
+		g_variant_builder_add (&builder, "(st)",
+				       each->stage, (guint64) each->time);
+	}
+
+	job->timeline_value = g_variant_ref_sink (g_variant_builder_end (&builder));
+	return job->timeline_value;
+}
+
+/* Time of the first (or last) event for @stage, or -1 */
+static gint64
+pd_job_impl_stage_time (PdJobImpl *job,
+			const gchar *stage,
+			gboolean last)
+{
+	gint64 ret = -1;
+	guint i;
+
+	for (i = 0; i < job->timeline->len; i++) {
+		PdJobImplEvent *event = &g_array_index (job->timeline,
+							PdJobImplEvent, i);
+		if (strcmp (event->stage, stage))
+			continue;
+
+		ret = event->time;
+		if (!last)
+			break;
+	}
+
+	return ret;
+}
+
+/* Time of the first filter spawn (or last filter exit) for
+ * @prefix, not counting the backend, or -1 */
+static gint64
+pd_job_impl_filter_time (PdJobImpl *job,
+			 const gchar *prefix,
+			 gboolean last)
+{
+	gint64 ret = -1;
+	guint i;
+
+	for (i = 0; i < job->timeline->len; i++) {
+		PdJobImplEvent *event = &g_array_index (job->timeline,
+							PdJobImplEvent, i);
+		if (!g_str_has_prefix (event->stage, prefix) ||
+		    !strcmp (event->stage + strlen (prefix), "backend"))
+			continue;
+
+		ret = event->time;
+		if (!last)
+			break;
+	}
+
+	return ret;
+}
+
+/**
+ * pd_job_impl_log_timeline:
+ * @job: A #PdJobImpl
+ *
+ * Log a summary of how long @job spent in each part of its
+ * lifecycle, and record those durations in the daemon metrics.
+ * Logged times are in milliseconds.
+ *
+ * This must be called while holding the @job's lock.
+ */
+static void
+pd_job_impl_log_timeline (PdJobImpl *job)
+{
+	GString *summary = g_string_new ("");
+	gint64 created, pending, first_byte, end;
+	gint64 spooling, spooled;
+	gint64 filters_start, filters_done;
+	gint64 backend_start, backend_done;
+
+	created = pd_job_impl_stage_time (job, "created", FALSE);
+	pending = pd_job_impl_stage_time (job, "pending", FALSE);
+	first_byte = pd_job_impl_stage_time (job, "first-byte", FALSE);
+	spooling = pd_job_impl_stage_time (job, "spooling", FALSE);
+	spooled = pd_job_impl_stage_time (job, "spooled", FALSE);
+	filters_start = pd_job_impl_filter_time (job, "spawn:", FALSE);
+	filters_done = pd_job_impl_filter_time (job, "exit:", TRUE);
+	backend_start = pd_job_impl_stage_time (job, "spawn:backend", FALSE);
+	backend_done = pd_job_impl_stage_time (job, "exit:backend", FALSE);
+	end = g_array_index (job->timeline, PdJobImplEvent,
+			     job->timeline->len - 1).time;
+
+	g_string_append_printf (summary, "total=%" G_GINT64_FORMAT,
+				(end - created) / 1000);
+	pd_metrics_observe (PD_METRICS_JOB_LATENCY, end - created);
+
+	if (pending != -1)
+		g_string_append_printf (summary, " queued-after=%" G_GINT64_FORMAT,
+					(pending - created) / 1000);
+	if (pending != -1 && first_byte != -1)
+		g_string_append_printf (summary, " time-to-first-byte=%" G_GINT64_FORMAT,
+					(first_byte - pending) / 1000);
+	if (spooling != -1 && spooled != -1)
+		pd_metrics_observe (PD_METRICS_SPOOL_TIME,
+				    spooled - spooling);
+	if (filters_start != -1 && filters_done != -1) {
+		g_string_append_printf (summary, " transform=%" G_GINT64_FORMAT,
+					(filters_done - filters_start) / 1000);
+		pd_metrics_observe (PD_METRICS_TRANSFORM_TIME,
+				    filters_done - filters_start);
+	}
+	if (backend_start != -1 && backend_done != -1)
+		pd_metrics_observe (PD_METRICS_BACKEND_TIME,
+				    backend_done - backend_start);
+
+	job_log (PD_JOB (job), LOG_INFO, "Finished (%s): %s",
+		 pd_job_state_as_string (pd_job_get_state (PD_JOB (job))),
+		 summary->str);
+	g_string_free (summary, TRUE);
+}
+
 static void
 pd_job_impl_init_jp (PdJobImpl *job,
 		     struct _PdJobProcess *jp)
@@ -296,6 +587,13 @@ pd_job_impl_init (PdJobImpl *job)
 
 	g_mutex_init (&job->lock);
 
+	job->attributes = pd_attribute_table_new (NULL);
+
+	job->timeline = g_array_new (FALSE, FALSE, sizeof (PdJobImplEvent));
+	g_array_set_clear_func (job->timeline, pd_job_impl_clear_event);
+	pd_job_impl_mark (job, "created");
+	pd_job_impl_update_resource_usage (job);
+
 	pd_job_set_state (PD_JOB (job), PD_JOB_STATE_PENDING_HELD);
 	gchar *incoming[] = { g_strdup ("job-incoming"), NULL };
 	pd_job_set_state_reasons (PD_JOB (job),
@@ -342,6 +640,34 @@ pd_job_impl_class_init (PdJobImplClass *klass)
 							      G_PARAM_CONSTRUCT_ONLY |
 							      G_PARAM_STATIC_STRINGS));
 
+	/**
+	 * PdJobImpl:defaults:
+	 *
+	 * The printer's defaults when the job was created, as a
+	 * #GHashTable from pd_attribute_table_new(). It is shared, so
+	 * must not be modified.
+	 */
+	g_object_class_install_property (gobject_class,
+					 PROP_DEFAULTS,
+					 g_param_spec_boxed ("defaults",
+							     "Defaults",
+							     "The printer defaults for the job",
+							     G_TYPE_HASH_TABLE,
+							     G_PARAM_WRITABLE |
+							     G_PARAM_CONSTRUCT_ONLY |
+							     G_PARAM_STATIC_STRINGS));
+
+	/* Attributes are kept in our own tables rather than in the
+	 * skeleton, and merged when read */
+	g_object_class_override_property (gobject_class,
+					  PROP_ATTRIBUTES,
+					  "attributes");
+
+	/* Likewise the timeline, which changes several times a job */
+	g_object_class_override_property (gobject_class,
+					  PROP_TIMELINE,
+					  "timeline");
+
 	/**
 	 * PdJobImpl::add-printer-state-reason
 	 *
@@ -490,22 +816,119 @@ pd_job_impl_check_job_transforming (PdJobImpl *job)
 	return job_transforming;
 }
 
+/**
+ * pd_job_impl_update_resource_usage:
+ * @job: A #PdJobImpl
+ *
+ * Set the ResourceUsage property from the processes which have
+ * finished.
+ *
+ * This must be called while holding the @job's lock.
+ */
+static void
+pd_job_impl_update_resource_usage (PdJobImpl *job)
+{
+	GVariantBuilder builder;
+	GList *processes, *each;
+
+	processes = g_list_copy (job->filterchain);
+	if (job->backend)
+		processes = g_list_append (processes, job->backend);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+	for (each = processes; each; each = g_list_next (each)) {
+		struct _PdJobProcess *jp = each->data;
+
+		if (!jp->finished)
+			continue;
+
+		g_variant_builder_open (&builder, G_VARIANT_TYPE ("{sa{sv}}"));
+		g_variant_builder_add (&builder, "s", jp->what);
+		g_variant_builder_open (&builder, G_VARIANT_TYPE ("a{sv}"));
+		g_variant_builder_add (&builder, "{sv}", "command",
+				       g_variant_new_string (jp->cmd));
+		g_variant_builder_add (&builder, "{sv}", "exit-status",
+				       g_variant_new_int32 (jp->exit_status));
+		if (jp->have_usage)
+			pd_metrics_usage_build (&jp->usage, &builder);
+		g_variant_builder_close (&builder);
+		g_variant_builder_close (&builder);
+	}
+
+	pd_job_set_resource_usage (PD_JOB (job),
+				   g_variant_builder_end (&builder));
+	g_list_free (processes);
+}
+
+/* Name to total resource usage under. cupsfilter runs the PPD's
+ * filters itself and waits for them, so its usage includes theirs. */
+static const gchar *
+pd_job_impl_process_name (struct _PdJobProcess *jp)
+{
+	const gchar *slash;
+
+	switch (jp->type) {
+	case FILTERCHAIN_CUPSFILTER:
+		return "cupsfilter";
+
+	case FILTERCHAIN_FILE_OUTPUT:
+		return "file-output";
+
+	default:
+		slash = strrchr (jp->cmd, '/');
+		return slash ? slash + 1 : jp->cmd;
+	}
+}
+
 static void
 pd_job_impl_process_watch_cb (GPid pid,
 			      gint status,
+			      const struct rusage *usage,
 			      gpointer user_data)
 {
 	struct _PdJobProcess *jp = (struct _PdJobProcess *) user_data;
 	PdJobImpl *job = PD_JOB_IMPL (jp->job);
+	const gchar *watchdog;
 
-	g_mutex_lock (&job->lock);
+	watchdog = pd_watchdog_enter ("[printerd] child watch");
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
 	g_object_freeze_notify (G_OBJECT (job));
 	g_spawn_close_pid (pid);
 	jp->finished = TRUE;
 	jp->process_watch_source = 0;
-	job_debug (PD_JOB (jp->job),
-		   "PID %d (%s) finished with status %d",
-		   pid, jp->what, WEXITSTATUS (status));
+	if (WIFSIGNALED (status)) {
+		/* Report the signal as a negative status */
+		jp->exit_status = -WTERMSIG (status);
+		job_debug (PD_JOB (jp->job),
+			   "PID %d (%s) killed by signal %d",
+			   pid, jp->what, WTERMSIG (status));
+	} else {
+		jp->exit_status = WEXITSTATUS (status);
+		job_debug (PD_JOB (jp->job),
+			   "PID %d (%s) finished with status %d",
+			   pid, jp->what, jp->exit_status);
+	}
+
+	pd_job_impl_mark (job, "exit:%s", jp->what);
+	PD_TRACE3 (process_exit, pd_job_get_id (PD_JOB (job)), jp->what,
+		   status);
+	pd_metrics_gauge_add (PD_METRICS_ACTIVE_FILTERS, -1);
+
+	if (usage) {
+		jp->have_usage = TRUE;
+		pd_metrics_usage_init (&jp->usage, usage);
+		pd_metrics_add_usage (job->metrics,
+				      pd_job_impl_process_name (jp),
+				      &jp->usage);
+		job_debug (PD_JOB (jp->job),
+			   "%s used %" G_GUINT64_FORMAT "us user, %"
+			   G_GUINT64_FORMAT "us system, %"
+			   G_GUINT64_FORMAT "KiB max RSS",
+			   jp->what, jp->usage.user_usec,
+			   jp->usage.system_usec, jp->usage.max_rss_kb);
+	}
+
+	pd_job_impl_update_resource_usage (job);
 
 	/* Close its input file descriptors */
 	if (jp->io_source[STDIN_FILENO]) {
@@ -525,8 +948,9 @@ pd_job_impl_process_watch_cb (GPid pid,
 		/* Backend. */
 		pd_job_impl_remove_state_reason (job, "job-outgoing");
 
-	/* Adjust job state. */
-	if (WEXITSTATUS (status) != 0) {
+	/* Adjust job state, unless we killed it ourselves. */
+	if (jp->exit_status != 0 &&
+	    !state_reason_is_set (job, "processing-to-stop-point")) {
 		job_debug (PD_JOB (jp->job),
 			   "%s failed: aborting job", jp->what);
 
@@ -555,11 +979,21 @@ pd_job_impl_process_watch_cb (GPid pid,
 		}
 	}
 
-	g_mutex_unlock (&job->lock);
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
 	g_object_thaw_notify (G_OBJECT (job));
+	pd_watchdog_leave (watchdog);
 }
 
-static void
+/**
+ * pd_job_impl_parse_stderr:
+ * @job: A #PdJobImpl.
+ * @line: A line of output from a filter or backend.
+ *
+ * Acts on "STATE:" messages by emitting
+ * #PdJobImpl::add-printer-state-reason or
+ * #PdJobImpl::remove-printer-state-reason for each reason.
+ */
+void
 pd_job_impl_parse_stderr (PdJobImpl *job,
 			  const gchar *line)
 {
@@ -615,9 +1049,12 @@ pd_job_impl_data_io_cb (GIOChannel *channel,
 	GIOChannel *nextchannel;
 	gint thisfd;
 	gint nextfd;
+	const gchar *watchdog;
 
-	g_mutex_lock (&job->lock);
+	watchdog = pd_watchdog_enter ("[printerd] job data");
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
 	g_object_freeze_notify (G_OBJECT (job));
+	pd_metrics_count (PD_METRICS_RELAY_WAKEUPS, job->metrics, 1);
 	if (condition & (G_IO_IN | G_IO_HUP)) {
 		g_assert (thisjp != job->backend);
 		thisfd = STDOUT_FILENO;
@@ -634,6 +1071,8 @@ pd_job_impl_data_io_cb (GIOChannel *channel,
 		case G_IO_STATUS_NORMAL:
 			job->buflen = got;
 			job->bufsent = 0;
+			PD_TRACE3 (relay_read, pd_job_get_id (PD_JOB (job)),
+				   thisjp->what, got);
 			job_debug (PD_JOB (job), "Read %zu bytes from %s",
 				   got,
 				   thisjp->what);
@@ -708,6 +1147,8 @@ pd_job_impl_data_io_cb (GIOChannel *channel,
 			thisjp->io_source[thisfd] = 0;
 			job_debug (PD_JOB (job), "Closing input to %s",
 				   thisjp->what);
+			if (thisjp == job->backend)
+				pd_job_impl_mark (job, "last-byte");
 			thisjp->channel[thisfd] = NULL;
 			g_io_channel_unref (channel);
 			pd_job_impl_check_job_transforming (job);
@@ -741,9 +1182,21 @@ pd_job_impl_data_io_cb (GIOChannel *channel,
 		case G_IO_STATUS_NORMAL:
 			job_debug (PD_JOB (job), "Wrote %zu bytes to %s",
 				   wrote, thisjp->what);
+			PD_TRACE3 (relay_write, pd_job_get_id (PD_JOB (job)),
+				   thisjp->what, wrote);
 			break;
 		}
 
+		if (wrote > 0 && thisjp == job->backend) {
+			if (!job->sent_first_byte) {
+				job->sent_first_byte = TRUE;
+				pd_job_impl_mark (job, "first-byte");
+			}
+
+			pd_metrics_count (PD_METRICS_BYTES_RELAYED,
+					  job->metrics, wrote);
+		}
+
 		job->bufsent += wrote;
 
 		if (job->buflen - job->bufsent == 0) {
@@ -763,8 +1216,9 @@ pd_job_impl_data_io_cb (GIOChannel *channel,
 	}
 
  out:
-	g_mutex_unlock (&job->lock);
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
 	g_object_thaw_notify (G_OBJECT (job));
+	pd_watchdog_leave (watchdog);
 	return keep_source;
 }
 
@@ -781,10 +1235,12 @@ pd_job_impl_message_io_cb (GIOChannel *channel,
 	gchar *line = NULL;
 	gsize got;
 	gint thisfd;
+	const gchar *watchdog;
 
 	g_assert (condition & (G_IO_IN | G_IO_HUP));
 
-	g_mutex_lock (&job->lock);
+	watchdog = pd_watchdog_enter ("[printerd] job messages");
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
 	g_object_freeze_notify (G_OBJECT (job));
 
 	if (channel == jp->channel[STDERR_FILENO])
@@ -841,10 +1297,11 @@ pd_job_impl_message_io_cb (GIOChannel *channel,
 	}
 
  out:
-	g_mutex_unlock (&job->lock);
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
 	g_object_thaw_notify (G_OBJECT (job));
 	if (line)
 		g_free (line);
+	pd_watchdog_leave (watchdog);
 	return keep_source;
 }
 
@@ -857,7 +1314,7 @@ pd_job_impl_create_pipe_for (PdJobImpl *job,
 	GError *error = NULL;
 	gint pipe_fd[2];
 
-	if (!g_unix_open_pipe (pipe_fd, 0, &error)) {
+	if (!g_unix_open_pipe (pipe_fd, FD_CLOEXEC, &error)) {
 		job_warning (PD_JOB (job), "Failed to create pipe: %s",
 			     error->message);
 		g_error_free (error);
@@ -869,212 +1326,150 @@ pd_job_impl_create_pipe_for (PdJobImpl *job,
 	return TRUE;
 }
 
-static void
-pd_job_impl_process_setup (gpointer user_data)
+/**
+ * pd_job_impl_file_output:
+ *
+ * The backend for file: device URIs, which copies its standard input
+ * to the file named by DEVICE_URI. The daemon runs itself with
+ * --file-output for this, so that it is started like any other
+ * backend.
+ *
+ * Returns: The exit status.
+ */
+gint
+pd_job_impl_file_output (void)
 {
-	struct _PdJobProcess *jp = (struct _PdJobProcess *) user_data;
-	gint i;
-
-	/* Close the parent's ends of any pipes */
-	for (i = 0; i < PD_FD_MAX; i++)
-		if (jp->parent_fd[i] != -1)
-			close (jp->parent_fd[i]);
-
-	/* Watch out for clashes */
-	for (i = 0; i < PD_FD_MAX; i++)
-		if (jp->child_fd[i] < PD_FD_MAX &&
-		    jp->child_fd[i] != i) {
-			gint newfd = PD_FD_MAX + i;
-			dup2 (jp->child_fd[i], newfd);
-			close (jp->child_fd[i]);
-			jp->child_fd[i] = newfd;
-		}
-
-	/* Set our standard file descriptors to existing ones */
-	for (i = 0; i < PD_FD_MAX; i++)
-		if (jp->child_fd[i] != -1 &&
-		    jp->child_fd[i] != i) {
-			if (dup2 (jp->child_fd[i], i) == -1 &&
-			    i > STDERR_FILENO)
-				fprintf (stderr,
-					 "ERROR: dup2(%d,%d) failed with %s\n",
-					 jp->child_fd[i], i, strerror (errno));
-			if (close (jp->child_fd[i]) && i > STDERR_FILENO)
-				fprintf (stderr,
-					 "ERROR: close(%d) failed with %s\n",
-					 jp->child_fd[i], strerror (errno));
-		}
-}
+	gchar *uri;
+	gchar *options;
+	GInputStream *input = NULL;
+	GFile *file = NULL;
+	GFileIOStream *fileio = NULL;
+	GOutputStream *output = NULL;
+	GError *error = NULL;
+	guint64 delay = 0;
+	gint ret = 0;
 
-static GVariant *
-get_attribute_value (PdJob *job,
-		     const gchar *key)
-{
-	GVariant *attributes;
-	GVariantIter iter;
-	gchar *dkey;
-	GVariant *dvalue;
-
-	attributes = pd_job_get_attributes (PD_JOB (job));
-	g_variant_iter_init (&iter, attributes);
-	while (g_variant_iter_loop (&iter, "{sv}", &dkey, &dvalue))
-		if (!strcmp (dkey, key)) {
-			g_free (dkey);
-			return dvalue;
-		}
+	uri = g_strdup (g_getenv ("DEVICE_URI"));
+	if (!uri) {
+		fprintf (stderr, "ERROR: no DEVICE_URI in environment\n");
+		return 1;
+	}
 
-	return NULL;
-}
+	/* Process any options (for testing) */
+	options = strchr (uri, '?');
+	if (options) {
+		char *next_option;
+		char *option;
+		*options++ = '\0';
+		for (option = options;
+		     option && *option;
+		     option = next_option) {
+			char *opt;
+			char *value;
+			char *end;
+
+			next_option = strchr (option, '&');
+			if (next_option) {
+				end = next_option;
+				*next_option++ = '\0';
+			} else
+				end = option + strlen (option);
+
+			opt = g_uri_unescape_segment (option, end, NULL);
+			if (!opt)
+				continue;
 
-static gboolean
-run_file_output (gchar **argv,
-		 gchar **envp,
-		 GSpawnChildSetupFunc child_setup,
-		 gpointer user_data,
-		 GPid *child_pid,
-		 GError **error)
-{
-	pid_t pid = fork ();
+			value = strchr (opt, '=');
+			if (!value)
+				value = "true";
+			else
+				*value++ = '\0';
 
-	if (pid == -1) {
-		*error = g_error_new (PD_ERROR,
-				      PD_ERROR_FAILED,
-				      "fork: %s",
-				      strerror (errno));
-		return FALSE;
-	} else if (pid == 0) {
-		gchar **env;
-		gchar *uri = NULL;
-		gchar *options;
-		GInputStream *input;
-		GFile *file;
-		GFileIOStream *fileio = NULL;
-		GOutputStream *output = NULL;
-		GError *error = NULL;
-		guint64 delay = 0;
-		gint ret = 0;
-
-		/* Child */
-		(*child_setup) (user_data);
-
-		/* Write output to file */
-		for (env = envp; *env; env++)
-			if (!strncmp (*env, "DEVICE_URI=", 11)) {
-				uri = g_strdup (*env + 11);
-				break;
+			if (!g_strcmp0 (opt, "wait")) {
+				delay = g_ascii_strtoull (value, &end, 10);
+				if (delay > G_MAXUINT)
+					delay = G_MAXUINT;
 			}
 
-		if (!uri) {
-			fprintf (stderr,
-				 "ERROR: no DEVICE_URI in environment\n");
-			exit (1);
+			g_free (opt);
 		}
+	}
 
-		/* Process any options (for testing) */
-		options = strchr (uri, '?');
-		if (options) {
-			char *next_option;
-			char *option;
-			*options++ = '\0';
-			for (option = options;
-			     option && *option;
-			     option = next_option) {
-				char *opt;
-				char *value;
-				char *end;
-
-				next_option = strchr (option, '&');
-				if (next_option) {
-					end = next_option;
-					*next_option++ = '\0';
-				} else
-					end = option + strlen (option);
-
-				opt = g_uri_unescape_segment (option,
-							      end,
-							      NULL);
-				if (!opt)
-					continue;
-
-				value = strchr (opt, '=');
-				if (!value)
-					value = "true";
-				else
-					*value++ = '\0';
-
-				if (!g_strcmp0 (opt, "wait")) {
-					delay = g_ascii_strtoull (value,
-								  &end,
-								  10);
-					if (delay > G_MAXUINT)
-						delay = G_MAXUINT;
-				}
+	file = g_file_new_for_uri (uri);
+	fileio = g_file_open_readwrite (file, NULL, &error);
+	if (!fileio) {
+		ret = 1;
+		goto out;
+	}
 
-				g_free (opt);
-			}
-		}
+	if (delay) {
+		fprintf (stderr, "DEBUG: Sleeping for %us\n",
+			 (unsigned int) delay);
+		sleep ((unsigned int) delay);
+	}
 
-		file = g_file_new_for_uri (uri);
-		fileio = g_file_open_readwrite (file, NULL, &error);
-		if (!fileio) {
-			fprintf (stderr, "ERROR: %s\n", error->message);
-			g_error_free (error);
-			exit (1);
-		}
+	output = g_io_stream_get_output_stream (G_IO_STREAM (fileio));
+	input = g_unix_input_stream_new (STDIN_FILENO, FALSE);
+	if (g_output_stream_splice (output,
+				    input,
+				    0,
+				    NULL,
+				    &error) == -1)
+		ret = 1;
 
-		if (delay) {
-			fprintf (stderr, "DEBUG: Sleeping for %us\n",
-				 (unsigned int) delay);
-			sleep ((unsigned int) delay);
-		}
+	if (ret == 0 && g_io_stream_close (G_IO_STREAM (fileio),
+					   NULL,
+					   &error) == -1)
+		ret = 1;
 
-		output = g_io_stream_get_output_stream (G_IO_STREAM (fileio));
-		input = g_unix_input_stream_new (STDIN_FILENO, FALSE);
-		if (g_output_stream_splice (output,
-					    input,
-					    0,
-					    NULL,
-					    &error) == -1)
-			ret = 1;
-
-		if (ret == 0 && g_io_stream_close (G_IO_STREAM (fileio),
-						   NULL,
-						   &error) == -1)
-			ret = 1;
-
-		if (ret == 0 && !g_input_stream_close (input, NULL, &error))
-			ret = 1;
-
-		if (ret) {
-			fprintf (stderr, "ERROR: %s\n", error->message);
-			g_error_free (error);
-		}
+	if (ret == 0 && !g_input_stream_close (input, NULL, &error))
+		ret = 1;
 
-		if (fileio)
-			g_io_stream_close (G_IO_STREAM (fileio), NULL, NULL);
-		if (input)
-			g_input_stream_close (input, NULL, NULL);
+ out:
+	if (ret) {
+		fprintf (stderr, "ERROR: %s\n", error->message);
+		g_error_free (error);
+	}
 
+	if (fileio) {
+		g_io_stream_close (G_IO_STREAM (fileio), NULL, NULL);
 		g_object_unref (fileio);
-		g_object_unref (file);
-		g_free (uri);
-		exit (ret);
+	}
+	if (input) {
+		g_input_stream_close (input, NULL, NULL);
+		g_object_unref (input);
 	}
 
-	/* Parent */
-	*child_pid = pid;
-	return TRUE;
+	if (file)
+		g_object_unref (file);
+	g_free (uri);
+	return ret;
+}
+
+static gboolean
+run_file_output (gchar **envp,
+		 const gint *child_fds,
+		 GPid *child_pid,
+		 GError **error)
+{
+	/* Run this program again, so as not to fork the daemon */
+	const gchar *argv[] = { "printerd", "--file-output", NULL };
+
+	return pd_spawn_helper_spawn (PD_SELF_EXE,
+				      (gchar **) argv,
+				      envp,
+				      child_fds,
+				      PD_FD_MAX,
+				      child_pid,
+				      error);
 }
 
 static gboolean
 run_cupsfilter (PdJobImpl *job,
+		struct _PdJobProcess *jp,
 		gchar **envp,
-		GSpawnChildSetupFunc child_setup,
-		gpointer user_data,
-		GPid *child_pid,
 		GError **error)
 {
-	struct _PdJobProcess *jp = user_data;
 	PdPrinter *printer;
 	const gchar *driver;
 	gboolean ret;
@@ -1112,132 +1507,130 @@ run_cupsfilter (PdJobImpl *job,
 	for (s = argv + 1; *s; s++)
 		job_debug (PD_JOB (job), " Arg: %s", *s);
 
-	ret = g_spawn_async ("/" /* wd */,
-			     argv,
-			     envp,
-			     G_SPAWN_DO_NOT_REAP_CHILD,
-			     child_setup,
-			     user_data,
-			     child_pid,
-			     error);
+	ret = pd_spawn_helper_spawn (argv[0],
+				     argv,
+				     envp,
+				     jp->child_fd,
+				     PD_FD_MAX,
+				     &jp->pid,
+				     error);
 
 	g_strfreev (argv);
 	return ret;
 }
 
+typedef struct
+{
+	PdJobImpl	*job;
+	GString		*options;
+} PdJobImplOptions;
+
+static void
+pd_job_impl_append_option (gpointer key,
+			   gpointer value,
+			   gpointer user_data)
+{
+	PdJobImplOptions *data = user_data;
+
+	if (!pd_append_cups_option (data->options, key, value))
+		job_debug (PD_JOB (data->job),
+			   "Not passing attribute %s to filters",
+			   (const gchar *) key);
+}
+
+/**
+ * pd_job_impl_exec_context_new:
+ * @job: A #PdJobImpl
+ * @ppd: (allow-none): The printer's driver
+ *
+ * Make the arguments and environment shared by all the processes
+ * for @job, from its attributes as they are now.
+ *
+ * This must be called while holding the @job's lock.
+ *
+ * Returns: (transfer full): The execution context.
+ */
+static PdJobExecContext *
+pd_job_impl_exec_context_new (PdJobImpl *job,
+			      const gchar *ppd)
+{
+	PdJobExecContext *exec = g_new0 (PdJobExecContext, 1);
+	const gchar *uri = pd_job_get_device_uri (PD_JOB (job));
+	PdJobImplOptions data;
+	GVariant *variant;
+	gchar **s;
+
+	data.job = job;
+	data.options = g_string_new ("");
+	pd_job_impl_foreach_attribute (job,
+				       pd_job_impl_append_option,
+				       &data);
+
+	/* URI */
+	exec->argv[1] = g_strdup (uri);
+	/* Job ID */
+	exec->argv[2] = g_strdup_printf ("%u", pd_job_get_id (PD_JOB (job)));
+	/* User name */
+	variant = pd_job_impl_get_attribute (job, "job-originating-user-name");
+	if (variant)
+		exec->argv[3] = g_variant_dup_string (variant, NULL);
+	else
+		exec->argv[3] = g_strdup ("unknown");
+	/* Job title */
+	exec->argv[4] = g_strdup (pd_job_get_name (PD_JOB (job)));
+	/* Copies */
+	exec->argv[5] = g_strdup ("1");
+	/* Options */
+	exec->argv[6] = g_string_free (data.options, FALSE);
+
+	exec->envp[0] = g_strdup_printf ("DEVICE_URI=%s", uri);
+	exec->envp[1] = g_strdup_printf ("PPD=%s", ppd ? ppd : "");
+
+	for (s = exec->envp; *s; s++)
+		job_debug (PD_JOB (job), " Env: %s", *s);
+	for (s = exec->argv + 1; *s; s++)
+		job_debug (PD_JOB (job), " Arg: %s", *s);
+
+	return exec;
+}
+
 static gboolean
 pd_job_impl_run_process (PdJobImpl *job,
 			 struct _PdJobProcess *jp,
-			 const gchar *ppd,
 			 GError **error)
 {
 	gboolean ret = FALSE;
-	guint job_id = pd_job_get_id (PD_JOB (job));
-	gchar *username;
-	GString *options = NULL;
-	GVariant *attributes;
-	GVariant *variant;
-	GVariantIter iter;
-	gchar *dkey;
-	GVariant *dvalue;
-	const gchar *uri;
-	char **argv = NULL;
-	char **envp = NULL;
-	gchar **s;
+	gchar *argv[G_N_ELEMENTS (job->exec->argv)];
+	gchar **envp = job->exec->envp;
 	gint i;
 
-	uri = pd_job_get_device_uri (PD_JOB (job));
-
-	variant = get_attribute_value (PD_JOB (job),
-				       "job-originating-user-name");
-	if (variant) {
-		username = g_variant_dup_string (variant, NULL);
-		g_variant_unref (variant);
-	} else
-		username = g_strdup ("unknown");
-
-	attributes = pd_job_get_attributes (PD_JOB (job));
-	g_variant_iter_init (&iter, attributes);
-	while (g_variant_iter_loop (&iter, "{sv}", &dkey, &dvalue)) {
-		gchar *val;
-
-		if (g_variant_is_of_type (dvalue, G_VARIANT_TYPE_STRING))
-			val = g_variant_dup_string (dvalue, NULL);
-		else
-			val = g_variant_print (dvalue, FALSE);
-
-		if (options == NULL) {
-			options = g_string_new ("");
-			g_string_printf (options, "%s=%s", dkey, val);
-		} else
-			g_string_append_printf (options, " %s=%s", dkey, val);
-
-		g_free (val);
-	}
-
-	if (options == NULL)
-		options = g_string_new ("");
-
-	argv = g_malloc0 (sizeof (char *) * 8);
-	argv[0] = g_strdup (jp->cmd);
-	if (jp->type != FILTERCHAIN_CUPSFILTER) {
-		/* URI */
-		argv[1] = g_strdup (uri);
-		/* Job ID */
-		argv[2] = g_strdup_printf ("%u", job_id);
-		/* User name */
-		argv[3] = username;
-		/* Job title */
-		argv[4] = g_strdup (pd_job_get_name (PD_JOB (job)));
-		/* Copies */
-		argv[5] = g_strdup ("1");
-		/* Options */
-		argv[6] = options->str;
-		g_string_free (options, FALSE);
-		argv[7] = NULL;
-	}
-
-	envp = g_malloc0 (sizeof (char *) * 3);
-	envp[0] = g_strdup_printf ("DEVICE_URI=%s", uri);
-	envp[1] = g_strdup_printf ("PPD=%s", ppd);
-	envp[2] = NULL;
+	/* The arguments are the same for each process apart from the
+	 * command itself */
+	memcpy (argv, job->exec->argv, sizeof (argv));
+	argv[0] = jp->cmd;
 
 	job_debug (PD_JOB (job), "Executing %s", argv[0]);
-	for (s = envp; *s; s++)
-		job_debug (PD_JOB (job), " Env: %s", *s);
-	if (jp->type != FILTERCHAIN_CUPSFILTER)
-		for (s = argv + 1; *s; s++)
-			job_debug (PD_JOB (job), " Arg: %s", *s);
 
 	switch (jp->type) {
 	case FILTERCHAIN_CMD:
-		ret = g_spawn_async ("/" /* wd */,
-				     argv,
-				     envp,
-				     G_SPAWN_DO_NOT_REAP_CHILD |
-				     G_SPAWN_FILE_AND_ARGV_ZERO,
-				     pd_job_impl_process_setup,
-				     jp,
-				     &jp->pid,
-				     error);
+		ret = pd_spawn_helper_spawn (argv[0],
+					     argv,
+					     envp,
+					     jp->child_fd,
+					     PD_FD_MAX,
+					     &jp->pid,
+					     error);
 		break;
 
 	case FILTERCHAIN_FILE_OUTPUT:
-		ret = run_file_output (argv,
-				       envp,
-				       pd_job_impl_process_setup,
-				       jp,
+		ret = run_file_output (envp,
+				       jp->child_fd,
 				       &jp->pid,
 				       error);
 		break;
 
 	case FILTERCHAIN_CUPSFILTER:
-		ret = run_cupsfilter (job,
-				      envp,
-				      pd_job_impl_process_setup,
-				      jp,
-				      &jp->pid,
-				      error);
+		ret = run_cupsfilter (job, jp, envp, error);
 		break;
 
 	default:
@@ -1248,6 +1641,17 @@ pd_job_impl_run_process (PdJobImpl *job,
 		goto out;
 
 	jp->started = TRUE;
+	pd_job_impl_mark (job, "spawn:%s", jp->what);
+	PD_TRACE3 (process_spawn, pd_job_get_id (PD_JOB (job)), jp->what,
+		   jp->pid);
+	pd_metrics_gauge_add (PD_METRICS_ACTIVE_FILTERS, 1);
+
+	/* Watch for it exiting straight away, so it is reaped even if
+	 * a later process in the chain fails to start */
+	jp->process_watch_source =
+		pd_spawn_helper_child_watch_add (jp->pid,
+						 pd_job_impl_process_watch_cb,
+						 jp);
 
 	/* Close the child's end of the in/out/err pipes now they've started */
 	for (i = 0; i <= STDERR_FILENO; i++)
@@ -1277,10 +1681,6 @@ pd_job_impl_run_process (PdJobImpl *job,
 	}
 
  out:
-	if (argv)
-		g_strfreev (argv);
-
-	g_strfreev (envp);
 	return ret;
 }
 
@@ -1299,6 +1699,7 @@ pd_job_impl_start_processing (PdJobImpl *job)
 	GError *error = NULL;
 	const gchar *uri;
 	PdPrinter *printer = NULL;
+	PdMetricsPrinter *metrics;
 	char *scheme = NULL;
 	GIOChannel *channel;
 	struct _PdJobProcess *jp;
@@ -1320,13 +1721,18 @@ pd_job_impl_start_processing (PdJobImpl *job)
 		goto fail;
 	}
 
+	/* Keep the printer's metrics so relaying needn't look them up */
+	metrics = pd_printer_impl_get_metrics (PD_PRINTER_IMPL (printer));
+	if (job->metrics == NULL && metrics)
+		job->metrics = pd_metrics_printer_ref (metrics);
+
 	uri = pd_printer_impl_get_uri (PD_PRINTER_IMPL (printer));
 	job_debug (PD_JOB (job), "Using device URI %s", uri);
 	pd_job_set_device_uri (PD_JOB (job), uri);
 	scheme = g_uri_parse_scheme (uri);
 
 	/* Open document */
-	document_fd = open (job->document_filename, O_RDONLY);
+	document_fd = open (job->document_filename, O_RDONLY | O_CLOEXEC);
 	if (document_fd == -1) {
 		job_warning (PD_JOB (job), "Failed to open spool file %s: %s",
 			     job->document_filename, g_strerror (errno));
@@ -1339,7 +1745,8 @@ pd_job_impl_start_processing (PdJobImpl *job)
 		job->backend->type = FILTERCHAIN_FILE_OUTPUT;
 	} else {
 		job->backend->type = FILTERCHAIN_CMD;
-		job->backend->cmd = g_strdup_printf ("/usr/lib/cups/backend/%s",
+		job->backend->cmd = g_strdup_printf ("%s/backend/%s",
+						     pd_get_serverbin (),
 						     scheme);
 	}
 
@@ -1349,7 +1756,8 @@ pd_job_impl_start_processing (PdJobImpl *job)
 	jp = g_malloc0 (sizeof (struct _PdJobProcess));
 	pd_job_impl_init_jp (job, jp);
 	jp->type = FILTERCHAIN_CMD;
-	jp->cmd = g_strdup ("/usr/lib/cups/filter/pdftopdf");
+	jp->cmd = g_strdup_printf ("%s/filter/pdftopdf",
+				   pd_get_serverbin ());
 	jp->what = "arranger";
 
 	/* Add the arranger to the filter chain */
@@ -1387,7 +1795,8 @@ pd_job_impl_start_processing (PdJobImpl *job)
 		jp = g_malloc0 (sizeof (struct _PdJobProcess));
 		pd_job_impl_init_jp (job, jp);
 		jp->type = FILTERCHAIN_CMD;
-		jp->cmd = g_strdup_printf ("/usr/lib/cups/filter/%s",
+		jp->cmd = g_strdup_printf ("%s/filter/%s",
+					   pd_get_serverbin (),
 					   final_filter);
 		jp->what = "final-filter";
 
@@ -1411,7 +1820,7 @@ pd_job_impl_start_processing (PdJobImpl *job)
 		goto fail_setup;
 
 	/* Connect the back-channel between backend and filter-chain */
-	if (!g_unix_open_pipe (job->fd_back, 0, &error)) {
+	if (!g_unix_open_pipe (job->fd_back, FD_CLOEXEC, &error)) {
 		job_warning (PD_JOB (job), "Failed to create pipe: %s",
 			     error->message);
 		g_error_free (error);
@@ -1427,7 +1836,8 @@ pd_job_impl_start_processing (PdJobImpl *job)
 	}
 
 	/* Connect the side-channel between filter-chain and backend */
-	if (socketpair (AF_LOCAL, SOCK_STREAM, 0, job->fd_side) != 0) {
+	if (socketpair (AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0,
+			job->fd_side) != 0) {
 		job_warning (PD_JOB (job), "Failed to create socket pair: %s",
 			     g_strerror (errno));
 		goto fail;
@@ -1466,7 +1876,7 @@ pd_job_impl_start_processing (PdJobImpl *job)
 
 		jp = filter->data;
 		nextjp = next_filter->data;
-		if (!g_unix_open_pipe (pipe_fd, 0, &error)) {
+		if (!g_unix_open_pipe (pipe_fd, FD_CLOEXEC, &error)) {
 			job_warning (PD_JOB (job), "Failed to create pipe: %s",
 				     error->message);
 			g_error_free (error);
@@ -1493,13 +1903,16 @@ pd_job_impl_start_processing (PdJobImpl *job)
 	   processing (the backend hasn't run yet). */
 	job->pending_job_state = PD_JOB_STATE_PROCESSING;
 
+	/* Every process gets the same arguments and environment */
+	job->exec = pd_job_impl_exec_context_new (job, driver);
+
 	/* Run filter chain */
 	pd_job_impl_add_state_reason (job, "job-transforming");
 	for (filter = g_list_first (job->filterchain);
 	     filter;
 	     filter = g_list_next (filter)) {
 		jp = filter->data;
-		if (!pd_job_impl_run_process (job, jp, driver, &error)) {
+		if (!pd_job_impl_run_process (job, jp, &error)) {
 			job_warning (PD_JOB (job), "Running %s: %s",
 				     jp->what, error->message);
 			g_error_free (error);
@@ -1525,17 +1938,6 @@ pd_job_impl_start_processing (PdJobImpl *job)
 					jp);
 	}
 
-	/* Watch for processes exiting */
-	for (filter = g_list_first (job->filterchain);
-	     filter;
-	     filter = g_list_next (filter)) {
-		jp = filter->data;
-		jp->process_watch_source =
-			g_child_watch_add (jp->pid,
-					   pd_job_impl_process_watch_cb,
-					   jp);
-	}
-
 	/* Don't add an IO watch to the end of the chain yet. Let it
 	 * buffer until the backend has started. */
 
@@ -1565,16 +1967,8 @@ pd_job_impl_start_sending (PdJobImpl *job)
 	GError *error = NULL;
 	GIOChannel *channel;
 	struct _PdJobProcess *jp;
-	PdPrinter *printer;
-	const gchar *driver = NULL;
 
-	printer = pd_job_impl_get_printer (job);
-	if (printer) {
-		driver = pd_printer_get_driver (printer);
-		g_object_unref (printer);
-	}
-
-	g_mutex_lock (&job->lock);
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
 	g_object_freeze_notify (G_OBJECT (job));
 
 	pd_job_impl_add_state_reason (job, "job-outgoing");
@@ -1590,7 +1984,7 @@ pd_job_impl_start_sending (PdJobImpl *job)
 	job->pending_job_state = PD_JOB_STATE_COMPLETED;
 
 	/* Run backend */
-	if (!pd_job_impl_run_process (job, job->backend, driver, &error)) {
+	if (!pd_job_impl_run_process (job, job->backend, &error)) {
 		job_warning (PD_JOB (job), "Running backend: %s",
 			     error->message);
 		g_error_free (error);
@@ -1625,13 +2019,6 @@ pd_job_impl_start_sending (PdJobImpl *job)
 				pd_job_impl_message_io_cb,
 				job->backend);
 
-	/* Watch for the backend exiting */
-	jp = job->backend;
-	jp->process_watch_source =
-		g_child_watch_add (jp->pid,
-				   pd_job_impl_process_watch_cb,
-				   jp);
-
 	/* Now there's somewhere to send the data to, add an IO watch
 	 * to the stdout of the last filter in the chain. */
 	jp = g_list_last (job->filterchain)->data;
@@ -1644,7 +2031,7 @@ pd_job_impl_start_sending (PdJobImpl *job)
 				jp);
 
  out:
-	g_mutex_unlock (&job->lock);
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
 	g_object_thaw_notify (G_OBJECT (job));
 	return;
 }
@@ -1652,10 +2039,20 @@ pd_job_impl_start_sending (PdJobImpl *job)
 static void
 pd_job_impl_job_state_notify (PdJobImpl *job)
 {
+	guint state = pd_job_get_state (PD_JOB (job));
+
 	/* This function watches changes to the job state and
 	   starts/stop things accordingly. */
 
-	switch (pd_job_get_state (PD_JOB (job))) {
+	PD_TRACE2 (job_state, pd_job_get_id (PD_JOB (job)), state);
+
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
+	pd_job_impl_mark (job, "%s", pd_job_state_as_string (state));
+	if (state >= PD_JOB_STATE_CANCELED)
+		pd_job_impl_log_timeline (job);
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
+
+	switch (state) {
 	case PD_JOB_STATE_CANCELED:
 	case PD_JOB_STATE_ABORTED:
 	case PD_JOB_STATE_COMPLETED:
@@ -1672,6 +2069,193 @@ pd_job_impl_job_state_notify (PdJobImpl *job)
 	}
 }
 
+/**
+ * pd_job_impl_get_attribute:
+ * @job: A #PdJobImpl
+ * @name: Attribute name
+ *
+ * Look up a job attribute, falling back to the printer's defaults
+ * from when the job was created.
+ *
+ * This must be called while holding the @job's lock.
+ *
+ * Returns: (transfer none): The attribute value, or %NULL if it is
+ * not set.
+ */
+GVariant *
+pd_job_impl_get_attribute (PdJobImpl *job,
+			   const gchar *name)
+{
+	GVariant *value;
+
+	value = g_hash_table_lookup (job->attributes, name);
+	if (value == NULL && job->defaults)
+		value = g_hash_table_lookup (job->defaults, name);
+
+	return value;
+}
+
+/**
+ * pd_job_impl_foreach_attribute:
+ * @job: A #PdJobImpl
+ * @func: Function to call with each name and value
+ * @user_data: Data to pass to @func
+ *
+ * Call @func for each job attribute, including printer defaults
+ * not overridden by the job.
+ *
+ * This must be called while holding the @job's lock.
+ */
+static void
+pd_job_impl_foreach_attribute (PdJobImpl *job,
+			       GHFunc func,
+			       gpointer user_data)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_foreach (job->attributes, func, user_data);
+	if (job->defaults == NULL)
+		return;
+
+	g_hash_table_iter_init (&iter, job->defaults);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		if (!g_hash_table_contains (job->attributes, key))
+			(*func) (key, value, user_data);
+}
+
+static void
+pd_job_impl_add_attribute (gpointer key,
+			   gpointer value,
+			   gpointer user_data)
+{
+	g_variant_builder_add (user_data, "{sv}",
+			       (const gchar *) key,
+			       (GVariant *) value);
+}
+
+/* Value for the Attributes property, owned by the job and valid
+ * until the attributes next change. Must hold the job's lock. */
+static GVariant *
+pd_job_impl_peek_attributes (PdJobImpl *job)
+{
+	GVariantBuilder builder;
+
+	if (job->attributes_value)
+		return job->attributes_value;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	pd_job_impl_foreach_attribute (job,
+				       pd_job_impl_add_attribute,
+				       &builder);
+	job->attributes_value = g_variant_ref_sink (g_variant_builder_end (&builder));
+	return job->attributes_value;
+}
+
+/* Tell clients which of our own properties have changed, without
+ * sending the new values. */
+static gboolean
+pd_job_impl_emit_properties_changed (gpointer user_data)
+{
+	PdJobImpl *job = PD_JOB_IMPL (user_data);
+	GDBusInterfaceSkeleton *skeleton = G_DBUS_INTERFACE_SKELETON (job);
+	const gchar *invalidated[3];
+	const gchar *object_path;
+	GList *connections, *each;
+	GVariant *signal;
+	guint properties;
+	guint n = 0;
+	const gchar *watchdog;
+
+	watchdog = pd_watchdog_enter ("[printerd] job properties");
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
+	properties = job->invalidated;
+	job->invalidated = 0;
+	job->invalidated_source = 0;
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
+
+	if (properties & PD_JOB_IMPL_ATTRIBUTES)
+		invalidated[n++] = "Attributes";
+	if (properties & PD_JOB_IMPL_TIMELINE)
+		invalidated[n++] = "Timeline";
+	invalidated[n] = NULL;
+
+	object_path = g_dbus_interface_skeleton_get_object_path (skeleton);
+	if (object_path == NULL)
+		goto out;
+
+	signal = g_variant_ref_sink (g_variant_new ("(s@a{sv}^as)",
+						    g_dbus_interface_skeleton_get_info (skeleton)->name,
+						    g_variant_new_array (G_VARIANT_TYPE ("{sv}"),
+									 NULL, 0),
+						    invalidated));
+	connections = g_dbus_interface_skeleton_get_connections (skeleton);
+	for (each = connections; each; each = g_list_next (each))
+		g_dbus_connection_emit_signal (each->data,
+					       NULL, /* destination */
+					       object_path,
+					       "org.freedesktop.DBus.Properties",
+					       "PropertiesChanged",
+					       signal,
+					       NULL);
+
+	g_list_free_full (connections, g_object_unref);
+	g_variant_unref (signal);
+ out:
+	pd_watchdog_leave (watchdog);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * pd_job_impl_invalidate:
+ * @job: A #PdJobImpl
+ * @properties: Mask of properties that have changed
+ *
+ * Arrange to signal a change to the Attributes or Timeline property
+ * from the main loop, once for any number of changes made before it
+ * runs.
+ *
+ * This must be called while holding the @job's lock.
+ */
+static void
+pd_job_impl_invalidate (PdJobImpl *job,
+			guint properties)
+{
+	GSource *source;
+
+	job->invalidated |= properties;
+	if (job->invalidated_source)
+		return;
+
+	source = g_idle_source_new ();
+	g_source_set_name (source, "[printerd] job properties");
+	g_source_set_callback (source,
+			       pd_job_impl_emit_properties_changed,
+			       g_object_ref (job),
+			       g_object_unref);
+	job->invalidated_source = g_source_attach (source, NULL);
+	g_source_unref (source);
+}
+
+/**
+ * pd_job_impl_attributes_changed:
+ * @job: A #PdJobImpl
+ *
+ * Forget the merged Attributes value and tell clients it has changed.
+ *
+ * This must be called while holding the @job's lock.
+ */
+static void
+pd_job_impl_attributes_changed (PdJobImpl *job)
+{
+	if (job->attributes_value) {
+		g_variant_unref (job->attributes_value);
+		job->attributes_value = NULL;
+	}
+
+	pd_job_impl_invalidate (job, PD_JOB_IMPL_ATTRIBUTES);
+}
+
 /**
  * pd_job_impl_set_attribute:
  * @job: A #PdJobImpl
@@ -1685,121 +2269,45 @@ pd_job_impl_set_attribute (PdJobImpl *job,
 			   const gchar *name,
 			   GVariant *value)
 {
-	GVariant *attributes;
-
-	g_mutex_lock (&job->lock);
-	g_object_freeze_notify (G_OBJECT (job));
-
-	/* Read the current value of the 'attributes' property */
-	attributes = pd_job_get_attributes (PD_JOB (job));
-
-#if GLIB_CHECK_VERSION(2,40,0)
-	GVariantDict *dict = g_variant_dict_new (attributes);
-	g_variant_dict_insert_value (dict, name, value);
-	pd_job_set_attributes (PD_JOB (job),
-			       g_variant_dict_end (dict));
-#else /* older version */
-	GVariantBuilder builder;
-	GVariantIter viter;
-	GHashTable *ht;
-	GHashTableIter htiter;
-	gchar *dkey;
-	GVariant *dvalue;
-
-	/* Convert to a GHashTable */
-	ht = g_hash_table_new_full (g_str_hash,
-				    g_str_equal,
-				    g_free,
-				    (GDestroyNotify) g_variant_unref);
-
-	g_variant_iter_init (&viter, attributes);
-	while (g_variant_iter_loop (&viter, "{sv}", &dkey, &dvalue))
-		g_hash_table_insert (ht,
-				     g_strdup (dkey),
-				     g_variant_ref_sink (dvalue));
-
-	/* Set the attribute value */
-	g_hash_table_insert (ht,
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
+	g_hash_table_insert (job->attributes,
 			     g_strdup (name),
 			     g_variant_ref_sink (value));
-
-	/* Convert back to a GVariant */
-	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
-	g_hash_table_iter_init (&htiter, ht);
-	while (g_hash_table_iter_next (&htiter,
-				       (gpointer *) &dkey,
-				       (gpointer *) &dvalue))
-		g_variant_builder_add (&builder, "{sv}", dkey, dvalue);
-
-	/* Write it back */
-	pd_job_set_attributes (PD_JOB (job),
-			       g_variant_builder_end (&builder));
-	g_hash_table_unref (ht);
-#endif /* glib < 2.40 */
-
-	g_mutex_unlock (&job->lock);
-	g_object_thaw_notify (G_OBJECT (job));
+	pd_job_impl_attributes_changed (job);
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
 }
 
-/* ------------------------------------------------------------------ */
-
-/* runs in main thread */
+/**
+ * pd_job_impl_do_add_document:
+ * @job: A #PdJobImpl
+ * @options: Options, possibly including "document-format"
+ * @fd_list: The #GUnixFDList for the method invocation
+ * @file_descriptor: Handle of the document in @fd_list
+ * @error: Return location for error
+ *
+ * Take ownership of the document file descriptor for @job.
+ *
+ * This must be called while holding the @job's lock.
+ *
+ * Returns: True on success.
+ */
 static gboolean
-pd_job_impl_add_document (PdJob *_job,
-			  GDBusMethodInvocation *invocation,
-			  GUnixFDList *fd_list,
-			  GVariant *options,
-			  GVariant *file_descriptor)
+pd_job_impl_do_add_document (PdJobImpl *job,
+			     GVariant *options,
+			     GUnixFDList *fd_list,
+			     GVariant *file_descriptor,
+			     GError **error)
 {
-	PdJobImpl *job = PD_JOB_IMPL (_job);
 	gint32 fd_handle;
-	GError *error = NULL;
-	GVariant *attr_user;
-	gchar *requesting_user = NULL;
-	const gchar *originating_user = NULL;
-
-	/* Check if the user is authorized to add a document */
-	if (!pd_daemon_check_authorization_sync (job->daemon,
-						 options,
-						 N_("Authentication is required to add a job"),
-						 invocation,
-						 "org.freedesktop.printerd.job-add",
-						 NULL))
-		return TRUE;
-
-	/* Get the requesting user before holding the lock as it uses
-	 * sync D-Bus calls */
-	requesting_user = pd_get_unix_user (invocation);
-
-	g_mutex_lock (&job->lock);
-	g_object_freeze_notify (G_OBJECT (job));
-
-	/* Check if this user owns the job */
-	attr_user = get_attribute_value (PD_JOB (job),
-					 "job-originating-user-name");
-	if (attr_user) {
-		originating_user = g_variant_get_string (attr_user, NULL);
-		g_variant_unref (attr_user);
-	}
-	if (g_strcmp0 (originating_user, requesting_user)) {
-		job_debug (PD_JOB (job), "AddDocument: denied "
-			   "[originating user: %s; requesting user: %s]",
-			   originating_user, requesting_user);
-		g_dbus_method_invocation_return_error (invocation,
-						       PD_ERROR,
-						       PD_ERROR_FAILED,
-						       N_("Not job owner"));
-		goto out;
-	}
 
 	if (job->document_fd != -1 ||
 	    job->document_filename != NULL) {
 		job_debug (PD_JOB (job), "Tried to add second document");
-		g_dbus_method_invocation_return_error (invocation,
-						       PD_ERROR,
-						       PD_ERROR_FAILED,
-						       N_("No more documents allowed"));
-		goto out;
+		g_set_error (error,
+			     PD_ERROR,
+			     PD_ERROR_FAILED,
+			     N_("No more documents allowed"));
+		return FALSE;
 	}
 
 	/* If the document format has been specified, make a note of it. */
@@ -1809,140 +2317,123 @@ pd_job_impl_add_document (PdJob *_job,
 	job_debug (PD_JOB (job), "Adding document");
 	if (fd_list == NULL || g_unix_fd_list_get_length (fd_list) != 1) {
 		job_warning (PD_JOB (job), "Bad AddDocument call");
-		g_dbus_method_invocation_return_error (invocation,
-						       PD_ERROR,
-						       PD_ERROR_FAILED,
-						       N_("Bad AddDocumentCall"));
-		goto out;
+		g_set_error (error,
+			     PD_ERROR,
+			     PD_ERROR_FAILED,
+			     N_("Bad AddDocumentCall"));
+		return FALSE;
 	}
 
 	fd_handle = g_variant_get_handle (file_descriptor);
 	job->document_fd = g_unix_fd_list_get (fd_list,
 					       fd_handle,
-					       &error);
+					       error);
 	if (job->document_fd < 0) {
 		job_debug (PD_JOB (job), " failed to get file descriptor: %s",
-			   error ? error->message : "(no error message)");
-		if (error) {
-			g_dbus_method_invocation_return_gerror (invocation,
-								error);
-			g_error_free (error);
-		} else
-			g_dbus_method_invocation_return_error \
-				(invocation,
-				 PD_ERROR,
-				 PD_ERROR_FAILED,
-				 N_("Bad AddDocumentCall"));
-		goto out;
+			   (error && *error) ? (*error)->message :
+			   "(no error message)");
+		if (error && *error == NULL)
+			g_set_error (error,
+				     PD_ERROR,
+				     PD_ERROR_FAILED,
+				     N_("Bad AddDocumentCall"));
+		return FALSE;
 	}
 
 	job_debug (PD_JOB (job), "Got file descriptor: %d", job->document_fd);
-	g_dbus_method_invocation_return_value (invocation, NULL);
-
- out:
-	g_mutex_unlock (&job->lock);
-	g_object_thaw_notify (G_OBJECT (job));
-	g_free (requesting_user);
-	return TRUE; /* handled the method invocation */
+	pd_job_impl_mark (job, "document-added");
+	return TRUE;
 }
 
-/* runs in main thread */
+/**
+ * pd_job_impl_spool_prepare:
+ * @job: A #PdJobImpl
+ * @spoolfd: (out): Return location for the spool file descriptor
+ * @input: (out): Return location for the document stream
+ * @output: (out): Return location for the spool file stream
+ * @error: Return location for error
+ *
+ * Create the spool file for the document and open streams to copy
+ * it. The @output stream owns @spoolfd.
+ *
+ * This must be called while holding the @job's lock.
+ *
+ * Returns: True on success.
+ */
 static gboolean
-pd_job_impl_start (PdJob *_job,
-		   GDBusMethodInvocation *invocation,
-		   GVariant *options)
+pd_job_impl_spool_prepare (PdJobImpl *job,
+			   gint *spoolfd,
+			   GInputStream **input,
+			   GOutputStream **output,
+			   GError **error)
 {
-	PdJobImpl *job = PD_JOB_IMPL (_job);
 	gchar *name_used = NULL;
-	GError *error = NULL;
-	GInputStream *input = NULL;
-	GOutputStream *output = NULL;
-	gint spoolfd;
-	GVariant *attr_user;
-	gchar *requesting_user = NULL;
-	const gchar *originating_user = NULL;
-
-	/* Check if the user is authorized to start a job */
-	if (!pd_daemon_check_authorization_sync (job->daemon,
-						 options,
-						 N_("Authentication is required to add a job"),
-						 invocation,
-						 "org.freedesktop.printerd.job-add",
-						 NULL))
-		return TRUE;
-
-	/* Get the requesting user before holding the lock as it uses
-	 * sync D-Bus calls */
-	requesting_user = pd_get_unix_user (invocation);
-
-	g_mutex_lock (&job->lock);
-	g_object_freeze_notify (G_OBJECT (job));
-
-	/* Check if this user owns the job */
-	attr_user = get_attribute_value (PD_JOB (job),
-					 "job-originating-user-name");
-	if (attr_user) {
-		originating_user = g_variant_get_string (attr_user, NULL);
-		g_variant_unref (attr_user);
-	}
-	if (g_strcmp0 (originating_user, requesting_user)) {
-		job_debug (PD_JOB (job), "AddDocument: denied "
-			   "[originating user: %s; requesting user: %s]",
-			   originating_user, requesting_user);
-		g_dbus_method_invocation_return_error (invocation,
-						       PD_ERROR,
-						       PD_ERROR_FAILED,
-						       N_("Not job owner"));
-		goto out;
-	}
 
 	if (job->document_fd == -1) {
-		g_dbus_method_invocation_return_error (invocation,
-						       PD_ERROR,
-						       PD_ERROR_FAILED,
-						       "No document");
-		goto out;
+		g_set_error (error,
+			     PD_ERROR,
+			     PD_ERROR_FAILED,
+			     "No document");
+		return FALSE;
 	}
 
 	g_assert (job->document_filename == NULL);
-	spoolfd = g_file_open_tmp ("printerd-spool-XXXXXX",
-				   &name_used,
-				   &error);
+	*spoolfd = g_file_open_tmp ("printerd-spool-XXXXXX",
+				    &name_used,
+				    error);
 
-	if (spoolfd < 0) {
+	if (*spoolfd < 0) {
 		job_debug (PD_JOB (job), "Error making temporary file: %s",
-			   error->message);
-		g_dbus_method_invocation_return_gerror (invocation,
-							error);
-		g_error_free (error);
-		goto out;
+			   (error && *error) ? (*error)->message :
+			   "(no error message)");
+		return FALSE;
 	}
 
-	job->document_filename = g_strdup (name_used);
+	job->document_filename = name_used;
+	pd_job_impl_mark (job, "spooling");
+	PD_TRACE1 (spool_start, pd_job_get_id (PD_JOB (job)));
 
 	job_debug (PD_JOB (job), "Starting job");
 
 	job_debug (PD_JOB (job), "Spooling");
 	job_debug (PD_JOB (job), "  Created temporary file %s", name_used);
 
-	input = g_unix_input_stream_new (job->document_fd,
-					 TRUE /* close_fd */);
-	output = g_unix_output_stream_new (spoolfd,
-					   FALSE /* close_fd */);
+	*input = g_unix_input_stream_new (job->document_fd,
+					  TRUE /* close_fd */);
+	*output = g_unix_output_stream_new (*spoolfd,
+					    TRUE /* close_fd */);
 	job->document_fd = -1;
+	pd_job_set_spool_progress (PD_JOB (job), 0);
+	return TRUE;
+}
 
-	if (g_output_stream_splice (output,
-				    input,
-				    G_OUTPUT_STREAM_SPLICE_NONE,
-				    NULL, /* cancellable */
-				    &error) == -1)
-		goto fail;
-
-	if (g_output_stream_close (output, NULL, &error) == -1)
-		goto fail;
+/**
+ * pd_job_impl_spool_finish:
+ * @job: A #PdJobImpl
+ * @spoolfd: The spool file descriptor
+ * @output: The spool file stream, which is closed
+ * @error: Return location for error
+ *
+ * Work out the MIME type of the spooled document and make the job
+ * available for processing.
+ *
+ * This must be called while holding the @job's lock.
+ *
+ * Returns: True on success.
+ */
+static gboolean
+pd_job_impl_spool_finish (PdJobImpl *job,
+			  gint spoolfd,
+			  GOutputStream *output,
+			  GError **error)
+{
+	GError *local_error = NULL;
+	GInputStream *input = NULL;
+	gboolean ret = FALSE;
 
-	if (!g_input_stream_close (input, NULL, &error))
-		goto fail;
+	pd_job_impl_mark (job, "spooled");
+	PD_TRACE2 (spool_end, pd_job_get_id (PD_JOB (job)),
+		   pd_job_get_spool_progress (PD_JOB (job)));
 
 	/* If document-format unset, use the printer's document-format
 	 * default */
@@ -1971,30 +2462,34 @@ pd_job_impl_start (PdJob *_job,
 
 		job_debug (PD_JOB (job), "Auto-sensing MIME type");
 		lseek (spoolfd, 0, SEEK_SET);
-		g_object_unref (input);
 		input = g_unix_input_stream_new (spoolfd,
-						 TRUE /* close_fd */);
+						 FALSE /* close_fd */);
 		data_size = g_input_stream_read (input,
 						 data,
 						 sizeof (data),
 						 NULL,
-						 &error);
+						 &local_error);
 		if (data_size == -1)
 			goto fail;
 
-		content_type = g_content_type_guess (name_used,
+		content_type = g_content_type_guess (job->document_filename,
 						     data,
 						     (gsize) data_size,
 						     &type_uncertain);
 
+		g_free (job->document_mimetype);
+		job->document_mimetype = NULL;
 		if (type_uncertain)
 			job_debug (PD_JOB (job), "Content type unknown");
-		else {
+		else
 			job->document_mimetype = g_content_type_get_mime_type (content_type);
-			g_free (content_type);
-		}
+
+		g_free (content_type);
 	}
 
+	if (!g_output_stream_close (output, NULL, &local_error))
+		goto fail;
+
 	if (!job->document_mimetype) {
 		job_debug (PD_JOB (job), "Aborting due to unknown MIME type");
 		goto unsupported_doctype;
@@ -2009,10 +2504,10 @@ pd_job_impl_start (PdJob *_job,
 		pd_job_impl_do_cancel_with_reason (job,
 						   PD_JOB_STATE_ABORTED,
 						   "job-aborted-by-system");
-		g_dbus_method_invocation_return_error (invocation,
-						       PD_ERROR,
-						       PD_ERROR_UNSUPPORTED_DOCUMENT_TYPE,
-						       N_("Unsupported document type"));
+		g_set_error (error,
+			     PD_ERROR,
+			     PD_ERROR_UNSUPPORTED_DOCUMENT_TYPE,
+			     N_("Unsupported document type"));
 		goto out;
 	}
 
@@ -2024,31 +2519,620 @@ pd_job_impl_start (PdJob *_job,
 	   start processing */
 	job_debug (PD_JOB (job), " Set job state to pending");
 	pd_job_set_state (PD_JOB (job), PD_JOB_STATE_PENDING);
+	ret = TRUE;
 
-	/* Return success */
-	g_dbus_method_invocation_return_value (invocation,
-					       g_variant_new ("()"));
+ out:
+	if (input)
+		g_object_unref (input);
+	return ret;
+
+ fail:
+	job_warning (PD_JOB (job), "Error spooling file: %s",
+		     local_error->message);
+	g_clear_error (&local_error);
+	g_set_error (error,
+		     PD_ERROR,
+		     PD_ERROR_FAILED,
+		     "Error spooling file");
+	goto out;
+}
+
+/**
+ * pd_job_impl_do_spool:
+ * @job: A #PdJobImpl
+ * @spoolfd: (out): The spool file descriptor
+ * @output: (out): The spool file stream, still open
+ * @error: Return location for error
+ *
+ * Copy the document to the spool file. This blocks while the
+ * document is copied, so it is only for use outside the main
+ * thread. Finish with pd_job_impl_spool_finish() in the main thread.
+ *
+ * This must be called while holding the @job's lock. The lock is
+ * released while the document is copied so that the job can still
+ * be examined and canceled meanwhile.
+ *
+ * Returns: True on success.
+ */
+static gboolean
+pd_job_impl_do_spool (PdJobImpl *job,
+		      gint *spoolfd,
+		      GOutputStream **output,
+		      GError **error)
+{
+	gboolean ret = FALSE;
+	GError *local_error = NULL;
+	GCancellable *cancellable = NULL;
+	GInputStream *input = NULL;
+	gssize spooled;
+
+	*output = NULL;
+	if (!pd_job_impl_spool_prepare (job,
+					spoolfd,
+					&input,
+					output,
+					error))
+		goto out;
+
+	/* Cancel will stop the copy, as it does for Start */
+	cancellable = g_cancellable_new ();
+	job->spool_cancellable = g_object_ref (cancellable);
+
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
+	spooled = g_output_stream_splice (*output,
+					  input,
+					  G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE,
+					  cancellable,
+					  &local_error);
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
+
+	g_clear_object (&job->spool_cancellable);
+	if (g_cancellable_is_cancelled (cancellable)) {
+		/* The job was canceled while we were spooling */
+		job_debug (PD_JOB (job), "Spooling stopped");
+		g_clear_error (&local_error);
+		g_set_error (error,
+			     PD_ERROR,
+			     PD_ERROR_FAILED,
+			     N_("Job canceled"));
+		goto out;
+	}
+
+	if (spooled == -1) {
+		job_warning (PD_JOB (job), "Error spooling file: %s",
+			     local_error->message);
+		g_clear_error (&local_error);
+		g_set_error (error,
+			     PD_ERROR,
+			     PD_ERROR_FAILED,
+			     "Error spooling file");
+		goto out;
+	}
+
+	pd_job_set_spool_progress (PD_JOB (job), spooled);
+	ret = TRUE;
 
  out:
-	g_mutex_unlock (&job->lock);
+	if (cancellable)
+		g_object_unref (cancellable);
+	if (input)
+		g_object_unref (input);
+	if (!ret)
+		g_clear_object (output);
+	return ret;
+}
+
+/* A SubmitJob call whose document has been spooled */
+typedef struct
+{
+	PdJobImpl *job;
+	GDBusMethodInvocation *invocation;
+	GVariant *reply;
+	GOutputStream *output;
+	gint spoolfd;
+	GError *error;
+} PdJobImplSubmit;
+
+/* runs in main thread */
+static gboolean
+pd_job_impl_submit_finish (gpointer user_data)
+{
+	PdJobImplSubmit *submit = user_data;
+	PdJobImpl *job = submit->job;
+	const gchar *watchdog;
+
+	watchdog = pd_watchdog_enter ("[printerd] job submit");
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
+	g_object_freeze_notify (G_OBJECT (job));
+
+	/* Queue the job here rather than in the method's thread, so
+	 * that the engine sees it become pending in the main thread
+	 * as it does for Start */
+	if (submit->error == NULL)
+		pd_job_impl_spool_finish (job,
+					  submit->spoolfd,
+					  submit->output,
+					  &submit->error);
+
+	if (submit->error) {
+		job_debug (PD_JOB (job), "Submitting failed: %s",
+			   submit->error->message);
+		pd_job_impl_do_cancel_with_reason (job,
+						   PD_JOB_STATE_ABORTED,
+						   "job-aborted-by-system");
+		g_dbus_method_invocation_return_gerror (submit->invocation,
+							submit->error);
+	} else
+		g_dbus_method_invocation_return_value (submit->invocation,
+						       submit->reply);
+
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
+	g_object_thaw_notify (G_OBJECT (job));
+
+	g_object_unref (submit->job);
+	g_object_unref (submit->invocation);
+	g_variant_unref (submit->reply);
+	if (submit->output)
+		g_object_unref (submit->output);
+	g_clear_error (&submit->error);
+	g_free (submit);
+	pd_watchdog_leave (watchdog);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * pd_job_impl_submit:
+ * @job: A #PdJobImpl
+ * @invocation: The SubmitJob method invocation
+ * @options: Options, possibly including "document-format"
+ * @fd_list: The #GUnixFDList for the method invocation
+ * @file_descriptor: Handle of the document in @fd_list
+ * @reply: The value to return from @invocation on success
+ *
+ * Add the document to a newly-created job and make the job available
+ * for processing, as AddDocument followed by Start would, then
+ * complete @invocation. On failure the job is aborted.
+ *
+ * The document is copied in the calling thread, which must not be
+ * the main thread. The job is queued and @invocation completed in
+ * the main thread.
+ */
+void
+pd_job_impl_submit (PdJobImpl *job,
+		    GDBusMethodInvocation *invocation,
+		    GVariant *options,
+		    GUnixFDList *fd_list,
+		    GVariant *file_descriptor,
+		    GVariant *reply)
+{
+	PdJobImplSubmit *submit;
+
+	g_return_if_fail (PD_IS_JOB_IMPL (job));
+
+	submit = g_new0 (PdJobImplSubmit, 1);
+	submit->job = g_object_ref (job);
+	submit->invocation = g_object_ref (invocation);
+	submit->reply = g_variant_ref_sink (reply);
+	submit->spoolfd = -1;
+
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
+	if (pd_job_impl_do_add_document (job,
+					 options,
+					 fd_list,
+					 file_descriptor,
+					 &submit->error))
+		pd_job_impl_do_spool (job,
+				      &submit->spoolfd,
+				      &submit->output,
+				      &submit->error);
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
+
+	g_main_context_invoke (NULL, pd_job_impl_submit_finish, submit);
+}
+
+/* ------------------------------------------------------------------ */
+
+/* Handlers for methods that run in the main thread must not block
+ * it, as that would stall every job's data relay. Authorization and
+ * the caller's identity are looked up asynchronously, and the method
+ * is completed once both are known. */
+
+typedef struct _PdJobImplCall PdJobImplCall;
+
+/* Called with the job lock held once the caller has been found to be
+ * authorized and to own the job */
+typedef void (*PdJobImplCompleteFunc) (PdJobImpl *job,
+				       PdJobImplCall *call);
+
+struct _PdJobImplCall
+{
+	PdJobImpl *job;
+	GDBusMethodInvocation *invocation;
+	const gchar *method;
+	PdJobImplCompleteFunc complete;
+	GVariant *options;
+	GUnixFDList *fd_list;
+	GVariant *file_descriptor;
+};
+
+static void
+pd_job_impl_call_free (PdJobImplCall *call)
+{
+	g_object_unref (call->job);
+	g_object_unref (call->invocation);
+	if (call->options)
+		g_variant_unref (call->options);
+	if (call->fd_list)
+		g_object_unref (call->fd_list);
+	if (call->file_descriptor)
+		g_variant_unref (call->file_descriptor);
+	g_free (call);
+}
+
+/* runs in main thread */
+static void
+pd_job_impl_call_got_user_cb (GObject *source_object,
+			      GAsyncResult *res,
+			      gpointer user_data)
+{
+	PdJobImplCall *call = user_data;
+	PdJobImpl *job = call->job;
+	GVariant *attr_user;
+	gchar *requesting_user;
+	const gchar *originating_user = NULL;
+
+	requesting_user = pd_daemon_get_unix_user_finish (PD_DAEMON (source_object),
+							  res);
+
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
+	g_object_freeze_notify (G_OBJECT (job));
+
+	/* Check if this user owns the job */
+	attr_user = pd_job_impl_get_attribute (job,
+					       "job-originating-user-name");
+	if (attr_user)
+		originating_user = g_variant_get_string (attr_user, NULL);
+	if (g_strcmp0 (originating_user, requesting_user)) {
+		job_debug (PD_JOB (job), "%s: denied "
+			   "[originating user: %s; requesting user: %s]",
+			   call->method, originating_user, requesting_user);
+		g_dbus_method_invocation_return_error (call->invocation,
+						       PD_ERROR,
+						       PD_ERROR_FAILED,
+						       N_("Not job owner"));
+	} else
+		(*call->complete) (job, call);
+
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
 	g_object_thaw_notify (G_OBJECT (job));
 
 	g_free (requesting_user);
-	if (input)
-		g_object_unref (input);
-	if (output)
-		g_object_unref (output);
-	g_free (name_used);
+	pd_job_impl_call_free (call);
+}
+
+/* runs in main thread */
+static void
+pd_job_impl_call_authorized_cb (GObject *source_object,
+				GAsyncResult *res,
+				gpointer user_data)
+{
+	PdJobImplCall *call = user_data;
+	GError *error = NULL;
+
+	if (!pd_daemon_check_authorization_finish (PD_DAEMON (source_object),
+						   res,
+						   &error)) {
+		g_dbus_method_invocation_return_gerror (call->invocation,
+							error);
+		g_error_free (error);
+		pd_job_impl_call_free (call);
+		return;
+	}
+
+	pd_daemon_get_unix_user_async (call->job->daemon,
+				       call->invocation,
+				       pd_job_impl_call_got_user_cb,
+				       call);
+}
+
+/* runs in main thread */
+static PdJobImplCall *
+pd_job_impl_call_new (PdJobImpl *job,
+		      GDBusMethodInvocation *invocation,
+		      const gchar *method,
+		      PdJobImplCompleteFunc complete,
+		      GVariant *options)
+{
+	PdJobImplCall *call = g_new0 (PdJobImplCall, 1);
+
+	call->job = g_object_ref (job);
+	call->invocation = g_object_ref (invocation);
+	call->method = method;
+	call->complete = complete;
+	call->options = g_variant_ref (options);
+	return call;
+}
+
+/* Called with the job lock held */
+static void
+pd_job_impl_complete_add_document (PdJobImpl *job,
+				   PdJobImplCall *call)
+{
+	GError *error = NULL;
+
+	if (!pd_job_impl_do_add_document (job,
+					  call->options,
+					  call->fd_list,
+					  call->file_descriptor,
+					  &error)) {
+		g_dbus_method_invocation_return_gerror (call->invocation,
+							error);
+		g_error_free (error);
+		return;
+	}
+
+	g_dbus_method_invocation_return_value (call->invocation, NULL);
+}
+
+/* runs in main thread */
+static gboolean
+pd_job_impl_add_document (PdJob *_job,
+			  GDBusMethodInvocation *invocation,
+			  GUnixFDList *fd_list,
+			  GVariant *options,
+			  GVariant *file_descriptor)
+{
+	PdJobImpl *job = PD_JOB_IMPL (_job);
+	PdJobImplCall *call;
+
+	call = pd_job_impl_call_new (job,
+				     invocation,
+				     "AddDocument",
+				     pd_job_impl_complete_add_document,
+				     options);
+	if (fd_list)
+		call->fd_list = g_object_ref (fd_list);
+	call->file_descriptor = g_variant_ref (file_descriptor);
+
+	/* Check if the user is authorized to add a document */
+	pd_daemon_check_authorization (job->daemon,
+				       options,
+				       N_("Authentication is required to add a job"),
+				       invocation,
+				       pd_job_impl_call_authorized_cb,
+				       call,
+				       "org.freedesktop.printerd.job-add",
+				       NULL);
 	return TRUE; /* handled the method invocation */
+}
 
-fail:
-	/* error */
-	g_dbus_method_invocation_return_error (invocation,
-					       PD_ERROR,
-					       PD_ERROR_FAILED,
-					       "Error spooling file");
-	goto out;
+/* Spooling for Start is done asynchronously, a chunk at a time, so
+ * that a large or slow document does not hold up other jobs */
+
+#define PD_JOB_IMPL_SPOOL_CHUNK			65536
+#define PD_JOB_IMPL_SPOOL_PROGRESS_INTERVAL	(G_USEC_PER_SEC / 4)
+
+typedef struct
+{
+	PdJobImpl *job;
+	GDBusMethodInvocation *invocation;
+	GCancellable *cancellable;
+	GInputStream *input;
+	GOutputStream *output;
+	gint spoolfd;
+	gchar *buffer;
+	gsize buflen;
+	gsize bufsent;
+	guint64 spooled;
+	gint64 progress_time;
+} PdJobImplSpool;
+
+static void pd_job_impl_spool_read (PdJobImplSpool *spool);
+
+static void
+pd_job_impl_spool_free (PdJobImplSpool *spool)
+{
+	g_object_unref (spool->job);
+	g_object_unref (spool->invocation);
+	g_object_unref (spool->cancellable);
+	g_object_unref (spool->input);
+	g_object_unref (spool->output);
+	g_free (spool->buffer);
+	g_free (spool);
+}
+
+/* runs in main thread */
+static void
+pd_job_impl_spool_done (PdJobImplSpool *spool,
+			GError *error)
+{
+	PdJobImpl *job = spool->job;
+	GError *local_error = NULL;
+	const gchar *watchdog;
+
+	watchdog = pd_watchdog_enter ("[printerd] job spool");
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
+	g_object_freeze_notify (G_OBJECT (job));
+
+	g_clear_object (&job->spool_cancellable);
+	pd_job_set_spool_progress (PD_JOB (job), spool->spooled);
+	job_debug (PD_JOB (job), "Spooled %" G_GUINT64_FORMAT " bytes",
+		   spool->spooled);
+
+	if (g_cancellable_is_cancelled (spool->cancellable)) {
+		/* The job was canceled while we were spooling */
+		job_debug (PD_JOB (job), "Spooling stopped");
+		g_dbus_method_invocation_return_error (spool->invocation,
+						       PD_ERROR,
+						       PD_ERROR_FAILED,
+						       N_("Job canceled"));
+	} else if (error) {
+		job_warning (PD_JOB (job), "Error spooling file: %s",
+			     error->message);
+		g_dbus_method_invocation_return_error (spool->invocation,
+						       PD_ERROR,
+						       PD_ERROR_FAILED,
+						       "Error spooling file");
+	} else if (!pd_job_impl_spool_finish (job,
+					      spool->spoolfd,
+					      spool->output,
+					      &local_error)) {
+		g_dbus_method_invocation_return_gerror (spool->invocation,
+							local_error);
+		g_error_free (local_error);
+	} else
+		/* Return success */
+		g_dbus_method_invocation_return_value (spool->invocation,
+						       g_variant_new ("()"));
+
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
+	g_object_thaw_notify (G_OBJECT (job));
+	pd_job_impl_spool_free (spool);
+	pd_watchdog_leave (watchdog);
+}
 
+/* runs in main thread */
+static void
+pd_job_impl_spool_write_cb (GObject *source_object,
+			    GAsyncResult *res,
+			    gpointer user_data)
+{
+	PdJobImplSpool *spool = user_data;
+	GError *error = NULL;
+	gssize written;
+	gint64 now;
+
+	written = g_output_stream_write_finish (G_OUTPUT_STREAM (source_object),
+						res,
+						&error);
+	if (written < 0) {
+		pd_job_impl_spool_done (spool, error);
+		g_error_free (error);
+		return;
+	}
+
+	spool->bufsent += written;
+	spool->spooled += written;
+
+	/* Don't flood the bus with property changes */
+	now = g_get_monotonic_time ();
+	if (now - spool->progress_time >= PD_JOB_IMPL_SPOOL_PROGRESS_INTERVAL) {
+		spool->progress_time = now;
+		pd_job_set_spool_progress (PD_JOB (spool->job),
+					   spool->spooled);
+	}
+
+	if (spool->bufsent < spool->buflen)
+		g_output_stream_write_async (spool->output,
+					     spool->buffer + spool->bufsent,
+					     spool->buflen - spool->bufsent,
+					     G_PRIORITY_DEFAULT,
+					     spool->cancellable,
+					     pd_job_impl_spool_write_cb,
+					     spool);
+	else
+		pd_job_impl_spool_read (spool);
+}
+
+/* runs in main thread */
+static void
+pd_job_impl_spool_read_cb (GObject *source_object,
+			   GAsyncResult *res,
+			   gpointer user_data)
+{
+	PdJobImplSpool *spool = user_data;
+	GError *error = NULL;
+	gssize got;
+
+	got = g_input_stream_read_finish (G_INPUT_STREAM (source_object),
+					  res,
+					  &error);
+	if (got <= 0) {
+		/* Error or end of file */
+		pd_job_impl_spool_done (spool, error);
+		if (error)
+			g_error_free (error);
+		return;
+	}
+
+	spool->buflen = got;
+	spool->bufsent = 0;
+	g_output_stream_write_async (spool->output,
+				     spool->buffer,
+				     spool->buflen,
+				     G_PRIORITY_DEFAULT,
+				     spool->cancellable,
+				     pd_job_impl_spool_write_cb,
+				     spool);
+}
+
+static void
+pd_job_impl_spool_read (PdJobImplSpool *spool)
+{
+	g_input_stream_read_async (spool->input,
+				   spool->buffer,
+				   PD_JOB_IMPL_SPOOL_CHUNK,
+				   G_PRIORITY_DEFAULT,
+				   spool->cancellable,
+				   pd_job_impl_spool_read_cb,
+				   spool);
+}
+
+/* Called with the job lock held */
+static void
+pd_job_impl_complete_start (PdJobImpl *job,
+			    PdJobImplCall *call)
+{
+	GError *error = NULL;
+	PdJobImplSpool *spool;
+
+	spool = g_new0 (PdJobImplSpool, 1);
+	if (!pd_job_impl_spool_prepare (job,
+					&spool->spoolfd,
+					&spool->input,
+					&spool->output,
+					&error)) {
+		g_dbus_method_invocation_return_gerror (call->invocation,
+							error);
+		g_error_free (error);
+		g_free (spool);
+		return;
+	}
+
+	/* The invocation is completed once the document is spooled */
+	spool->job = g_object_ref (job);
+	spool->invocation = g_object_ref (call->invocation);
+	spool->cancellable = g_cancellable_new ();
+	spool->buffer = g_malloc (PD_JOB_IMPL_SPOOL_CHUNK);
+	job->spool_cancellable = g_object_ref (spool->cancellable);
+	pd_job_impl_spool_read (spool);
+}
+
+/* runs in main thread */
+static gboolean
+pd_job_impl_start (PdJob *_job,
+		   GDBusMethodInvocation *invocation,
+		   GVariant *options)
+{
+	PdJobImpl *job = PD_JOB_IMPL (_job);
+	PdJobImplCall *call;
+
+	call = pd_job_impl_call_new (job,
+				     invocation,
+				     "Start",
+				     pd_job_impl_complete_start,
+				     options);
+
+	/* Check if the user is authorized to start a job */
+	pd_daemon_check_authorization (job->daemon,
+				       options,
+				       N_("Authentication is required to add a job"),
+				       invocation,
+				       pd_job_impl_call_authorized_cb,
+				       call,
+				       "org.freedesktop.printerd.job-add",
+				       NULL);
+	return TRUE; /* handled the method invocation */
 }
 
 /* Cancel or abort job */
@@ -2062,6 +3146,10 @@ pd_job_impl_do_cancel_with_reason (PdJobImpl *job,
 
 	pd_job_impl_add_state_reason (PD_JOB_IMPL (job), reason);
 
+	/* Stop spooling the document if Start is still doing that */
+	if (job->spool_cancellable)
+		g_cancellable_cancel (job->spool_cancellable);
+
         /* RFC 2911, 3.3.3: only these jobs in these states can be
 	   canceled */
 	switch (pd_job_get_state (_job)) {
@@ -2124,7 +3212,7 @@ pd_job_impl_do_cancel_with_reason (PdJobImpl *job,
 			job_debug (PD_JOB (job),
 				   "Sending KILL signal to %s (PID %d)",
 				   jp->what, jp->pid);
-			kill (jp->pid, SIGKILL);
+			pd_spawn_helper_kill (jp->pid, SIGKILL);
 			g_spawn_close_pid (jp->pid);
 		}
 
@@ -2133,7 +3221,7 @@ pd_job_impl_do_cancel_with_reason (PdJobImpl *job,
 			job_debug (PD_JOB (job),
 				   "Sending KILL signal to backend (PID %d)",
 				   job->backend->pid);
-			kill (job->backend->pid, SIGKILL);
+			pd_spawn_helper_kill (job->backend->pid, SIGKILL);
 			g_spawn_close_pid (job->backend->pid);
 		}
 
@@ -2145,50 +3233,13 @@ pd_job_impl_do_cancel_with_reason (PdJobImpl *job,
 	}
 }
 
-/* runs in main thread */
-static gboolean
-pd_job_impl_cancel (PdJob *_job,
-		    GDBusMethodInvocation *invocation,
-		    GVariant *options)
+/* Called with the job lock held */
+static void
+pd_job_impl_complete_cancel (PdJobImpl *job,
+			     PdJobImplCall *call)
 {
-	PdJobImpl *job = PD_JOB_IMPL (_job);
-	GVariant *attr_user;
-	gchar *requesting_user = NULL;
-	const gchar *originating_user = NULL;
-
-	/* Check if the user is authorized to cancel this job */
-	if (!pd_daemon_check_authorization_sync (job->daemon,
-						 options,
-						 N_("Authentication is required to cancel a job"),
-						 invocation,
-						 "org.freedesktop.printerd.job-cancel",
-						 NULL))
-		return TRUE;
-
-	/* Get the requesting user before holding the lock as it uses
-	 * sync D-Bus calls */
-	requesting_user = pd_get_unix_user (invocation);
-
-	g_mutex_lock (&job->lock);
-	g_object_freeze_notify (G_OBJECT (job));
-
-	/* Check if this user owns the job */
-	attr_user = get_attribute_value (PD_JOB (job),
-					 "job-originating-user-name");
-	if (attr_user) {
-		originating_user = g_variant_get_string (attr_user, NULL);
-		g_variant_unref (attr_user);
-	}
-	if (g_strcmp0 (originating_user, requesting_user)) {
-		job_debug (PD_JOB (job), "AddDocument: denied "
-			   "[originating user: %s; requesting user: %s]",
-			   originating_user, requesting_user);
-		g_dbus_method_invocation_return_error (invocation,
-						       PD_ERROR,
-						       PD_ERROR_FAILED,
-						       N_("Not job owner"));
-		goto out;
-	}
+	PdJob *_job = PD_JOB (job);
+	GDBusMethodInvocation *invocation = call->invocation;
 
 	switch (pd_job_get_state (_job)) {
 	case PD_JOB_STATE_PENDING:
@@ -2233,18 +3284,68 @@ pd_job_impl_cancel (PdJob *_job,
 		break;
 		;
 	}
+}
 
- out:
-	g_mutex_unlock (&job->lock);
-	g_object_thaw_notify (G_OBJECT (job));
-	g_free (requesting_user);
+/* runs in main thread */
+static gboolean
+pd_job_impl_cancel (PdJob *_job,
+		    GDBusMethodInvocation *invocation,
+		    GVariant *options)
+{
+	PdJobImpl *job = PD_JOB_IMPL (_job);
+	PdJobImplCall *call;
+
+	call = pd_job_impl_call_new (job,
+				     invocation,
+				     "Cancel",
+				     pd_job_impl_complete_cancel,
+				     options);
+
+	/* Check if the user is authorized to cancel this job */
+	pd_daemon_check_authorization (job->daemon,
+				       options,
+				       N_("Authentication is required to cancel a job"),
+				       invocation,
+				       pd_job_impl_call_authorized_cb,
+				       call,
+				       "org.freedesktop.printerd.job-cancel",
+				       NULL);
 	return TRUE; /* handled the method invocation */
 }
 
 
+/* Used by pd_job_get_attributes(), as the skeleton does not hold
+ * the value */
+static GVariant *
+pd_job_impl_get_attributes (PdJob *_job)
+{
+	PdJobImpl *job = PD_JOB_IMPL (_job);
+	GVariant *ret;
+
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
+	ret = pd_job_impl_peek_attributes (job);
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
+	return ret;
+}
+
+/* Used by pd_job_get_timeline() */
+static GVariant *
+pd_job_impl_get_timeline (PdJob *_job)
+{
+	PdJobImpl *job = PD_JOB_IMPL (_job);
+	GVariant *ret;
+
+	pd_mutex_lock (&job->lock, PD_LOCK_JOB);
+	ret = pd_job_impl_peek_timeline (job);
+	pd_mutex_unlock (&job->lock, PD_LOCK_JOB);
+	return ret;
+}
+
 static void
 pd_job_iface_init (PdJobIface *iface)
 {
+	iface->get_attributes = pd_job_impl_get_attributes;
+	iface->get_timeline = pd_job_impl_get_timeline;
 	iface->handle_add_document = pd_job_impl_add_document;
 	iface->handle_start = pd_job_impl_start;
 	iface->handle_cancel = pd_job_impl_cancel;
@@ -21,6 +21,8 @@
 #ifndef __PD_JOB_IMPL_H__
 #define __PD_JOB_IMPL_H__
 
+#include <gio/gunixfdlist.h>
+
 #include "pd-daemontypes.h"
 
 G_BEGIN_DECLS
@@ -31,10 +33,21 @@ G_BEGIN_DECLS
 
 GType		 pd_job_impl_get_type		(void) G_GNUC_CONST;
 PdDaemon	*pd_job_impl_get_daemon		(PdJobImpl *job);
+GVariant	*pd_job_impl_get_attribute	(PdJobImpl *job,
+						 const gchar *name);
 void		 pd_job_impl_set_attribute	(PdJobImpl *job,
 						 const gchar *name,
 						 GVariant *value);
 void		 pd_job_impl_start_sending	(PdJobImpl *job);
+gint		 pd_job_impl_file_output	(void);
+void		 pd_job_impl_parse_stderr	(PdJobImpl *job,
+						 const gchar *line);
+void		 pd_job_impl_submit		(PdJobImpl *job,
+						 GDBusMethodInvocation *invocation,
+						 GVariant *options,
+						 GUnixFDList *fd_list,
+						 GVariant *file_descriptor,
+						 GVariant *reply);
 
 G_END_DECLS
 
@@ -0,0 +1,375 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "pd-lock.h"
+#include "pd-log.h"
+
+#ifdef PD_LOCK_STATS
+
+/* Same bucketing as the daemon metrics: bucket i counts durations
+ * below 2^i microseconds */
+#define PD_LOCK_N_BUCKETS	33
+
+/* Deepest nesting of instrumented locks in any one thread */
+#define PD_LOCK_MAX_HELD	8
+
+typedef struct
+{
+	guint64		 count;
+	guint64		 sum;
+	guint64		 max;
+	guint64		 buckets[PD_LOCK_N_BUCKETS];
+} PdLockHistogram;
+
+typedef struct
+{
+	guint64		 acquisitions;
+	guint64		 contended;
+	PdLockHistogram	 wait;
+	PdLockHistogram	 hold;
+} PdLockStats;
+
+/*
+ * As with the metrics, each thread records into its own shard so
+ * that measuring a lock does not add contention of its own. The
+ * shard also remembers which locks the thread holds and since when.
+ */
+typedef struct
+{
+	GMutex		 lock;
+	PdLockStats	 stats[PD_LOCK_N_CLASSES];
+	struct {
+		GMutex	*mutex;
+		gint64	 acquired;
+	}		 held[PD_LOCK_MAX_HELD];
+	guint		 n_held;
+} PdLockShard;
+
+static const gchar *class_names[PD_LOCK_N_CLASSES] = {
+	"engine",
+	"printer",
+	"job",
+	"auth",
+	"identity",
+};
+
+static void pd_lock_shard_retire (gpointer data);
+
+static GPrivate current_shard = G_PRIVATE_INIT (pd_lock_shard_retire);
+static GMutex shards_lock;
+static GSList *shards;		/* of PdLockShard* */
+static PdLockStats retired[PD_LOCK_N_CLASSES];
+
+static void
+pd_lock_histogram_observe (PdLockHistogram *histogram,
+			   gint64 usec)
+{
+	guint bucket = usec > 0 ? g_bit_storage ((gulong) usec) : 0;
+
+	histogram->count++;
+	histogram->sum += usec;
+	histogram->max = MAX (histogram->max, (guint64) usec);
+	histogram->buckets[MIN (bucket, PD_LOCK_N_BUCKETS - 1)]++;
+}
+
+static void
+pd_lock_histogram_merge (PdLockHistogram *dest,
+			 const PdLockHistogram *src)
+{
+	gint i;
+
+	dest->count += src->count;
+	dest->sum += src->sum;
+	dest->max = MAX (dest->max, src->max);
+	for (i = 0; i < PD_LOCK_N_BUCKETS; i++)
+		dest->buckets[i] += src->buckets[i];
+}
+
+static void
+pd_lock_stats_merge (PdLockStats *dest,
+		     const PdLockStats *src)
+{
+	gint i;
+
+	for (i = 0; i < PD_LOCK_N_CLASSES; i++) {
+		dest[i].acquisitions += src[i].acquisitions;
+		dest[i].contended += src[i].contended;
+		pd_lock_histogram_merge (&dest[i].wait, &src[i].wait);
+		pd_lock_histogram_merge (&dest[i].hold, &src[i].hold);
+	}
+}
+
+static void
+pd_lock_shard_retire (gpointer data)
+{
+	PdLockShard *shard = data;
+
+	g_mutex_lock (&shards_lock);
+	shards = g_slist_remove (shards, shard);
+	pd_lock_stats_merge (retired, shard->stats);
+	g_mutex_unlock (&shards_lock);
+
+	g_mutex_clear (&shard->lock);
+	g_free (shard);
+}
+
+static PdLockShard *
+pd_lock_shard_get (void)
+{
+	PdLockShard *shard = g_private_get (&current_shard);
+
+	if (G_LIKELY (shard))
+		return shard;
+
+	shard = g_new0 (PdLockShard, 1);
+	g_mutex_init (&shard->lock);
+	g_private_set (&current_shard, shard);
+
+	g_mutex_lock (&shards_lock);
+	shards = g_slist_prepend (shards, shard);
+	g_mutex_unlock (&shards_lock);
+	return shard;
+}
+
+/* Sum of all shards, live and retired. Caller frees. */
+static PdLockStats *
+pd_lock_stats_collect (void)
+{
+	PdLockStats *total = g_new0 (PdLockStats, PD_LOCK_N_CLASSES);
+	GSList *each;
+
+	g_mutex_lock (&shards_lock);
+	pd_lock_stats_merge (total, retired);
+	for (each = shards; each; each = g_slist_next (each)) {
+		PdLockShard *shard = each->data;
+		g_mutex_lock (&shard->lock);
+		pd_lock_stats_merge (total, shard->stats);
+		g_mutex_unlock (&shard->lock);
+	}
+	g_mutex_unlock (&shards_lock);
+	return total;
+}
+
+/**
+ * pd_lock_stats_lock:
+ * @mutex: A #GMutex.
+ * @klass: The class @mutex belongs to.
+ *
+ * Locks @mutex, recording whether it had to be waited for and for
+ * how long. Use pd_mutex_lock() rather than calling this directly.
+ */
+void
+pd_lock_stats_lock (GMutex *mutex,
+		    PdLockClass klass)
+{
+	PdLockShard *shard = pd_lock_shard_get ();
+	PdLockStats *stats = &shard->stats[klass];
+	gboolean contended = FALSE;
+	gint64 start = 0;
+	gint64 acquired;
+
+	if (!g_mutex_trylock (mutex)) {
+		contended = TRUE;
+		start = g_get_monotonic_time ();
+		g_mutex_lock (mutex);
+	}
+
+	acquired = g_get_monotonic_time ();
+
+	g_mutex_lock (&shard->lock);
+	stats->acquisitions++;
+	if (contended) {
+		stats->contended++;
+		pd_lock_histogram_observe (&stats->wait, acquired - start);
+	} else
+		pd_lock_histogram_observe (&stats->wait, 0);
+	g_mutex_unlock (&shard->lock);
+
+	if (shard->n_held < PD_LOCK_MAX_HELD) {
+		shard->held[shard->n_held].mutex = mutex;
+		shard->held[shard->n_held].acquired = acquired;
+	}
+
+	shard->n_held++;
+}
+
+/**
+ * pd_lock_stats_unlock:
+ * @mutex: A #GMutex locked with pd_lock_stats_lock().
+ * @klass: The class @mutex belongs to.
+ *
+ * Unlocks @mutex, recording how long it was held. Use
+ * pd_mutex_unlock() rather than calling this directly.
+ */
+void
+pd_lock_stats_unlock (GMutex *mutex,
+		      PdLockClass klass)
+{
+	PdLockShard *shard = pd_lock_shard_get ();
+	gint64 acquired = 0;
+	guint i;
+
+	/* Usually the innermost lock, but not always */
+	for (i = MIN (shard->n_held, PD_LOCK_MAX_HELD); i > 0; i--) {
+		if (shard->held[i - 1].mutex != mutex)
+			continue;
+
+		acquired = shard->held[i - 1].acquired;
+		for (; i < MIN (shard->n_held, PD_LOCK_MAX_HELD); i++)
+			shard->held[i - 1] = shard->held[i];
+		break;
+	}
+
+	if (shard->n_held > 0)
+		shard->n_held--;
+
+	g_mutex_unlock (mutex);
+
+	if (acquired == 0)
+		return;
+
+	g_mutex_lock (&shard->lock);
+	pd_lock_histogram_observe (&shard->stats[klass].hold,
+				   g_get_monotonic_time () - acquired);
+	g_mutex_unlock (&shard->lock);
+}
+
+static GVariant *
+pd_lock_histogram_to_variant (const PdLockHistogram *histogram)
+{
+	GVariantBuilder builder;
+	GVariantBuilder buckets;
+	gint i;
+
+	g_variant_builder_init (&buckets, G_VARIANT_TYPE ("a(tt)"));
+	for (i = 0; i < PD_LOCK_N_BUCKETS; i++) {
+		guint64 limit = (i == PD_LOCK_N_BUCKETS - 1) ?
+			G_MAXUINT64 : ((guint64) 1) << i;
+
+		if (histogram->buckets[i] == 0)
+			continue;
+
+		g_variant_builder_add (&buckets, "(tt)", limit,
+				       histogram->buckets[i]);
+	}
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (&builder, "{sv}", "count",
+			       g_variant_new_uint64 (histogram->count));
+	g_variant_builder_add (&builder, "{sv}", "sum",
+			       g_variant_new_uint64 (histogram->sum));
+	g_variant_builder_add (&builder, "{sv}", "max",
+			       g_variant_new_uint64 (histogram->max));
+	g_variant_builder_add (&builder, "{sv}", "buckets",
+			       g_variant_builder_end (&buckets));
+	return g_variant_builder_end (&builder);
+}
+
+/**
+ * pd_lock_stats_snapshot:
+ * @builder: An open a{sv} #GVariantBuilder.
+ *
+ * Adds "locks" to @builder: an "a{sa{sv}}" keyed by lock class,
+ * with "acquisitions" and "contended" counts and "wait-time" and
+ * "hold-time" histograms in the same form as the daemon metrics,
+ * plus "max". Nothing is added unless lock statistics were enabled
+ * at build time.
+ */
+void
+pd_lock_stats_snapshot (GVariantBuilder *builder)
+{
+	PdLockStats *total = pd_lock_stats_collect ();
+	GVariantBuilder locks;
+	gint i;
+
+	g_variant_builder_init (&locks, G_VARIANT_TYPE ("a{sa{sv}}"));
+	for (i = 0; i < PD_LOCK_N_CLASSES; i++) {
+		GVariantBuilder stats;
+
+		g_variant_builder_init (&stats, G_VARIANT_TYPE ("a{sv}"));
+		g_variant_builder_add (&stats, "{sv}", "acquisitions",
+				       g_variant_new_uint64 (total[i].acquisitions));
+		g_variant_builder_add (&stats, "{sv}", "contended",
+				       g_variant_new_uint64 (total[i].contended));
+		g_variant_builder_add (&stats, "{sv}", "wait-time",
+				       pd_lock_histogram_to_variant (&total[i].wait));
+		g_variant_builder_add (&stats, "{sv}", "hold-time",
+				       pd_lock_histogram_to_variant (&total[i].hold));
+		g_variant_builder_add (&locks, "{sa{sv}}", class_names[i],
+				       &stats);
+	}
+
+	g_variant_builder_add (builder, "{sv}", "locks",
+			       g_variant_builder_end (&locks));
+	g_free (total);
+}
+
+/**
+ * pd_lock_stats_dump:
+ *
+ * Writes a one-line summary for each lock class to the log.
+ */
+void
+pd_lock_stats_dump (void)
+{
+	PdLockStats *total = pd_lock_stats_collect ();
+	gint i;
+
+	for (i = 0; i < PD_LOCK_N_CLASSES; i++) {
+		PdLockStats *stats = &total[i];
+
+		pd_log (LOG_NOTICE, 0, NULL,
+			"[Locks] %s: acquired=%" G_GUINT64_FORMAT
+			" contended=%" G_GUINT64_FORMAT
+			" wait-total=%" G_GUINT64_FORMAT "us"
+			" wait-max=%" G_GUINT64_FORMAT "us"
+			" hold-total=%" G_GUINT64_FORMAT "us"
+			" hold-max=%" G_GUINT64_FORMAT "us",
+			class_names[i],
+			stats->acquisitions,
+			stats->contended,
+			stats->wait.sum,
+			stats->wait.max,
+			stats->hold.sum,
+			stats->hold.max);
+	}
+
+	g_free (total);
+}
+
+#else /* !PD_LOCK_STATS */
+
+void
+pd_lock_stats_snapshot (GVariantBuilder *builder)
+{
+}
+
+void
+pd_lock_stats_dump (void)
+{
+	pd_log (LOG_NOTICE, 0, NULL,
+		"[Locks] Lock statistics not enabled at build time");
+}
+
+#endif /* PD_LOCK_STATS */
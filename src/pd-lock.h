@@ -0,0 +1,62 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __PD_LOCK_H__
+#define __PD_LOCK_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Each mutex belongs to a class, and statistics are kept per class */
+typedef enum
+{
+	PD_LOCK_ENGINE,
+	PD_LOCK_PRINTER,
+	PD_LOCK_JOB,
+	PD_LOCK_AUTH,
+	PD_LOCK_IDENTITY,
+	PD_LOCK_N_CLASSES
+} PdLockClass;
+
+/*
+ * When configured with --enable-lock-stats, pd_mutex_lock() and
+ * pd_mutex_unlock() record how often each class of lock is taken,
+ * how long callers wait for it and how long it is held. Otherwise
+ * they are plain g_mutex_lock() and g_mutex_unlock().
+ */
+#ifdef PD_LOCK_STATS
+void	 pd_lock_stats_lock	(GMutex *mutex,
+				 PdLockClass klass);
+void	 pd_lock_stats_unlock	(GMutex *mutex,
+				 PdLockClass klass);
+# define pd_mutex_lock(mutex,klass)	pd_lock_stats_lock ((mutex), (klass))
+# define pd_mutex_unlock(mutex,klass)	pd_lock_stats_unlock ((mutex), (klass))
+#else
+# define pd_mutex_lock(mutex,klass)	g_mutex_lock (mutex)
+# define pd_mutex_unlock(mutex,klass)	g_mutex_unlock (mutex)
+#endif /* PD_LOCK_STATS */
+
+void	 pd_lock_stats_snapshot	(GVariantBuilder *builder);
+void	 pd_lock_stats_dump	(void);
+
+G_END_DECLS
+
+#endif /* __PD_LOCK_H__ */
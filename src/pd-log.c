@@ -0,0 +1,454 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <glib.h>
+
+#include "pd-log.h"
+
+/* Number of records that can be waiting to be written. Must be a
+ * power of two. */
+#define PD_LOG_RING_SIZE	4096
+#define PD_LOG_RING_MASK	(PD_LOG_RING_SIZE - 1)
+
+/* Most records written before checking for shutdown */
+#define PD_LOG_BATCH		256
+
+typedef struct
+{
+	/* Slot protocol: the slot is free for the producer claiming
+	 * position P when sequence == P, and holds a record for the
+	 * consumer at position P when sequence == P + 1 */
+	gint		 sequence;
+
+	gint		 priority;
+	const gchar	*file;
+	gint		 line;
+	const gchar	*func;
+	guint		 job_id;
+	gchar		*printer;
+	gchar		*message;
+	gint64		 timestamp;
+} PdLogRecord;
+
+static PdLogRecord ring[PD_LOG_RING_SIZE];
+static gint enqueue_pos;	/* shared by producers */
+static gint dequeue_pos;	/* writer thread only */
+static gint dropped;
+static gint running;
+static GThread *writer;
+static guint reported_dropped;	/* writer thread only */
+
+/* The writer waits on wake_cond when the ring is empty, with
+ * sleeping set so that producers know to wake it */
+static GMutex wake_lock;
+static GCond wake_cond;
+static gint sleeping;
+static gboolean console;
+static gboolean console_is_tty;
+
+/* Messages less severe than this are discarded before any of their
+ * arguments are evaluated */
+gint pd_log_level = LOG_INFO;
+
+/**
+ * pd_log_set_level:
+ * @level: A syslog priority, from LOG_EMERG to LOG_DEBUG.
+ *
+ * Sets the least severe priority that will be logged.
+ */
+void
+pd_log_set_level (gint level)
+{
+	g_atomic_int_set (&pd_log_level, CLAMP (level, LOG_EMERG, LOG_DEBUG));
+}
+
+static void
+pd_log_write_console (GString *out,
+		      PdLogRecord *record)
+{
+	gchar str_time[32];
+	time_t the_time = record->timestamp / G_USEC_PER_SEC;
+	struct tm tm;
+
+	localtime_r (&the_time, &tm);
+	strftime (str_time, sizeof (str_time), "%H:%M:%S", &tm);
+
+	if (!console_is_tty) {
+		g_string_append_printf (out, "%s\n", record->message);
+		return;
+	}
+
+	/* header always in green, then warnings and errors in red
+	 * and debug in blue */
+	g_string_append_printf (out, "%c[%dmTI:%s\t%c[%dm%s\n%c[%dm",
+				0x1B, 32, str_time,
+				0x1B, record->priority <= LOG_WARNING ? 31 : 34,
+				record->message,
+				0x1B, 0);
+}
+
+static void
+pd_log_write_system (PdLogRecord *record)
+{
+#ifdef HAVE_SYSTEMD
+	struct iovec iov[7];
+	gchar *fields[7];
+	gint n = 0;
+	gint i;
+
+	fields[n++] = g_strdup_printf ("MESSAGE=%s", record->message);
+	fields[n++] = g_strdup_printf ("PRIORITY=%i", record->priority);
+	fields[n++] = g_strdup_printf ("CODE_FILE=%s", record->file);
+	fields[n++] = g_strdup_printf ("CODE_LINE=%d", record->line);
+	fields[n++] = g_strdup_printf ("CODE_FUNC=%s", record->func);
+	if (record->job_id)
+		fields[n++] = g_strdup_printf ("PRINTERD_JOB_ID=%u",
+					       record->job_id);
+	if (record->printer)
+		fields[n++] = g_strdup_printf ("PRINTERD_PRINTER=%s",
+					       record->printer);
+
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = fields[i];
+		iov[i].iov_len = strlen (fields[i]);
+	}
+
+	sd_journal_sendv (iov, n);
+
+	for (i = 0; i < n; i++)
+		g_free (fields[i]);
+#else /* !defined(HAVE_SYSTEMD) */
+	syslog (record->priority, "%s", record->message);
+#endif /* defined(HAVE_SYSTEMD) */
+}
+
+static void
+pd_log_write (GString *out,
+	      PdLogRecord *record)
+{
+	pd_log_write_system (record);
+
+	if (console)
+		pd_log_write_console (out, record);
+	else if (record->priority <= LOG_WARNING)
+		g_string_append_printf (out, "printerd: %s\n",
+					record->message);
+}
+
+static void
+pd_log_flush (GString *out)
+{
+	if (out->len == 0)
+		return;
+
+	if (console)
+		fwrite (out->str, 1, out->len, stdout);
+	else
+		fwrite (out->str, 1, out->len, stderr);
+
+	fflush (console ? stdout : stderr);
+	g_string_truncate (out, 0);
+}
+
+/* Only called from the writer thread, or once it has stopped */
+static gboolean
+pd_log_is_empty (void)
+{
+	PdLogRecord *slot = &ring[dequeue_pos & PD_LOG_RING_MASK];
+	gint seq = g_atomic_int_get (&slot->sequence);
+
+	return (gint) ((guint) seq - ((guint) dequeue_pos + 1)) < 0;
+}
+
+/* Only called from the writer thread, or once it has stopped */
+static gboolean
+pd_log_dequeue (PdLogRecord *record)
+{
+	PdLogRecord *slot = &ring[dequeue_pos & PD_LOG_RING_MASK];
+
+	if (pd_log_is_empty ())
+		return FALSE;
+
+	*record = *slot;
+
+	/* Hand the slot back to producers, one lap ahead */
+	g_atomic_int_set (&slot->sequence,
+			  (gint) ((guint) dequeue_pos + PD_LOG_RING_SIZE));
+	dequeue_pos = (gint) ((guint) dequeue_pos + 1);
+	return TRUE;
+}
+
+/* Writes out up to a batch of queued records. Only called from the
+ * writer thread, or once it has stopped. Returns the number
+ * written. */
+static guint
+pd_log_drain (GString *out)
+{
+	PdLogRecord record;
+	guint n = 0;
+	guint now_dropped;
+
+	while (n < PD_LOG_BATCH && pd_log_dequeue (&record)) {
+		pd_log_write (out, &record);
+		g_free (record.printer);
+		g_free (record.message);
+		n++;
+	}
+
+	now_dropped = g_atomic_int_get (&dropped);
+	if (now_dropped != reported_dropped) {
+		memset (&record, 0, sizeof (record));
+		record.priority = LOG_WARNING;
+		record.file = __FILE__;
+		record.line = __LINE__;
+		record.func = G_STRFUNC;
+		record.timestamp = g_get_real_time ();
+		record.message = g_strdup_printf ("[Log] Dropped %u messages",
+						  now_dropped - reported_dropped);
+		pd_log_write (out, &record);
+		g_free (record.message);
+		reported_dropped = now_dropped;
+	}
+
+	pd_log_flush (out);
+	return n;
+}
+
+/* Wakes the writer if it is waiting for records */
+static void
+pd_log_wake (void)
+{
+	if (!g_atomic_int_get (&sleeping))
+		return;
+
+	g_mutex_lock (&wake_lock);
+	g_atomic_int_set (&sleeping, FALSE);
+	g_cond_signal (&wake_cond);
+	g_mutex_unlock (&wake_lock);
+}
+
+static gpointer
+pd_log_writer_thread (gpointer data)
+{
+	GString *out = g_string_new (NULL);
+
+	for (;;) {
+		if (pd_log_drain (out) > 0)
+			continue;
+
+		/* Nothing left; only stop once the ring is drained */
+		if (!g_atomic_int_get (&running))
+			break;
+
+		/* Announce that we are about to wait before looking at
+		 * the ring again: a producer publishing after that
+		 * look will see the flag and wake us */
+		g_mutex_lock (&wake_lock);
+		g_atomic_int_set (&sleeping, TRUE);
+		if (pd_log_is_empty () && g_atomic_int_get (&running))
+			while (g_atomic_int_get (&sleeping))
+				g_cond_wait (&wake_cond, &wake_lock);
+		g_atomic_int_set (&sleeping, FALSE);
+		g_mutex_unlock (&wake_lock);
+	}
+
+	g_string_free (out, TRUE);
+	return NULL;
+}
+
+/**
+ * pd_log_init:
+ * @to_console: Whether to copy all records to standard output.
+ *
+ * Starts the thread that writes log records. Until this is called,
+ * and after pd_log_shutdown(), records are written synchronously.
+ */
+void
+pd_log_init (gboolean to_console)
+{
+	gint i;
+
+	g_return_if_fail (writer == NULL);
+
+	console = to_console;
+	console_is_tty = isatty (fileno (stdout));
+	for (i = 0; i < PD_LOG_RING_SIZE; i++)
+		ring[i].sequence = i;
+
+	g_atomic_int_set (&running, TRUE);
+	writer = g_thread_new ("log writer", pd_log_writer_thread, NULL);
+}
+
+/**
+ * pd_log_shutdown:
+ *
+ * Writes any queued records and stops the writer thread.
+ */
+void
+pd_log_shutdown (void)
+{
+	GString *out;
+
+	if (writer == NULL)
+		return;
+
+	g_atomic_int_set (&running, FALSE);
+	g_mutex_lock (&wake_lock);
+	g_atomic_int_set (&sleeping, FALSE);
+	g_cond_signal (&wake_cond);
+	g_mutex_unlock (&wake_lock);
+	g_thread_join (writer);
+	writer = NULL;
+
+	/* Producers that queued a record just as the writer stopped
+	 * will not have written it themselves */
+	out = g_string_new (NULL);
+	while (pd_log_drain (out) > 0)
+		;
+	g_string_free (out, TRUE);
+}
+
+/**
+ * pd_log_get_dropped:
+ *
+ * Returns: The number of records discarded because the queue was
+ * full.
+ */
+guint
+pd_log_get_dropped (void)
+{
+	return g_atomic_int_get (&dropped);
+}
+
+/* Writes a record from the calling thread, and frees @message */
+static void
+pd_log_write_now (gint priority,
+		  const gchar *file,
+		  gint line,
+		  const gchar *func,
+		  guint job_id,
+		  const gchar *printer,
+		  gchar *message)
+{
+	PdLogRecord record = {
+		0, priority, file, line, func, job_id,
+		(gchar *) printer, message, g_get_real_time ()
+	};
+	GString *out = g_string_new (NULL);
+
+	pd_log_write (out, &record);
+	pd_log_flush (out);
+	g_string_free (out, TRUE);
+	g_free (message);
+}
+
+/**
+ * pd_log_record:
+ * @priority: A syslog priority.
+ * @file: Source file name.
+ * @line: Source line number.
+ * @func: Function name.
+ * @job_id: Job ID, or 0.
+ * @printer: (allow-none): Printer name.
+ * @format: printf()-style format for the message.
+ *
+ * Queues a log record. If the queue is full, warnings and more
+ * severe records are written synchronously; anything less severe is
+ * counted and discarded. Use the printer_log(), job_log()
+ * etc macros rather than calling this directly.
+ */
+void
+pd_log_record (gint priority,
+	       const gchar *file,
+	       gint line,
+	       const gchar *func,
+	       guint job_id,
+	       const gchar *printer,
+	       const gchar *format,
+	       ...)
+{
+	PdLogRecord *slot;
+	gchar *message;
+	va_list ap;
+	gint pos;
+	gint seq;
+	gint diff;
+
+	va_start (ap, format);
+	message = g_strdup_vprintf (format, ap);
+	va_end (ap);
+
+	if (!g_atomic_int_get (&running)) {
+		pd_log_write_now (priority, file, line, func, job_id,
+				  printer, message);
+		return;
+	}
+
+	/* Claim a slot */
+	pos = g_atomic_int_get (&enqueue_pos);
+	for (;;) {
+		slot = &ring[pos & PD_LOG_RING_MASK];
+		seq = g_atomic_int_get (&slot->sequence);
+		diff = (gint) ((guint) seq - (guint) pos);
+		if (diff == 0) {
+			if (g_atomic_int_compare_and_exchange (&enqueue_pos,
+							       pos,
+							       (gint) ((guint) pos + 1)))
+				break;
+		} else if (diff < 0) {
+			/* Full: the writer has not caught up. Warnings
+			 * and worse are still written, just not from
+			 * the writer thread. */
+			if (priority <= LOG_WARNING) {
+				pd_log_write_now (priority, file, line, func,
+						  job_id, printer, message);
+				return;
+			}
+
+			g_atomic_int_inc (&dropped);
+			g_free (message);
+			return;
+		}
+
+		pos = g_atomic_int_get (&enqueue_pos);
+	}
+
+	slot->priority = priority;
+	slot->file = file;
+	slot->line = line;
+	slot->func = func;
+	slot->job_id = job_id;
+	slot->printer = g_strdup (printer);
+	slot->message = message;
+	slot->timestamp = g_get_real_time ();
+
+	/* Publish it to the writer */
+	g_atomic_int_set (&slot->sequence, (gint) ((guint) pos + 1));
+	pd_log_wake ();
+}
@@ -29,124 +29,123 @@
 
 G_BEGIN_DECLS
 
-#ifdef HAVE_SYSTEMD
-# define printer_log(printer,priority,g_,msg,args...)			\
+extern gint pd_log_level;
+void pd_log_set_level (gint level);
+
+/* Whether messages at @priority are being logged. This is checked
+ * before any other work is done for a message. */
+#define pd_log_enabled(priority)				\
+	((priority) <= g_atomic_int_get (&pd_log_level))
+
+/* Records are formatted by the caller and written out in batches by
+ * a separate thread, see pd-log.c */
+void pd_log_init (gboolean to_console);
+void pd_log_shutdown (void);
+guint pd_log_get_dropped (void);
+void pd_log_record (gint priority,
+		    const gchar *file,
+		    gint line,
+		    const gchar *func,
+		    guint job_id,
+		    const gchar *printer,
+		    const gchar *format,
+		    ...) G_GNUC_PRINTF (7, 8);
+
+#define pd_log(priority,job_id,printer,msg,args...)			\
+	pd_log_record (priority, __FILE__, __LINE__, G_STRFUNC,		\
+		       job_id, printer, msg, ##args)
+
+#define printer_log(printer,priority,msg,args...)			\
 do {									\
-	const gchar *_name = pd_printer_get_name (PD_PRINTER (printer)); \
-	sd_journal_send("MESSAGE=[Printer %s] " msg, _name, ##args,	\
-			"PRIORITY=%i", priority,			\
-			"PRINTERD_PRINTER=%s", _name,			\
-			NULL);						\
-	g_("[Printer %s] " msg, _name, ##args);				\
+	if (pd_log_enabled (priority)) {				\
+		const gchar *_name = pd_printer_get_name (PD_PRINTER (printer)); \
+		pd_log (priority, 0, _name, "[Printer %s] " msg, _name, ##args); \
+	}								\
 } while (0)
 
-# define job_log(job,priority,g_,msg,args...)				\
+#ifdef HAVE_SYSTEMD
+/* The journal record includes the printer name */
+# define job_log(job,priority,msg,args...)				\
 do {									\
-	guint _id = pd_job_get_id (PD_JOB (job));			\
-	const gchar *_path = pd_job_get_printer (PD_JOB (job));		\
-	PdDaemon *_daemon = pd_job_impl_get_daemon (PD_JOB_IMPL (job));	\
-	PdObject *_obj = pd_daemon_find_object (_daemon,		\
-						_path);			\
-	PdPrinter *_printer = NULL;					\
-	const gchar *_name = NULL;					\
-	if (_obj) {							\
-		_printer = pd_object_get_printer (_obj);		\
-		_name = pd_printer_get_name (PD_PRINTER (_printer));	\
+	if (pd_log_enabled (priority)) {				\
+		guint _id = pd_job_get_id (PD_JOB (job));		\
+		const gchar *_path = pd_job_get_printer (PD_JOB (job));	\
+		PdDaemon *_daemon = pd_job_impl_get_daemon (PD_JOB_IMPL (job)); \
+		PdObject *_obj = pd_daemon_find_object (_daemon,	\
+							_path);		\
+		PdPrinter *_printer = NULL;				\
+		const gchar *_name = NULL;				\
+		if (_obj) {						\
+			_printer = pd_object_get_printer (_obj);	\
+			_name = pd_printer_get_name (PD_PRINTER (_printer)); \
+		}							\
+		pd_log (priority, _id, _name, "[Job %u] " msg, _id, ##args); \
+		if (_obj)						\
+			g_object_unref (_obj);				\
+		if (_printer)						\
+			g_object_unref (_printer);			\
 	}								\
-	sd_journal_send("MESSAGE=[Job %u] " msg, _id, ##args,		\
-			"PRIORITY=%i", priority,			\
-			"PRINTERD_JOB_ID=%u", _id,			\
-			_name ? "PRINTERD_PRINTER=%s" : NULL, _name,	\
-			NULL);						\
-	if (_obj)							\
-		g_object_unref (_obj);					\
-	if (_printer)							\
-		g_object_unref (_printer);				\
-	g_("[Job %u] " msg, _id, ##args);				\
-} while (0)
-
-# define manager_log(manager,priority,g_,msg,args...)		\
-do {								\
-	sd_journal_send("MESSAGE=[Manager] " msg, ##args,	\
-			"PRIORITY=%i", priority,		\
-			NULL);					\
-	g_("[Manager] " msg, ##args);				\
 } while (0)
-
-# define engine_log(engine,priority,g_,msg,args...)		\
-do {								\
-	sd_journal_send("MESSAGE=[Engine] " msg, ##args,	\
-			"PRIORITY=%i", priority,		\
-			NULL);					\
-	g_("[Engine] " msg, ##args);					\
-} while (0)
-
 #else /* !defined(HAVE_SYSTEMD) */
-
-# define printer_log(printer,priority,g_,msg,args...)			\
+# define job_log(job,priority,msg,args...)				\
 do {									\
-	const gchar *_name = pd_printer_get_name (PD_PRINTER (printer)); \
-	syslog(priority, "[Printer %s] " msg, _name, ##args);		\
-	g_("[Printer %s] " msg, _name, ##args);				\
+	if (pd_log_enabled (priority)) {				\
+		guint _id = pd_job_get_id (PD_JOB (job));		\
+		pd_log (priority, _id, NULL, "[Job %u] " msg, _id, ##args); \
+	}								\
 } while (0)
+#endif /* defined(HAVE_SYSTEMD) */
 
-# define job_log(job,priority,g_,msg,args...)		\
-do {							\
-	guint _id = pd_job_get_id (PD_JOB (job));	\
-	syslog(priority, "[Job %u] " msg, _id, ##args);	\
-	g_("[Job %u] " msg, _id, ##args);		\
+#define manager_log(manager,priority,msg,args...)			\
+do {									\
+	if (pd_log_enabled (priority)) {				\
+		pd_log (priority, 0, NULL, "[Manager] " msg, ##args);	\
+	}								\
 } while (0)
 
-# define manager_log(manager,priority,g_,msg,args...)	\
-do {							\
-	syslog(priority, "[Manager] " msg, ##args);	\
-	g_("[Manager] " msg, ##args);			\
-} while (0);
-
-#define engine_log(engine,priority,g_,msg,args...)	\
-do {							\
-	syslog(priority, "[Engine] " msg, ##args);	\
-	g_("[Engine] " msg, ##args);			\
-} while (0);
-
-#endif /* defined(HAVE_SYSTEMD) */
+#define engine_log(engine,priority,msg,args...)				\
+do {									\
+	if (pd_log_enabled (priority)) {				\
+		pd_log (priority, 0, NULL, "[Engine] " msg, ##args);	\
+	}								\
+} while (0)
 
 #define printer_debug(printer,msg,args...)			\
-	printer_log(printer,LOG_DEBUG,g_debug,msg,##args)
+	printer_log(printer,LOG_DEBUG,msg,##args)
 
 #define printer_warning(printer,msg,args...)			\
-	printer_log(printer,LOG_WARNING,g_warning,msg,##args)
+	printer_log(printer,LOG_WARNING,msg,##args)
 
 #define printer_error(printer,msg,args...)			\
-	printer_log(printer,LOG_ERR,g_warning,msg,##args)
+	printer_log(printer,LOG_ERR,msg,##args)
 
 
 #define job_debug(job,msg,args...)				\
-	job_log(job,LOG_DEBUG,g_debug,msg,##args)
+	job_log(job,LOG_DEBUG,msg,##args)
 
 #define job_warning(job,msg,args...)				\
-	job_log(job,LOG_WARNING,g_warning,msg,##args)
+	job_log(job,LOG_WARNING,msg,##args)
 
 #define job_error(job,msg,args...)				\
-	job_log(job,LOG_ERR,g_warning,msg,##args)
+	job_log(job,LOG_ERR,msg,##args)
 
 #define manager_debug(manager,msg,args...)		\
-	manager_log(manager,LOG_DEBUG,g_debug,msg,##args)
+	manager_log(manager,LOG_DEBUG,msg,##args)
 
 #define manager_warning(manager,msg,args...)		\
-	manager_log(manager,LOG_WARNING,g_warning,msg,##args)
+	manager_log(manager,LOG_WARNING,msg,##args)
 
 #define manager_error(manager,msg,args...)		\
-	manager_log(manager,LOG_ERR,g_warning,msg,##args)
+	manager_log(manager,LOG_ERR,msg,##args)
 
 #define engine_debug(engine,msg,args...)		\
-	engine_log(engine,LOG_DEBUG,g_debug,msg,##args)
+	engine_log(engine,LOG_DEBUG,msg,##args)
 
 #define engine_warning(engine,msg,args...)		\
-	engine_log(engine,LOG_WARNING,g_warning,msg,##args)
+	engine_log(engine,LOG_WARNING,msg,##args)
 
 #define engine_error(engine,msg,args...)		\
-	engine_log(engine,LOG_ERR,g_warning,msg,##args)
+	engine_log(engine,LOG_ERR,msg,##args)
 
 
 G_END_DECLS
@@ -29,7 +29,9 @@
 #include "pd-engine.h"
 #include "pd-device-impl.h"
 #include "pd-printer-impl.h"
+#include "pd-lock.h"
 #include "pd-log.h"
+#include "pd-metrics.h"
 
 /**
  * SECTION:pdmanager
@@ -166,6 +168,7 @@ pd_manager_impl_new (PdDaemon *daemon)
 	return PD_MANAGER (g_object_new (PD_TYPE_MANAGER_IMPL,
 					 "daemon", daemon,
 					 "version", PACKAGE_VERSION,
+					 "log-level", (guint) g_atomic_int_get (&pd_log_level),
 					 NULL));
 }
 
@@ -355,6 +358,103 @@ pd_manager_impl_delete_printer (PdManager *_manager,
 	return TRUE;
 }
 
+/* runs in thread dedicated to handling @invocation */
+static gboolean
+pd_manager_impl_set_log_level (PdManager *_manager,
+			       GDBusMethodInvocation *invocation,
+			       GVariant *options,
+			       guint level)
+{
+	PdManagerImpl *manager = PD_MANAGER_IMPL (_manager);
+
+	/* Check if the user is authorized to change the log level */
+	if (!pd_daemon_check_authorization_sync (manager->daemon,
+						 options,
+						 N_("Authentication is required to change the log level"),
+						 invocation,
+						 "org.freedesktop.printerd.all-edit",
+						 NULL))
+		goto out;
+
+	if (level > LOG_DEBUG) {
+		g_dbus_method_invocation_return_error (invocation,
+						       PD_ERROR,
+						       PD_ERROR_FAILED,
+						       N_("Invalid log level"));
+		goto out;
+	}
+
+	pd_log_set_level (level);
+	pd_manager_set_log_level (_manager, level);
+	g_debug ("[Manager] Log level set to %u", level);
+	g_dbus_method_invocation_return_value (invocation,
+					       g_variant_new ("()"));
+
+ out:
+	return TRUE; /* handled the method invocation */
+}
+
+/* runs in thread dedicated to handling @invocation */
+static gboolean
+pd_manager_impl_get_metrics (PdManager *_manager,
+			     GDBusMethodInvocation *invocation,
+			     GVariant *options)
+{
+	PdManagerImpl *manager = PD_MANAGER_IMPL (_manager);
+	PdEngine *engine = pd_daemon_get_engine (manager->daemon);
+	GList *printer_ids = pd_engine_dup_printer_ids (engine);
+	GList *each;
+	GVariantBuilder builder, queues;
+	GString *path = g_string_new ("");
+	guint64 auth_hits, auth_misses;
+	guint queue_depth = 0;
+
+	manager_debug (_manager, "Handling GetMetrics");
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	pd_metrics_snapshot (&builder);
+
+	/* Queue depth is counted now rather than tracked */
+	g_variant_builder_init (&queues, G_VARIANT_TYPE ("a{su}"));
+	for (each = printer_ids; each; each = g_list_next (each)) {
+		PdPrinter *printer;
+		guint n;
+
+		g_string_printf (path, "/org/freedesktop/printerd/printer/%s",
+				 (const gchar *) each->data);
+		printer = pd_engine_get_printer_by_path (engine, path->str);
+		if (printer == NULL)
+			continue;
+
+		n = pd_printer_impl_get_queue_depth (PD_PRINTER_IMPL (printer));
+		g_variant_builder_add (&queues, "{su}",
+				       (const gchar *) each->data, n);
+		queue_depth += n;
+		g_object_unref (printer);
+	}
+
+	g_variant_builder_add (&builder, "{sv}", "queue-depth",
+			       g_variant_new_uint32 (queue_depth));
+	g_variant_builder_add (&builder, "{sv}", "printer-queue-depth",
+			       g_variant_builder_end (&queues));
+
+	pd_daemon_get_auth_cache_stats (manager->daemon,
+					&auth_hits, &auth_misses);
+	g_variant_builder_add (&builder, "{sv}", "auth-cache-hits",
+			       g_variant_new_uint64 (auth_hits));
+	g_variant_builder_add (&builder, "{sv}", "auth-cache-misses",
+			       g_variant_new_uint64 (auth_misses));
+	g_variant_builder_add (&builder, "{sv}", "log-dropped",
+			       g_variant_new_uint32 (pd_log_get_dropped ()));
+	pd_lock_stats_snapshot (&builder);
+
+	g_dbus_method_invocation_return_value (invocation,
+					       g_variant_new ("(@a{sv})",
+							      g_variant_builder_end (&builder)));
+	g_string_free (path, TRUE);
+	g_list_free_full (printer_ids, g_free);
+	return TRUE; /* handled the method invocation */
+}
+
 static void
 pd_manager_iface_init (PdManagerIface *iface)
 {
@@ -362,4 +462,6 @@ pd_manager_iface_init (PdManagerIface *iface)
 	iface->handle_get_devices = pd_manager_impl_get_devices;
 	iface->handle_create_printer = pd_manager_impl_create_printer;
 	iface->handle_delete_printer = pd_manager_impl_delete_printer;
+	iface->handle_set_log_level = pd_manager_impl_set_log_level;
+	iface->handle_get_metrics = pd_manager_impl_get_metrics;
 }
@@ -0,0 +1,700 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif /* HAVE_MALLINFO2 */
+
+#include "pd-metrics.h"
+
+/* Histogram bucket i counts durations below 2^i microseconds (and
+ * at least 2^(i-1)). The last bucket counts everything longer. */
+#define PD_METRICS_N_BUCKETS	33
+
+/*
+ * Each thread records into its own shard, so recording only ever
+ * takes a lock nobody else wants. Shards are summed when the
+ * metrics are read. When a thread exits its shard is folded into
+ * the retired shard.
+ */
+typedef struct
+{
+	GMutex		 lock;
+	guint64		 counters[PD_METRICS_N_COUNTERS];
+	guint64		 buckets[PD_METRICS_N_HISTOGRAMS][PD_METRICS_N_BUCKETS];
+	guint64		 sum[PD_METRICS_N_HISTOGRAMS];
+	GHashTable	*command_usage;	/* command -> PdMetricsUsage* */
+	GHashTable	*slow_handlers;	/* source name -> PdMetricsSlow* */
+} PdMetricsShard;
+
+/* Main loop iterations that took too long, by source name */
+typedef struct
+{
+	guint64		 count;
+	guint64		 total_usec;
+	guint64		 max_usec;
+} PdMetricsSlow;
+
+/*
+ * Per-printer totals. The printer and its jobs each hold a
+ * reference, so recording needs no lookup by name. The entry
+ * leaves the registry, and so the snapshot, when the printer is
+ * deleted.
+ */
+struct _PdMetricsPrinter
+{
+	gint		 ref_count;
+	gchar		*name;
+	GMutex		 lock;
+	guint64		 counters[PD_METRICS_N_COUNTERS];
+	PdMetricsUsage	 usage;
+};
+
+static const gchar *counter_names[PD_METRICS_N_COUNTERS] = {
+	"jobs-created",
+	"jobs-completed",
+	"jobs-aborted",
+	"jobs-canceled",
+	"bytes-relayed",
+	"relay-wakeups",
+	"main-loop-iterations",
+};
+
+static const gchar *gauge_names[PD_METRICS_N_GAUGES] = {
+	"active-filters",
+};
+
+static const gchar *histogram_names[PD_METRICS_N_HISTOGRAMS] = {
+	"spool-time",
+	"transform-time",
+	"backend-time",
+	"job-latency",
+	"main-loop-lag",
+	"slow-dispatch",
+};
+
+static void pd_metrics_shard_retire (gpointer data);
+
+static GPrivate current_shard = G_PRIVATE_INIT (pd_metrics_shard_retire);
+static GMutex shards_lock;
+static GSList *shards;		/* of PdMetricsShard* */
+static PdMetricsShard *retired;
+static gint gauges[PD_METRICS_N_GAUGES];
+static GMutex printers_lock;
+static GHashTable *printers;	/* name -> PdMetricsPrinter* */
+
+static PdMetricsShard *
+pd_metrics_shard_new (void)
+{
+	PdMetricsShard *shard = g_new0 (PdMetricsShard, 1);
+
+	g_mutex_init (&shard->lock);
+	shard->command_usage = g_hash_table_new_full (g_str_hash,
+						      g_str_equal,
+						      g_free,
+						      g_free);
+	shard->slow_handlers = g_hash_table_new_full (g_str_hash,
+						      g_str_equal,
+						      g_free,
+						      g_free);
+	return shard;
+}
+
+static void
+pd_metrics_shard_free (PdMetricsShard *shard)
+{
+	g_hash_table_unref (shard->command_usage);
+	g_hash_table_unref (shard->slow_handlers);
+	g_mutex_clear (&shard->lock);
+	g_free (shard);
+}
+
+static void
+pd_metrics_usage_add (PdMetricsUsage *dest,
+		      const PdMetricsUsage *src)
+{
+	dest->processes += src->processes;
+	dest->user_usec += src->user_usec;
+	dest->system_usec += src->system_usec;
+	dest->max_rss_kb = MAX (dest->max_rss_kb, src->max_rss_kb);
+	dest->in_blocks += src->in_blocks;
+	dest->out_blocks += src->out_blocks;
+}
+
+static void
+pd_metrics_usage_table_add (GHashTable *table,
+			    const gchar *key,
+			    const PdMetricsUsage *usage)
+{
+	PdMetricsUsage *total = g_hash_table_lookup (table, key);
+
+	if (total == NULL) {
+		total = g_new0 (PdMetricsUsage, 1);
+		g_hash_table_insert (table, g_strdup (key), total);
+	}
+
+	pd_metrics_usage_add (total, usage);
+}
+
+static void
+pd_metrics_usage_table_merge (GHashTable *dest,
+			      GHashTable *src)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init (&iter, src);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		pd_metrics_usage_table_add (dest, key, value);
+}
+
+static void
+pd_metrics_slow_table_add (GHashTable *table,
+			   const gchar *name,
+			   const PdMetricsSlow *slow)
+{
+	PdMetricsSlow *total = g_hash_table_lookup (table, name);
+
+	if (total == NULL) {
+		total = g_new0 (PdMetricsSlow, 1);
+		g_hash_table_insert (table, g_strdup (name), total);
+	}
+
+	total->count += slow->count;
+	total->total_usec += slow->total_usec;
+	total->max_usec = MAX (total->max_usec, slow->max_usec);
+}
+
+/* Add @src into @dest. The caller must hold @src's lock. */
+static void
+pd_metrics_shard_merge (PdMetricsShard *dest,
+			PdMetricsShard *src)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	gint i, j;
+
+	for (i = 0; i < PD_METRICS_N_COUNTERS; i++)
+		dest->counters[i] += src->counters[i];
+
+	for (i = 0; i < PD_METRICS_N_HISTOGRAMS; i++) {
+		for (j = 0; j < PD_METRICS_N_BUCKETS; j++)
+			dest->buckets[i][j] += src->buckets[i][j];
+
+		dest->sum[i] += src->sum[i];
+	}
+
+	pd_metrics_usage_table_merge (dest->command_usage,
+				      src->command_usage);
+
+	g_hash_table_iter_init (&iter, src->slow_handlers);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		pd_metrics_slow_table_add (dest->slow_handlers, key, value);
+}
+
+/* Called by GLib when a thread that recorded metrics exits */
+static void
+pd_metrics_shard_retire (gpointer data)
+{
+	PdMetricsShard *shard = data;
+
+	g_mutex_lock (&shards_lock);
+	shards = g_slist_remove (shards, shard);
+	if (retired == NULL)
+		retired = pd_metrics_shard_new ();
+
+	g_mutex_lock (&shard->lock);
+	pd_metrics_shard_merge (retired, shard);
+	g_mutex_unlock (&shard->lock);
+	g_mutex_unlock (&shards_lock);
+
+	pd_metrics_shard_free (shard);
+}
+
+/* Returns the calling thread's shard, locked */
+static PdMetricsShard *
+pd_metrics_lock_shard (void)
+{
+	PdMetricsShard *shard = g_private_get (&current_shard);
+
+	if (G_UNLIKELY (shard == NULL)) {
+		shard = pd_metrics_shard_new ();
+		g_private_set (&current_shard, shard);
+
+		g_mutex_lock (&shards_lock);
+		shards = g_slist_prepend (shards, shard);
+		g_mutex_unlock (&shards_lock);
+	}
+
+	g_mutex_lock (&shard->lock);
+	return shard;
+}
+
+/**
+ * pd_metrics_printer_new:
+ * @name: Printer name.
+ *
+ * Creates the per-printer metrics for @name, replacing any left
+ * over from an earlier printer of the same name.
+ *
+ * Returns: (transfer full): A #PdMetricsPrinter. Free with
+ * pd_metrics_printer_unref().
+ */
+PdMetricsPrinter *
+pd_metrics_printer_new (const gchar *name)
+{
+	PdMetricsPrinter *printer = g_new0 (PdMetricsPrinter, 1);
+
+	printer->ref_count = 1;
+	printer->name = g_strdup (name);
+	g_mutex_init (&printer->lock);
+
+	g_mutex_lock (&printers_lock);
+	if (printers == NULL)
+		printers = g_hash_table_new_full (g_str_hash,
+						  g_str_equal,
+						  NULL,
+						  (GDestroyNotify) pd_metrics_printer_unref);
+
+	g_hash_table_replace (printers, printer->name,
+			      pd_metrics_printer_ref (printer));
+	g_mutex_unlock (&printers_lock);
+	return printer;
+}
+
+/**
+ * pd_metrics_printer_ref:
+ * @printer: A #PdMetricsPrinter.
+ *
+ * Returns: @printer, with an extra reference.
+ */
+PdMetricsPrinter *
+pd_metrics_printer_ref (PdMetricsPrinter *printer)
+{
+	g_atomic_int_inc (&printer->ref_count);
+	return printer;
+}
+
+/**
+ * pd_metrics_printer_unref:
+ * @printer: A #PdMetricsPrinter.
+ *
+ * Releases a reference to @printer.
+ */
+void
+pd_metrics_printer_unref (PdMetricsPrinter *printer)
+{
+	if (!g_atomic_int_dec_and_test (&printer->ref_count))
+		return;
+
+	g_mutex_clear (&printer->lock);
+	g_free (printer->name);
+	g_free (printer);
+}
+
+/**
+ * pd_metrics_printer_remove:
+ * @printer: A #PdMetricsPrinter.
+ *
+ * Stops reporting @printer, e.g. because it has been deleted. Jobs
+ * still holding a reference may go on recording into it.
+ */
+void
+pd_metrics_printer_remove (PdMetricsPrinter *printer)
+{
+	g_return_if_fail (printer != NULL);
+
+	g_mutex_lock (&printers_lock);
+	if (printers &&
+	    g_hash_table_lookup (printers, printer->name) == printer)
+		g_hash_table_remove (printers, printer->name);
+	g_mutex_unlock (&printers_lock);
+}
+
+/**
+ * pd_metrics_count:
+ * @counter: The counter to increment.
+ * @printer: (allow-none): A #PdMetricsPrinter, or %NULL.
+ * @delta: Amount to add.
+ *
+ * Adds @delta to @counter, both in total and, if @printer is not
+ * %NULL, for @printer.
+ */
+void
+pd_metrics_count (PdMetricsCounter counter,
+		  PdMetricsPrinter *printer,
+		  guint64 delta)
+{
+	PdMetricsShard *shard;
+
+	g_return_if_fail (counter < PD_METRICS_N_COUNTERS);
+
+	shard = pd_metrics_lock_shard ();
+	shard->counters[counter] += delta;
+	g_mutex_unlock (&shard->lock);
+
+	if (printer) {
+		g_mutex_lock (&printer->lock);
+		printer->counters[counter] += delta;
+		g_mutex_unlock (&printer->lock);
+	}
+}
+
+/**
+ * pd_metrics_gauge_add:
+ * @gauge: The gauge to adjust.
+ * @delta: Amount to add, which may be negative.
+ *
+ * Adjusts the current value of @gauge.
+ */
+void
+pd_metrics_gauge_add (PdMetricsGauge gauge,
+		      gint delta)
+{
+	g_return_if_fail (gauge < PD_METRICS_N_GAUGES);
+	g_atomic_int_add (&gauges[gauge], delta);
+}
+
+/**
+ * pd_metrics_observe:
+ * @histogram: The histogram to record into.
+ * @usec: Duration in microseconds.
+ *
+ * Records one duration in @histogram.
+ */
+void
+pd_metrics_observe (PdMetricsHistogram histogram,
+		    gint64 usec)
+{
+	PdMetricsShard *shard;
+	guint bucket = 0;
+
+	g_return_if_fail (histogram < PD_METRICS_N_HISTOGRAMS);
+
+	if (usec < 0)
+		usec = 0;
+
+	if (usec > 0)
+		bucket = MIN (g_bit_storage ((guint64) usec),
+			      PD_METRICS_N_BUCKETS - 1);
+
+	shard = pd_metrics_lock_shard ();
+	shard->buckets[histogram][bucket]++;
+	shard->sum[histogram] += usec;
+	g_mutex_unlock (&shard->lock);
+}
+
+/**
+ * pd_metrics_usage_init:
+ * @usage: A #PdMetricsUsage to fill in.
+ * @ru: Resource usage of one process, from wait4().
+ *
+ * Sets @usage to describe a single process.
+ */
+void
+pd_metrics_usage_init (PdMetricsUsage *usage,
+		       const struct rusage *ru)
+{
+	usage->processes = 1;
+	usage->user_usec = (guint64) ru->ru_utime.tv_sec * G_USEC_PER_SEC +
+		ru->ru_utime.tv_usec;
+	usage->system_usec = (guint64) ru->ru_stime.tv_sec * G_USEC_PER_SEC +
+		ru->ru_stime.tv_usec;
+	usage->max_rss_kb = ru->ru_maxrss;
+	usage->in_blocks = ru->ru_inblock;
+	usage->out_blocks = ru->ru_oublock;
+}
+
+/**
+ * pd_metrics_usage_build:
+ * @usage: A #PdMetricsUsage.
+ * @builder: An open a{sv} #GVariantBuilder.
+ *
+ * Adds user-time and system-time (in microseconds), max-rss (in
+ * KiB), block-input and block-output to @builder, all as "t".
+ */
+void
+pd_metrics_usage_build (const PdMetricsUsage *usage,
+			GVariantBuilder *builder)
+{
+	g_variant_builder_add (builder, "{sv}", "user-time",
+			       g_variant_new_uint64 (usage->user_usec));
+	g_variant_builder_add (builder, "{sv}", "system-time",
+			       g_variant_new_uint64 (usage->system_usec));
+	g_variant_builder_add (builder, "{sv}", "max-rss",
+			       g_variant_new_uint64 (usage->max_rss_kb));
+	g_variant_builder_add (builder, "{sv}", "block-input",
+			       g_variant_new_uint64 (usage->in_blocks));
+	g_variant_builder_add (builder, "{sv}", "block-output",
+			       g_variant_new_uint64 (usage->out_blocks));
+}
+
+/**
+ * pd_metrics_add_usage:
+ * @printer: (allow-none): A #PdMetricsPrinter, or %NULL.
+ * @command: The filter or backend program name.
+ * @usage: Resources used.
+ *
+ * Adds @usage to the totals for @printer and for @command.
+ */
+void
+pd_metrics_add_usage (PdMetricsPrinter *printer,
+		      const gchar *command,
+		      const PdMetricsUsage *usage)
+{
+	PdMetricsShard *shard;
+
+	shard = pd_metrics_lock_shard ();
+	pd_metrics_usage_table_add (shard->command_usage, command, usage);
+	g_mutex_unlock (&shard->lock);
+
+	if (printer) {
+		g_mutex_lock (&printer->lock);
+		pd_metrics_usage_add (&printer->usage, usage);
+		g_mutex_unlock (&printer->lock);
+	}
+}
+
+/**
+ * pd_metrics_add_slow_handler:
+ * @name: Name of the event source that was running.
+ * @usec: How long the main loop was busy.
+ *
+ * Records a main loop iteration that took too long.
+ */
+void
+pd_metrics_add_slow_handler (const gchar *name,
+			     gint64 usec)
+{
+	PdMetricsShard *shard;
+	PdMetricsSlow slow;
+
+	slow.count = 1;
+	slow.total_usec = slow.max_usec = MAX (usec, 0);
+	pd_metrics_observe (PD_METRICS_SLOW_DISPATCH, usec);
+
+	shard = pd_metrics_lock_shard ();
+	pd_metrics_slow_table_add (shard->slow_handlers, name, &slow);
+	g_mutex_unlock (&shard->lock);
+}
+
+static GVariant *
+pd_metrics_slow_table_to_variant (GHashTable *table)
+{
+	GVariantBuilder builder;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+	g_hash_table_iter_init (&iter, table);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		PdMetricsSlow *slow = value;
+		g_variant_builder_open (&builder, G_VARIANT_TYPE ("{sa{sv}}"));
+		g_variant_builder_add (&builder, "s", (const gchar *) key);
+		g_variant_builder_open (&builder, G_VARIANT_TYPE ("a{sv}"));
+		g_variant_builder_add (&builder, "{sv}", "count",
+				       g_variant_new_uint64 (slow->count));
+		g_variant_builder_add (&builder, "{sv}", "total-time",
+				       g_variant_new_uint64 (slow->total_usec));
+		g_variant_builder_add (&builder, "{sv}", "max-time",
+				       g_variant_new_uint64 (slow->max_usec));
+		g_variant_builder_close (&builder);
+		g_variant_builder_close (&builder);
+	}
+
+	return g_variant_builder_end (&builder);
+}
+
+static void
+pd_metrics_usage_table_entry (GVariantBuilder *builder,
+			      const gchar *key,
+			      const PdMetricsUsage *usage)
+{
+	g_variant_builder_open (builder, G_VARIANT_TYPE ("{sa{sv}}"));
+	g_variant_builder_add (builder, "s", key);
+	g_variant_builder_open (builder, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (builder, "{sv}", "processes",
+			       g_variant_new_uint64 (usage->processes));
+	pd_metrics_usage_build (usage, builder);
+	g_variant_builder_close (builder);
+	g_variant_builder_close (builder);
+}
+
+static GVariant *
+pd_metrics_usage_table_to_variant (GHashTable *table)
+{
+	GVariantBuilder builder;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+	g_hash_table_iter_init (&iter, table);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		pd_metrics_usage_table_entry (&builder, key, value);
+
+	return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+pd_metrics_counters_to_variant (const guint64 *counters)
+{
+	GVariantBuilder builder;
+	gint i;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	for (i = 0; i < PD_METRICS_N_COUNTERS; i++)
+		g_variant_builder_add (&builder, "{sv}",
+				       counter_names[i],
+				       g_variant_new_uint64 (counters[i]));
+
+	return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+pd_metrics_histogram_to_variant (PdMetricsShard *total,
+				 PdMetricsHistogram histogram)
+{
+	GVariantBuilder builder, buckets;
+	guint64 count = 0;
+	gint i;
+
+	g_variant_builder_init (&buckets, G_VARIANT_TYPE ("a(tt)"));
+	for (i = 0; i < PD_METRICS_N_BUCKETS; i++) {
+		guint64 n = total->buckets[histogram][i];
+		guint64 limit;
+
+		if (n == 0)
+			continue;
+
+		if (i == PD_METRICS_N_BUCKETS - 1)
+			limit = G_MAXUINT64;
+		else
+			limit = G_GUINT64_CONSTANT (1) << i;
+
+		g_variant_builder_add (&buckets, "(tt)", limit, n);
+		count += n;
+	}
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (&builder, "{sv}", "count",
+			       g_variant_new_uint64 (count));
+	g_variant_builder_add (&builder, "{sv}", "sum",
+			       g_variant_new_uint64 (total->sum[histogram]));
+	g_variant_builder_add (&builder, "{sv}", "buckets",
+			       g_variant_builder_end (&buckets));
+	return g_variant_builder_end (&builder);
+}
+
+/**
+ * pd_metrics_snapshot:
+ * @builder: An open a{sv} #GVariantBuilder.
+ *
+ * Adds the current value of every metric to @builder. Counters are
+ * added as "t" values, gauges as "u", per-printer counters under
+ * "printers" as "a{sa{sv}}", and each histogram as an "a{sv}" with
+ * "count", "sum" (in microseconds) and "buckets". Buckets are an
+ * "a(tt)" of (upper limit in microseconds, count), omitting empty
+ * buckets. Resources used by filters and backends are totalled by
+ * printer in "printer-usage" and by command in "command-usage".
+ * Slow main loop iterations are in "slow-handlers", by the name of
+ * the source that was running.
+ */
+void
+pd_metrics_snapshot (GVariantBuilder *builder)
+{
+	PdMetricsShard *total = pd_metrics_shard_new ();
+	GVariantBuilder per_printer, printer_usage;
+	GHashTableIter iter;
+	gpointer key, value;
+	GSList *each;
+	gint i;
+#ifdef HAVE_MALLINFO2
+	struct mallinfo2 info;
+#endif /* HAVE_MALLINFO2 */
+
+	g_mutex_lock (&shards_lock);
+	if (retired)
+		pd_metrics_shard_merge (total, retired);
+
+	for (each = shards; each; each = g_slist_next (each)) {
+		PdMetricsShard *shard = each->data;
+		g_mutex_lock (&shard->lock);
+		pd_metrics_shard_merge (total, shard);
+		g_mutex_unlock (&shard->lock);
+	}
+	g_mutex_unlock (&shards_lock);
+
+	for (i = 0; i < PD_METRICS_N_COUNTERS; i++)
+		g_variant_builder_add (builder, "{sv}",
+				       counter_names[i],
+				       g_variant_new_uint64 (total->counters[i]));
+
+	for (i = 0; i < PD_METRICS_N_GAUGES; i++)
+		g_variant_builder_add (builder, "{sv}",
+				       gauge_names[i],
+				       g_variant_new_uint32 (MAX (0, g_atomic_int_get (&gauges[i]))));
+
+	g_variant_builder_init (&per_printer, G_VARIANT_TYPE ("a{sa{sv}}"));
+	g_variant_builder_init (&printer_usage, G_VARIANT_TYPE ("a{sa{sv}}"));
+	g_mutex_lock (&printers_lock);
+	if (printers) {
+		g_hash_table_iter_init (&iter, printers);
+		while (g_hash_table_iter_next (&iter, &key, &value)) {
+			PdMetricsPrinter *printer = value;
+			g_mutex_lock (&printer->lock);
+			g_variant_builder_add (&per_printer, "{s@a{sv}}",
+					       printer->name,
+					       pd_metrics_counters_to_variant (printer->counters));
+			if (printer->usage.processes > 0)
+				pd_metrics_usage_table_entry (&printer_usage,
+							      printer->name,
+							      &printer->usage);
+			g_mutex_unlock (&printer->lock);
+		}
+	}
+	g_mutex_unlock (&printers_lock);
+
+	g_variant_builder_add (builder, "{sv}", "printers",
+			       g_variant_builder_end (&per_printer));
+
+	for (i = 0; i < PD_METRICS_N_HISTOGRAMS; i++)
+		g_variant_builder_add (builder, "{sv}",
+				       histogram_names[i],
+				       pd_metrics_histogram_to_variant (total, i));
+
+	g_variant_builder_add (builder, "{sv}", "printer-usage",
+			       g_variant_builder_end (&printer_usage));
+	g_variant_builder_add (builder, "{sv}", "command-usage",
+			       pd_metrics_usage_table_to_variant (total->command_usage));
+	g_variant_builder_add (builder, "{sv}", "slow-handlers",
+			       pd_metrics_slow_table_to_variant (total->slow_handlers));
+
+#ifdef HAVE_MALLINFO2
+	/* Allocated from the heap and from mmap()ed chunks */
+	info = mallinfo2 ();
+	g_variant_builder_add (builder, "{sv}", "heap-in-use",
+			       g_variant_new_uint64 (info.uordblks + info.hblkhd));
+#endif /* HAVE_MALLINFO2 */
+
+	pd_metrics_shard_free (total);
+}
@@ -0,0 +1,102 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __PD_METRICS_H__
+#define __PD_METRICS_H__
+
+#include <sys/resource.h>
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Monotonic counters, kept in total and per printer */
+typedef enum
+{
+	PD_METRICS_JOBS_CREATED,
+	PD_METRICS_JOBS_COMPLETED,
+	PD_METRICS_JOBS_ABORTED,
+	PD_METRICS_JOBS_CANCELED,
+	PD_METRICS_BYTES_RELAYED,
+	PD_METRICS_RELAY_WAKEUPS,
+	PD_METRICS_MAIN_LOOP_ITERATIONS,
+	PD_METRICS_N_COUNTERS
+} PdMetricsCounter;
+
+/* Values that go up and down */
+typedef enum
+{
+	PD_METRICS_ACTIVE_FILTERS,
+	PD_METRICS_N_GAUGES
+} PdMetricsGauge;
+
+/* Durations, in microseconds */
+typedef enum
+{
+	PD_METRICS_SPOOL_TIME,
+	PD_METRICS_TRANSFORM_TIME,
+	PD_METRICS_BACKEND_TIME,
+	PD_METRICS_JOB_LATENCY,
+	PD_METRICS_MAIN_LOOP_LAG,
+	PD_METRICS_SLOW_DISPATCH,
+	PD_METRICS_N_HISTOGRAMS
+} PdMetricsHistogram;
+
+/* Resources used by filter and backend processes */
+typedef struct
+{
+	guint64		 processes;
+	guint64		 user_usec;
+	guint64		 system_usec;
+	guint64		 max_rss_kb;	/* largest of any one process */
+	guint64		 in_blocks;
+	guint64		 out_blocks;
+} PdMetricsUsage;
+
+/* Per-printer totals, see pd_metrics_printer_new() */
+typedef struct _PdMetricsPrinter PdMetricsPrinter;
+
+PdMetricsPrinter *pd_metrics_printer_new	(const gchar *name);
+PdMetricsPrinter *pd_metrics_printer_ref	(PdMetricsPrinter *printer);
+void	 pd_metrics_printer_unref	(PdMetricsPrinter *printer);
+void	 pd_metrics_printer_remove	(PdMetricsPrinter *printer);
+
+void	 pd_metrics_usage_init	(PdMetricsUsage *usage,
+				 const struct rusage *ru);
+void	 pd_metrics_usage_build	(const PdMetricsUsage *usage,
+				 GVariantBuilder *builder);
+
+void	 pd_metrics_count	(PdMetricsCounter counter,
+				 PdMetricsPrinter *printer,
+				 guint64 delta);
+void	 pd_metrics_gauge_add	(PdMetricsGauge gauge,
+				 gint delta);
+void	 pd_metrics_observe	(PdMetricsHistogram histogram,
+				 gint64 usec);
+void	 pd_metrics_add_usage	(PdMetricsPrinter *printer,
+				 const gchar *command,
+				 const PdMetricsUsage *usage);
+void	 pd_metrics_add_slow_handler (const gchar *name,
+				 gint64 usec);
+void	 pd_metrics_snapshot	(GVariantBuilder *builder);
+
+G_END_DECLS
+
+#endif /* __PD_METRICS_H__ */
@@ -22,11 +22,14 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <gio/gunixfdlist.h>
 
 #include <cups/ppd.h>
+#include <cups/pwg.h>
 
 #include "pd-common.h"
 #include "pd-printer-impl.h"
@@ -34,6 +37,9 @@
 #include "pd-engine.h"
 #include "pd-job-impl.h"
 #include "pd-log.h"
+#include "pd-lock.h"
+#include "pd-metrics.h"
+#include "pd-trace.h"
 
 /**
  * SECTION:pdprinter
@@ -63,6 +69,21 @@ struct _PdPrinterImpl
 	gchar			*final_content_type;
 	gchar			*final_filter;
 
+	/* Per-printer metrics, made once the id is final */
+	PdMetricsPrinter	*metrics;
+
+	/* Defaults set with UpdateDefaults, which take precedence over
+	 * those from the driver */
+	GVariant		*explicit_defaults;
+
+	/* Defaults shared by new jobs, made when first needed */
+	GHashTable		*job_defaults;
+
+	/* Supported values by attribute name, each a set of strings,
+	 * compiled from the Supported property when it changes */
+	GVariant		*supported_compiled_from;
+	GHashTable		*supported_sets;
+
 	GMutex			 lock;
 };
 
@@ -135,12 +156,25 @@ pd_printer_impl_finalize (GObject *object)
 			     printer);
 	g_ptr_array_free (printer->jobs, TRUE);
 	g_free (printer->id);
+	if (printer->metrics)
+		pd_metrics_printer_unref (printer->metrics);
 	if (printer->final_content_type)
 		g_free (printer->final_content_type);
 
 	if (printer->final_filter)
 		g_free (printer->final_filter);
 
+	if (printer->explicit_defaults)
+		g_variant_unref (printer->explicit_defaults);
+
+	if (printer->job_defaults)
+		g_hash_table_unref (printer->job_defaults);
+
+	if (printer->supported_sets) {
+		g_hash_table_unref (printer->supported_sets);
+		g_variant_unref (printer->supported_compiled_from);
+	}
+
 	g_mutex_clear (&printer->lock);
 
 	G_OBJECT_CLASS (pd_printer_impl_parent_class)->finalize (object);
@@ -311,14 +345,45 @@ void
 pd_printer_impl_set_id (PdPrinterImpl *printer,
 			const gchar *id)
 {
-	g_mutex_lock (&printer->lock);
+	pd_mutex_lock (&printer->lock, PD_LOCK_PRINTER);
 
 	if (printer->id)
 		g_free (printer->id);
 
 	printer->id = g_strdup (id);
 
-	g_mutex_unlock (&printer->lock);
+	pd_mutex_unlock (&printer->lock, PD_LOCK_PRINTER);
+}
+
+/**
+ * pd_printer_impl_create_metrics:
+ * @printer: A #PdPrinterImpl.
+ *
+ * Starts recording metrics for @printer under its id. This is
+ * called once, before the printer is exported.
+ */
+void
+pd_printer_impl_create_metrics (PdPrinterImpl *printer)
+{
+	pd_mutex_lock (&printer->lock, PD_LOCK_PRINTER);
+	g_warn_if_fail (printer->metrics == NULL);
+	printer->metrics = pd_metrics_printer_new (printer->id);
+	pd_mutex_unlock (&printer->lock, PD_LOCK_PRINTER);
+}
+
+/**
+ * pd_printer_impl_get_metrics:
+ * @printer: A #PdPrinterImpl.
+ *
+ * Gets the per-printer metrics for @printer.
+ *
+ * Returns: (transfer none): A #PdMetricsPrinter, or %NULL if
+ * @printer has not been added to the engine.
+ */
+PdMetricsPrinter *
+pd_printer_impl_get_metrics (PdPrinterImpl *printer)
+{
+	return printer->metrics;
 }
 
 /**
@@ -336,6 +401,128 @@ pd_printer_impl_get_daemon (PdPrinterImpl *printer)
 	return printer->daemon;
 }
 
+/* PPD options with IPP equivalents. Other options keep their PPD
+ * names, as filters understand those too. */
+static const struct {
+	const gchar	*ppd;
+	const gchar	*ipp;
+} pd_printer_impl_ppd_options[] = {
+	{ "PageSize",	"media" },
+	{ "Duplex",	"sides" },
+	{ "ColorModel",	"print-color-mode" },
+	{ "Resolution",	"printer-resolution" },
+	{ "InputSlot",	"media-source" },
+	{ "MediaType",	"media-type" },
+};
+
+/* The IPP value for a PPD choice, or NULL if there is none */
+static const gchar *
+pd_printer_impl_ppd_choice_value (const gchar *attribute,
+				  const gchar *choice)
+{
+	pwg_media_t *media;
+
+	if (!strcmp (choice, "Custom"))
+		return NULL;
+
+	if (!strcmp (attribute, "media")) {
+		media = pwgMediaForPPD (choice);
+		if (media == NULL)
+			return choice;
+
+		return media->legacy ? media->legacy : media->pwg;
+	}
+
+	if (!strcmp (attribute, "sides")) {
+		if (!strcmp (choice, "None") || !strcmp (choice, "Simplex"))
+			return "one-sided";
+		if (!strcmp (choice, "DuplexNoTumble"))
+			return "two-sided-long-edge";
+		if (!strcmp (choice, "DuplexTumble"))
+			return "two-sided-short-edge";
+		return NULL;
+	}
+
+	if (!strcmp (attribute, "print-color-mode")) {
+		if (!g_ascii_strncasecmp (choice, "gray", 4) ||
+		    !g_ascii_strncasecmp (choice, "grey", 4) ||
+		    !g_ascii_strncasecmp (choice, "black", 5) ||
+		    !g_ascii_strncasecmp (choice, "mono", 4))
+			return "monochrome";
+		return "color";
+	}
+
+	return choice;
+}
+
+/**
+ * pd_printer_impl_ppd_attributes:
+ * @ppd: A PPD.
+ * @supported: An a{sv} #GVariantBuilder for supported values.
+ * @defaults: An a{sv} #GVariantBuilder for default values.
+ *
+ * Add the supported and default values for each option in @ppd.
+ */
+static void
+pd_printer_impl_ppd_attributes (ppd_file_t *ppd,
+				GVariantBuilder *supported,
+				GVariantBuilder *defaults)
+{
+	ppd_option_t *option;
+	GHashTable *seen;
+
+	seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	for (option = ppdFirstOption (ppd);
+	     option;
+	     option = ppdNextOption (ppd)) {
+		const gchar *attribute = option->keyword;
+		const gchar *value;
+		GVariantBuilder values;
+		guint j;
+		gint i;
+
+		/* Same as PageSize, as far as clients are concerned */
+		if (!strcmp (option->keyword, "PageRegion"))
+			continue;
+
+		for (j = 0; j < G_N_ELEMENTS (pd_printer_impl_ppd_options); j++)
+			if (!strcmp (option->keyword,
+				     pd_printer_impl_ppd_options[j].ppd)) {
+				attribute = pd_printer_impl_ppd_options[j].ipp;
+				break;
+			}
+
+		g_hash_table_remove_all (seen);
+		g_variant_builder_init (&values, G_VARIANT_TYPE ("as"));
+		for (i = 0; i < option->num_choices; i++) {
+			value = pd_printer_impl_ppd_choice_value (attribute,
+								  option->choices[i].choice);
+			if (value == NULL || g_hash_table_contains (seen, value))
+				continue;
+
+			g_hash_table_add (seen, g_strdup (value));
+			g_variant_builder_add (&values, "s", value);
+		}
+
+		if (g_hash_table_size (seen) == 0) {
+			g_variant_builder_clear (&values);
+			continue;
+		}
+
+		g_variant_builder_add (supported, "{sv}", attribute,
+				       g_variant_builder_end (&values));
+
+		value = pd_printer_impl_ppd_choice_value (attribute,
+							  option->defchoice);
+		if (value)
+			g_variant_builder_add (defaults, "{sv}", attribute,
+					       g_variant_new_string (value));
+	}
+
+	g_hash_table_unref (seen);
+}
+
 gboolean
 pd_printer_impl_set_driver (PdPrinterImpl *printer,
 			    const gchar *driver)
@@ -345,6 +532,9 @@ pd_printer_impl_set_driver (PdPrinterImpl *printer,
 	gchar *best_format = NULL;
 	gchar *best_format_filter = NULL;
 	int best_cost;
+	static const gchar *document_formats[] = { "application/pdf" };
+	GVariantBuilder supported, defaults;
+	GVariant *value;
 
 	if (driver == NULL)
 		return FALSE;
@@ -389,7 +579,32 @@ pd_printer_impl_set_driver (PdPrinterImpl *printer,
 	if (!best_format)
 		best_format = g_strdup ("application/vnd.cups-pdf");
 
-	g_mutex_lock (&printer->lock);
+	/* Supported and default values from the PPD's options */
+	g_variant_builder_init (&supported, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_init (&defaults, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (&supported, "{sv}", "document-format",
+			       g_variant_new_strv (document_formats,
+						   G_N_ELEMENTS (document_formats)));
+	g_variant_builder_add (&defaults, "{sv}", "document-format",
+			       g_variant_new_string ("application/octet-stream"));
+	pd_printer_impl_ppd_attributes (ppd, &supported, &defaults);
+	ppdClose (ppd);
+
+	/* Publish everything together */
+	pd_mutex_lock (&printer->lock, PD_LOCK_PRINTER);
+	g_object_freeze_notify (G_OBJECT (printer));
+	pd_printer_set_supported (PD_PRINTER (printer),
+				  g_variant_builder_end (&supported));
+	value = g_variant_ref_sink (g_variant_builder_end (&defaults));
+	if (printer->explicit_defaults)
+		pd_printer_set_defaults (PD_PRINTER (printer),
+					 update_attributes (value,
+							    printer->explicit_defaults));
+	else
+		pd_printer_set_defaults (PD_PRINTER (printer), value);
+	g_variant_unref (value);
+	g_clear_pointer (&printer->job_defaults, g_hash_table_unref);
+
 	if (printer->final_content_type)
 		g_free (printer->final_content_type);
 
@@ -402,35 +617,11 @@ pd_printer_impl_set_driver (PdPrinterImpl *printer,
 		       best_format_filter);
 	printer->final_content_type = best_format;
 	printer->final_filter = best_format_filter;
-
-	g_mutex_unlock (&printer->lock);
-	ppdClose (ppd);
 	pd_printer_set_driver (PD_PRINTER (printer), driver);
-	return TRUE;
-}
-
-static GVariant *
-update_attributes (GVariant *attributes, GVariant *updates)
-{
-	GVariantBuilder builder;
-	GVariantIter iter;
-	gchar *dkey;
-	GVariant *dvalue;
 
-	/* Add any values from attributes that are not in updates */
-	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
-	g_variant_iter_init (&iter, attributes);
-	while (g_variant_iter_loop (&iter, "{sv}", &dkey, &dvalue))
-		if (!g_variant_lookup_value (updates, dkey, NULL))
-			g_variant_builder_add (&builder, "{sv}",
-					       dkey, dvalue);
-
-	/* Now add in the updates */
-	g_variant_iter_init (&iter, updates);
-	while (g_variant_iter_loop (&iter, "{sv}", &dkey, &dvalue))
-		g_variant_builder_add (&builder, "{sv}", dkey, dvalue);
-
-	return g_variant_builder_end (&builder);
+	pd_mutex_unlock (&printer->lock, PD_LOCK_PRINTER);
+	g_object_thaw_notify (G_OBJECT (printer));
+	return TRUE;
 }
 
 void
@@ -454,13 +645,24 @@ pd_printer_impl_do_update_defaults (PdPrinterImpl *printer,
 		g_free (val);
 	}
 
-	g_mutex_lock (&printer->lock);
+	pd_mutex_lock (&printer->lock, PD_LOCK_PRINTER);
 	g_object_freeze_notify (G_OBJECT (printer));
 	current_defaults = pd_printer_get_defaults (PD_PRINTER (printer));
 	value = update_attributes (current_defaults,
 				   defaults);
 	pd_printer_set_defaults (PD_PRINTER (printer), value);
-	g_mutex_unlock (&printer->lock);
+
+	/* Remember these in case the driver changes */
+	if (printer->explicit_defaults) {
+		value = update_attributes (printer->explicit_defaults, defaults);
+		g_variant_unref (printer->explicit_defaults);
+		printer->explicit_defaults = g_variant_ref_sink (value);
+	} else
+		printer->explicit_defaults = g_variant_ref (defaults);
+
+	/* Jobs keep the defaults they were created with */
+	g_clear_pointer (&printer->job_defaults, g_hash_table_unref);
+	pd_mutex_unlock (&printer->lock, PD_LOCK_PRINTER);
 	g_object_thaw_notify (G_OBJECT (printer));
 }
 
@@ -507,13 +709,13 @@ pd_printer_impl_add_state_reason (PdPrinterImpl *printer,
 
 	printer_debug (PD_PRINTER (printer), "state-reasons += %s", reason);
 
-	g_mutex_lock (&printer->lock);
+	pd_mutex_lock (&printer->lock, PD_LOCK_PRINTER);
 	g_object_freeze_notify (G_OBJECT (printer));
 	reasons = pd_printer_get_state_reasons (PD_PRINTER (printer));
 	strv = add_or_remove_state_reason (reasons, '+', reason);
 	pd_printer_set_state_reasons (PD_PRINTER (printer),
 				      (const gchar *const *) strv);
-	g_mutex_unlock (&printer->lock);
+	pd_mutex_unlock (&printer->lock, PD_LOCK_PRINTER);
 	g_object_thaw_notify (G_OBJECT (printer));
 	g_strfreev (strv);
 }
@@ -527,13 +729,13 @@ pd_printer_impl_remove_state_reason (PdPrinterImpl *printer,
 
 	printer_debug (PD_PRINTER (printer), "state-reasons -= %s", reason);
 
-	g_mutex_lock (&printer->lock);
+	pd_mutex_lock (&printer->lock, PD_LOCK_PRINTER);
 	g_object_freeze_notify (G_OBJECT (printer));
 	reasons = pd_printer_get_state_reasons (PD_PRINTER (printer));
 	strv = add_or_remove_state_reason (reasons, '-', reason);
 	pd_printer_set_state_reasons (PD_PRINTER (printer),
 				      (const gchar *const *) strv);
-	g_mutex_unlock (&printer->lock);
+	pd_mutex_unlock (&printer->lock, PD_LOCK_PRINTER);
 	g_object_thaw_notify (G_OBJECT (printer));
 	g_strfreev (strv);
 }
@@ -574,7 +776,7 @@ pd_printer_impl_get_next_job (PdPrinterImpl *printer)
 
 	g_return_val_if_fail (PD_IS_PRINTER_IMPL (printer), NULL);
 
-	g_mutex_lock (&printer->lock);
+	pd_mutex_lock (&printer->lock, PD_LOCK_PRINTER);
 	index = 0;
 	for (index = 0; index < printer->jobs->len; index++) {
 		job = g_ptr_array_index (printer->jobs, index);
@@ -590,10 +792,40 @@ pd_printer_impl_get_next_job (PdPrinterImpl *printer)
 	if (best)
 		g_object_ref (best);
 
-	g_mutex_unlock (&printer->lock);
+	pd_mutex_unlock (&printer->lock, PD_LOCK_PRINTER);
 	return best;
 }
 
+/**
+ * pd_printer_impl_get_queue_depth:
+ * @printer: A #PdPrinterImpl.
+ *
+ * Count the jobs on @printer which have not yet finished.
+ *
+ * Returns: The number of pending, held or processing jobs.
+ */
+guint
+pd_printer_impl_get_queue_depth (PdPrinterImpl *printer)
+{
+	guint depth = 0;
+	guint index;
+
+	g_return_val_if_fail (PD_IS_PRINTER_IMPL (printer), 0);
+
+	pd_mutex_lock (&printer->lock, PD_LOCK_PRINTER);
+	for (index = 0; index < printer->jobs->len; index++) {
+		PdJob *job = g_ptr_array_index (printer->jobs, index);
+		if (job == NULL)
+			break;
+
+		if (pd_job_get_state (job) < PD_JOB_STATE_CANCELED)
+			depth++;
+	}
+
+	pd_mutex_unlock (&printer->lock, PD_LOCK_PRINTER);
+	return depth;
+}
+
 /**
  * pd_printer_impl_dup_final_content_type:
  * @printer: A #PdPrinterImpl.
@@ -613,12 +845,12 @@ pd_printer_impl_dup_final_content_type (PdPrinterImpl *printer,
 	gchar *final_content_type;
 	gchar *final_filter;
 
-	g_mutex_lock (&printer->lock);
+	pd_mutex_lock (&printer->lock, PD_LOCK_PRINTER);
 	if (printer->final_content_type)
 		final_content_type = g_strdup (printer->final_content_type);
 	if (printer->final_filter)
 		final_filter = g_strdup (printer->final_filter);
-	g_mutex_unlock (&printer->lock);
+	pd_mutex_unlock (&printer->lock, PD_LOCK_PRINTER);
 
 	if (!final_content_type || !final_filter)
 		goto fail;
@@ -678,51 +910,90 @@ out:
 	return TRUE; /* handled the method invocation */
 }
 
-static gboolean
-attribute_value_is_supported (PdPrinterImpl *printer,
-			      const gchar *key,
-			      GVariant *value)
+/* Make a set of strings for each attribute in the Supported
+ * property. The strings belong to the property value. */
+static GHashTable *
+pd_printer_impl_compile_supported (GVariant *supported)
+{
+	GHashTable *sets;
+	GVariantIter iter;
+	const gchar *key;
+	GVariant *values;
+
+	sets = g_hash_table_new_full (g_str_hash,
+				      g_str_equal,
+				      NULL,
+				      (GDestroyNotify) g_hash_table_unref);
+	g_variant_iter_init (&iter, supported);
+	while (g_variant_iter_next (&iter, "{&sv}", &key, &values)) {
+		GHashTable *set = g_hash_table_new (g_str_hash, g_str_equal);
+		const gchar **strv = NULL;
+		gsize i, n;
+
+		if (g_variant_is_of_type (values, G_VARIANT_TYPE_STRING_ARRAY)) {
+			strv = g_variant_get_strv (values, &n);
+			for (i = 0; i < n; i++)
+				g_hash_table_add (set, (gpointer) strv[i]);
+		}
+
+		g_hash_table_insert (sets, (gpointer) key, set);
+		g_free (strv);
+		g_variant_unref (values);
+	}
+
+	return sets;
+}
+
+/**
+ * pd_printer_impl_attribute_value_is_supported:
+ * @printer: A #PdPrinterImpl.
+ * @key: Attribute name.
+ * @value: Value for the attribute.
+ *
+ * This must be called while holding the @printer's lock.
+ *
+ * Returns: Whether @value is among the supported values for @key,
+ * or %TRUE if there is no restriction on @key.
+ */
+gboolean
+pd_printer_impl_attribute_value_is_supported (PdPrinterImpl *printer,
+					      const gchar *key,
+					      GVariant *value)
 {
-	gboolean ret = FALSE;
-	GVariant *supported_values;
-	GVariantIter iter_supported;
 	GVariant *supported;
-	gchar *supported_val;
-	const gchar *provided_val;
-	gboolean found;
+	GHashTable *set;
 
-	/* Is this an attribute for which there are restrictions? */
+	/* Compile the supported values again if they have changed */
 	supported = pd_printer_get_supported (PD_PRINTER (printer));
-	supported_values = g_variant_lookup_value (supported,
-						   key,
-						   G_VARIANT_TYPE ("s"));
-	if (!supported_values) {
-		ret = TRUE;
-		goto out;
-	}
+	if (supported != printer->supported_compiled_from) {
+		if (printer->supported_sets) {
+			g_hash_table_unref (printer->supported_sets);
+			g_variant_unref (printer->supported_compiled_from);
+			printer->supported_sets = NULL;
+			printer->supported_compiled_from = NULL;
+		}
 
-	/* Is the supplied value among those supported? */
-	provided_val = g_variant_get_string (value, NULL);
-	g_variant_iter_init (&iter_supported, supported_values);
-	found = FALSE;
-	while (g_variant_iter_loop (&iter_supported, "s", &supported_val)) {
-		if (!g_strcmp0 (provided_val, supported_val)) {
-			/* Yes, found it. */
-			found = TRUE;
-			break;
+		if (supported) {
+			printer->supported_compiled_from = g_variant_ref (supported);
+			printer->supported_sets = pd_printer_impl_compile_supported (supported);
 		}
 	}
 
-	if (!found) {
-		printer_debug (PD_PRINTER (printer),
-			       "Unsupported value for %s", key);
-		goto out;
-	}
+	/* Is this an attribute for which there are restrictions? */
+	if (printer->supported_sets == NULL)
+		return TRUE;
 
-	/* Passed all checks */
-	ret = TRUE;
- out:
-	return ret;
+	set = g_hash_table_lookup (printer->supported_sets, key);
+	if (set == NULL)
+		return TRUE;
+
+	/* Is the supplied value among those supported? */
+	if (g_variant_is_of_type (value, G_VARIANT_TYPE_STRING) &&
+	    g_hash_table_contains (set, g_variant_get_string (value, NULL)))
+		return TRUE;
+
+	printer_debug (PD_PRINTER (printer), "Unsupported value for %s", key);
+	return FALSE;
 }
 
 /**
@@ -738,6 +1009,7 @@ pd_printer_impl_job_state_notify (PdJob *job)
 	PdDaemon *daemon;
 	PdObject *obj = NULL;
 	PdPrinter *printer = NULL;
+	guint job_state;
 
 	printer_path = pd_job_get_printer (job);
 	daemon = pd_job_impl_get_daemon (PD_JOB_IMPL (job));
@@ -747,12 +1019,21 @@ pd_printer_impl_job_state_notify (PdJob *job)
 
 	printer = pd_object_get_printer (obj);
 
-	g_mutex_lock (&PD_PRINTER_IMPL (printer)->lock);
+	pd_mutex_lock (&PD_PRINTER_IMPL (printer)->lock,
+		       PD_LOCK_PRINTER);
 	g_object_freeze_notify (G_OBJECT (printer));
-	switch (pd_job_get_state (job)) {
+	job_state = pd_job_get_state (job);
+	switch (job_state) {
 	case PD_JOB_STATE_CANCELED:
 	case PD_JOB_STATE_ABORTED:
 	case PD_JOB_STATE_COMPLETED:
+		pd_metrics_count (job_state == PD_JOB_STATE_COMPLETED ?
+				  PD_METRICS_JOBS_COMPLETED :
+				  job_state == PD_JOB_STATE_ABORTED ?
+				  PD_METRICS_JOBS_ABORTED :
+				  PD_METRICS_JOBS_CANCELED,
+				  PD_PRINTER_IMPL (printer)->metrics, 1);
+
 		/* Only one job can be processing at a time currently */
 		if (pd_printer_get_state (printer) == PD_PRINTER_STATE_PROCESSING)
 			pd_printer_set_state (printer,
@@ -760,7 +1041,8 @@ pd_printer_impl_job_state_notify (PdJob *job)
 		break;
 	}
 
-	g_mutex_unlock (&PD_PRINTER_IMPL (printer)->lock);
+	pd_mutex_unlock (&PD_PRINTER_IMPL (printer)->lock,
+			 PD_LOCK_PRINTER);
 	g_object_thaw_notify (G_OBJECT (printer));
  out:
 	if (obj)
@@ -801,61 +1083,86 @@ pd_printer_impl_job_remove_state_reason (PdJobImpl *job,
 	pd_printer_impl_remove_state_reason (printer, reason);
 }
 
-static void
-pd_printer_impl_complete_create_job (PdPrinter *_printer,
-				     GDBusMethodInvocation *invocation,
-				     GVariant *options,
-				     const gchar *name,
-				     GVariant *attributes)
+/**
+ * pd_printer_impl_do_create_job:
+ * @printer: A #PdPrinterImpl.
+ * @user: Name of the originating user.
+ * @name: Name for the job.
+ * @attributes: Job template attributes.
+ * @unsupported: (out): Attributes whose values are not supported.
+ *
+ * Creates a job on @printer on behalf of @user. Free @unsupported
+ * with g_variant_unref().
+ *
+ * This must be called while holding the @printer's lock.
+ *
+ * Returns: (transfer none): The new #PdJob, owned by @printer.
+ */
+static PdJob *
+pd_printer_impl_do_create_job (PdPrinterImpl *printer,
+			       const gchar *user,
+			       const gchar *name,
+			       GVariant *attributes,
+			       GVariant **unsupported)
 {
-	PdPrinterImpl *printer = PD_PRINTER_IMPL (_printer);
 	PdJob *job;
-	gchar *object_path = NULL;
 	gchar *printer_path = NULL;
-	GVariant *defaults;
-	GVariantBuilder unsupported;
+	GVariantBuilder *unsupported_builder = NULL;
 	GVariantIter iter;
-	gchar *dkey;
+	const gchar *dkey;
 	GVariant *dvalue;
-	GVariant *job_attributes;
-	gchar *user = NULL;
 
 	printer_debug (PD_PRINTER (printer), "Creating job");
 
-	g_mutex_lock (&printer->lock);
-	g_object_freeze_notify (G_OBJECT (printer));
-
-	/* set attributes from job template attributes */
-	defaults = pd_printer_get_defaults (PD_PRINTER (printer));
-
 	/* Check for unsupported attributes */
-	g_variant_builder_init (&unsupported, G_VARIANT_TYPE ("a{sv}"));
 	g_variant_iter_init (&iter, attributes);
-	while (g_variant_iter_loop (&iter, "{sv}", &dkey, &dvalue))
+	while (g_variant_iter_next (&iter, "{&sv}", &dkey, &dvalue)) {
 		/* Is there a list of supported values? */
-		if (!attribute_value_is_supported (printer, dkey, dvalue)) {
+		if (!pd_printer_impl_attribute_value_is_supported (printer,
+								  dkey,
+								  dvalue)) {
 			gchar *val = g_variant_print (dvalue, TRUE);
 			printer_debug (PD_PRINTER (printer),
 				       "Unsupported attribute %s=%s",
 				       dkey, val);
 			g_free (val);
-			g_variant_builder_add (&unsupported, "{sv}",
+			if (unsupported_builder == NULL)
+				unsupported_builder = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
+			g_variant_builder_add (unsupported_builder, "{sv}",
 					       dkey,
 					       dvalue);
 		}
 
+		g_variant_unref (dvalue);
+	}
+
+	if (unsupported_builder) {
+		*unsupported = g_variant_ref_sink (g_variant_builder_end (unsupported_builder));
+		g_variant_builder_unref (unsupported_builder);
+	} else
+		*unsupported = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE ("{sv}"),
+									NULL, 0));
+
 	/* Tell the engine to create the job */
 	printer_path = g_strdup_printf ("/org/freedesktop/printerd/printer/%s",
 					printer->id);
-	job_attributes = update_attributes (defaults,
-					    attributes);
+	/* The job uses the defaults as they are now, overridden by its
+	 * own attributes */
+	if (printer->job_defaults == NULL) {
+		GVariant *defaults = pd_printer_get_defaults (PD_PRINTER (printer));
+		printer->job_defaults = pd_attribute_table_new (defaults);
+	}
+
 	job = pd_engine_add_job (pd_daemon_get_engine (printer->daemon),
 				 printer_path,
 				 name,
-				 job_attributes);
+				 printer->job_defaults,
+				 attributes);
 
 	/* Store the job in our array */
 	g_ptr_array_add (printer->jobs, (gpointer) job);
+	pd_metrics_count (PD_METRICS_JOBS_CREATED, printer->metrics, 1);
+	PD_TRACE2 (job_create, pd_job_get_id (job), printer->id);
 
 	/* Watch state changes */
 	g_signal_connect (job,
@@ -874,25 +1181,53 @@ pd_printer_impl_complete_create_job (PdPrinter *_printer,
 			  printer);
 
 	/* Set job-originating-user-name */
-	user = pd_get_unix_user (invocation);
 	printer_debug (PD_PRINTER (printer), "Originating user is %s", user);
 	pd_job_impl_set_attribute (PD_JOB_IMPL (job),
 				   "job-originating-user-name",
 				   g_variant_new_string (user));
 
+	g_free (printer_path);
+	return job;
+}
+
+static void
+pd_printer_impl_complete_create_job (PdPrinter *_printer,
+				     GDBusMethodInvocation *invocation,
+				     GVariant *options,
+				     const gchar *name,
+				     GVariant *attributes)
+{
+	PdPrinterImpl *printer = PD_PRINTER_IMPL (_printer);
+	PdJob *job;
+	gchar *object_path = NULL;
+	GVariant *unsupported = NULL;
+	gchar *user;
+
+	/* Resolve the caller before taking the lock */
+	user = pd_daemon_get_unix_user (printer->daemon, invocation);
+
+	pd_mutex_lock (&printer->lock, PD_LOCK_PRINTER);
+	g_object_freeze_notify (G_OBJECT (printer));
+
+	job = pd_printer_impl_do_create_job (printer,
+					     user,
+					     name,
+					     attributes,
+					     &unsupported);
+
 	object_path = g_strdup_printf ("/org/freedesktop/printerd/job/%u",
 				       pd_job_get_id (job));
 	printer_debug (PD_PRINTER (printer), "Job path is %s", object_path);
 	g_dbus_method_invocation_return_value (invocation,
 					       g_variant_new ("(o@a{sv})",
 							      object_path,
-							      g_variant_builder_end (&unsupported)));
+							      unsupported));
 
-	g_mutex_unlock (&printer->lock);
+	pd_mutex_unlock (&printer->lock, PD_LOCK_PRINTER);
 	g_object_thaw_notify (G_OBJECT (printer));
-	g_free (user);
+	g_variant_unref (unsupported);
 	g_free (object_path);
-	g_free (printer_path);
+	g_free (user);
 }
 
 /* runs in thread dedicated to handling @invocation */
@@ -924,6 +1259,88 @@ pd_printer_impl_create_job (PdPrinter *_printer,
 	return TRUE; /* handled the method invocation */
 }
 
+static void
+pd_printer_impl_complete_submit_job (PdPrinter *_printer,
+				     GDBusMethodInvocation *invocation,
+				     GUnixFDList *fd_list,
+				     GVariant *options,
+				     const gchar *name,
+				     GVariant *attributes,
+				     GVariant *file_descriptor)
+{
+	PdPrinterImpl *printer = PD_PRINTER_IMPL (_printer);
+	PdJob *job;
+	gchar *object_path = NULL;
+	GVariant *unsupported = NULL;
+	gchar *user;
+
+	user = pd_daemon_get_unix_user (printer->daemon, invocation);
+
+	pd_mutex_lock (&printer->lock, PD_LOCK_PRINTER);
+	g_object_freeze_notify (G_OBJECT (printer));
+	job = pd_printer_impl_do_create_job (printer,
+					     user,
+					     name,
+					     attributes,
+					     &unsupported);
+	g_object_ref (job);
+	pd_mutex_unlock (&printer->lock, PD_LOCK_PRINTER);
+	g_object_thaw_notify (G_OBJECT (printer));
+
+	/* Spool the document without holding the printer lock. The
+	 * job completes the invocation. */
+	object_path = g_strdup_printf ("/org/freedesktop/printerd/job/%u",
+				       pd_job_get_id (job));
+	printer_debug (PD_PRINTER (printer), "Job path is %s", object_path);
+	pd_job_impl_submit (PD_JOB_IMPL (job),
+			    invocation,
+			    options,
+			    fd_list,
+			    file_descriptor,
+			    g_variant_new ("(o@a{sv})",
+					   object_path,
+					   unsupported));
+
+	g_object_unref (job);
+	g_variant_unref (unsupported);
+	g_free (object_path);
+	g_free (user);
+}
+
+/* runs in thread dedicated to handling @invocation */
+static gboolean
+pd_printer_impl_submit_job (PdPrinter *_printer,
+			    GDBusMethodInvocation *invocation,
+			    GUnixFDList *fd_list,
+			    GVariant *options,
+			    const gchar *name,
+			    GVariant *attributes,
+			    GVariant *file_descriptor)
+{
+	PdPrinterImpl *printer = PD_PRINTER_IMPL (_printer);
+
+	/* One authorization check covers creating, adding the
+	 * document to and starting the job */
+	if (!pd_daemon_check_authorization_sync (printer->daemon,
+						 options,
+						 N_("Authentication is required to add a job"),
+						 invocation,
+						 "org.freedesktop.printerd.job-add",
+						 NULL))
+		goto out;
+
+	pd_printer_impl_complete_submit_job (_printer,
+					     invocation,
+					     fd_list,
+					     options,
+					     name,
+					     attributes,
+					     file_descriptor);
+
+ out:
+	return TRUE; /* handled the method invocation */
+}
+
 static void
 pd_printer_impl_handle_complete_update_driver (PdPrinter *_printer,
 					       GDBusMethodInvocation *invocation,
@@ -973,5 +1390,6 @@ pd_printer_iface_init (PdPrinterIface *iface)
 	iface->handle_set_device_uris = pd_printer_impl_set_device_uris;
 	iface->handle_update_defaults = pd_printer_impl_update_defaults;
 	iface->handle_create_job = pd_printer_impl_create_job;
+	iface->handle_submit_job = pd_printer_impl_submit_job;
 	iface->handle_update_driver = pd_printer_impl_handle_update_driver;
 }
@@ -23,6 +23,7 @@
 #define __PD_PRINTER_IMPL_H__
 
 #include "pd-daemontypes.h"
+#include "pd-metrics.h"
 
 G_BEGIN_DECLS
 
@@ -40,6 +41,8 @@ PdDaemon	*pd_printer_impl_get_daemon	(PdPrinterImpl	*printer);
 const gchar	*pd_printer_impl_get_id		(PdPrinterImpl	*printer);
 void		 pd_printer_impl_set_id		(PdPrinterImpl	*printer,
 						 const gchar	*id);
+void		 pd_printer_impl_create_metrics	(PdPrinterImpl	*printer);
+PdMetricsPrinter *pd_printer_impl_get_metrics	(PdPrinterImpl	*printer);
 void		 pd_printer_impl_do_update_defaults (PdPrinterImpl *printer,
 						     GVariant	*defaults);
 void		 pd_printer_impl_add_state_reason (PdPrinterImpl *printer,
@@ -48,12 +51,16 @@ void		 pd_printer_impl_remove_state_reason (PdPrinterImpl *printer,
 						      const gchar *reason);
 const gchar	*pd_printer_impl_get_uri	(PdPrinterImpl	*printer);
 PdJob		*pd_printer_impl_get_next_job	(PdPrinterImpl	*printer);
+guint		 pd_printer_impl_get_queue_depth (PdPrinterImpl	*printer);
 gboolean	 pd_printer_impl_set_driver (PdPrinterImpl *printer,
 					     const gchar *driver);
 gboolean	 pd_printer_impl_dup_final_content_type (PdPrinterImpl *printer,
 							 gchar **content_type,
 							 gchar **filter,
 							 GError **error);
+gboolean	 pd_printer_impl_attribute_value_is_supported (PdPrinterImpl *printer,
+							       const gchar *key,
+							       GVariant *value);
 
 G_END_DECLS
 
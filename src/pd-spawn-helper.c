@@ -0,0 +1,1032 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "pd-common.h"
+#include "pd-spawn-helper.h"
+#include "pd-watchdog.h"
+
+/* The helper's end of the socket */
+#define PD_SPAWN_HELPER_FD		3
+
+/* Most descriptors a process can be given */
+#define PD_SPAWN_HELPER_MAX_FDS		8
+
+/* Largest request, and largest reply */
+#define PD_SPAWN_HELPER_REQUEST_MAX	(256 * 1024)
+#define PD_SPAWN_HELPER_REPLY_MAX	4096
+
+/* How long to wait for the helper to reply to a request before
+ * giving up on it, and how often to look for the reply meanwhile,
+ * in milliseconds */
+#define PD_SPAWN_HELPER_TIMEOUT		10000
+#define PD_SPAWN_HELPER_POLL		50
+
+/* kind, and a body which depends on it */
+#define PD_SPAWN_HELPER_REQUEST		"(yv)"
+
+/* Request kinds */
+#define PD_SPAWN_HELPER_RUN		'r'
+#define PD_SPAWN_HELPER_SIGNAL		'k'
+
+/* Run: serial, path, argv, envp, descriptor number for each fd sent */
+#define PD_SPAWN_HELPER_RUN_BODY	"(usasasai)"
+#define PD_SPAWN_HELPER_RUN_ARGS	"(u&s^as^asai)"
+
+/* Signal: pid, signal number */
+#define PD_SPAWN_HELPER_SIGNAL_BODY	"(ii)"
+
+/* kind, serial, pid, wait status, struct rusage, error message */
+#define PD_SPAWN_HELPER_REPLY		"(yuiiays)"
+
+/* Reply kinds */
+#define PD_SPAWN_HELPER_SPAWNED		's'
+#define PD_SPAWN_HELPER_EXITED		'x'
+
+/*
+ * The helper is this program run again with --spawn-helper when the
+ * daemon starts. It talks to the daemon over a sequenced-packet
+ * socket. For each process to start, the daemon sends the program,
+ * its arguments and environment, along with the descriptors it
+ * should have (using SCM_RIGHTS). The helper starts it and replies
+ * with its PID or an error message, then later reports its wait
+ * status and resource usage when it exits.
+ *
+ * The helper reaps its children as soon as they exit, so only it
+ * knows whether a PID still belongs to one. The daemon asks it to
+ * send signals to them rather than calling kill() itself.
+ *
+ * The daemon waits for the reply to each request, without holding
+ * the lock so that other threads and the fd watch on the socket can
+ * read it meanwhile. Exit reports are delivered through a source for
+ * each process which becomes ready when it has exited.
+ *
+ * If the helper can't be started, or goes away, processes are
+ * started directly with pd_spawn(). So is any request too large to
+ * send.
+ */
+
+typedef struct
+{
+	GSource		 source;
+	GPid		 pid;
+	gboolean	 exited;
+	gint		 status;
+	gboolean	 have_usage;
+	struct rusage	 usage;
+} PdSpawnHelperChild;
+
+/* A request waiting for its reply */
+typedef struct
+{
+	guint32		 serial;
+	gboolean	 replied;
+	gint		 pid;
+	gchar		*message;
+} PdSpawnHelperPending;
+
+static GMutex lock;
+static gint helper_fd = -1;
+static guint helper_source;
+static guint32 helper_serial;
+static gsize helper_request_max = PD_SPAWN_HELPER_REQUEST_MAX;
+
+/* Requests waiting for replies, of PdSpawnHelperPending* */
+static GSList *pending;
+
+/* Processes started by the helper, by PID */
+static GHashTable *children;
+
+/* Helper only: written to when a child exits */
+static gint sigchld_pipe[2] = { -1, -1 };
+
+/* Helper only: children not yet reaped, a set of PIDs */
+static GHashTable *running;
+
+/* Send @message with @n_fds descriptors from @fds. On failure errno
+ * is set. */
+static gboolean
+pd_spawn_helper_send (gint sock,
+		      GVariant *message,
+		      const gint *fds,
+		      gint n_fds)
+{
+	union {
+		struct cmsghdr	cmsg;
+		gchar		buf[CMSG_SPACE (sizeof (gint) *
+						PD_SPAWN_HELPER_MAX_FDS)];
+	} control;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t ret;
+	gint err;
+
+	g_variant_ref_sink (message);
+	memset (&msg, 0, sizeof (msg));
+	iov.iov_base = (gpointer) g_variant_get_data (message);
+	iov.iov_len = g_variant_get_size (message);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (n_fds > 0) {
+		struct cmsghdr *cmsg;
+
+		memset (&control, 0, sizeof (control));
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE (sizeof (gint) * n_fds);
+		cmsg = CMSG_FIRSTHDR (&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN (sizeof (gint) * n_fds);
+		memcpy (CMSG_DATA (cmsg), fds, sizeof (gint) * n_fds);
+	}
+
+	do
+		ret = sendmsg (sock, &msg, MSG_NOSIGNAL);
+	while (ret == -1 && errno == EINTR);
+
+	err = errno;
+	g_variant_unref (message);
+	errno = err;
+	return ret != -1;
+}
+
+/**
+ * pd_spawn_helper_receive:
+ * @sock: The socket.
+ * @type: The expected message type.
+ * @max: The largest message expected.
+ * @flags: Flags for recvmsg().
+ * @fds: (allow-none): Where to store any descriptors received.
+ * @n_fds: (allow-none): Where to store how many were received.
+ *
+ * Returns: (transfer full): The message, or %NULL with errno set. At
+ * end of file errno is ECONNRESET.
+ */
+static GVariant *
+pd_spawn_helper_receive (gint sock,
+			 const GVariantType *type,
+			 gsize max,
+			 gint flags,
+			 gint *fds,
+			 gint *n_fds)
+{
+	union {
+		struct cmsghdr	cmsg;
+		gchar		buf[CMSG_SPACE (sizeof (gint) *
+						PD_SPAWN_HELPER_MAX_FDS)];
+	} control;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	gchar *buf = g_malloc (max);
+	gint received = 0;
+	ssize_t ret;
+	gint err;
+
+	memset (&msg, 0, sizeof (msg));
+	iov.iov_base = buf;
+	iov.iov_len = max;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof (control.buf);
+
+	do
+		ret = recvmsg (sock, &msg, flags | MSG_CMSG_CLOEXEC);
+	while (ret == -1 && errno == EINTR);
+
+	err = ret == 0 ? ECONNRESET : errno;
+	for (cmsg = ret > 0 ? CMSG_FIRSTHDR (&msg) : NULL;
+	     cmsg;
+	     cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+		const gint *data = (const gint *) CMSG_DATA (cmsg);
+		gint n, i;
+
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		n = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (gint);
+		for (i = 0; i < n; i++)
+			if (fds && received < PD_SPAWN_HELPER_MAX_FDS)
+				fds[received++] = data[i];
+			else
+				close (data[i]);
+	}
+
+	if (n_fds)
+		*n_fds = received;
+
+	if (ret > 0 && (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+		err = EMSGSIZE;
+		ret = -1;
+	}
+
+	if (ret <= 0) {
+		while (received > 0)
+			close (fds[--received]);
+		if (n_fds)
+			*n_fds = 0;
+
+		g_free (buf);
+		errno = err;
+		return NULL;
+	}
+
+	return g_variant_ref_sink (g_variant_new_from_data (type,
+							    buf,
+							    ret,
+							    FALSE,
+							    g_free,
+							    buf));
+}
+
+/* ------------------------------------------------------------------ */
+/* Daemon side */
+
+static gboolean
+pd_spawn_helper_child_dispatch (GSource *source,
+				GSourceFunc callback,
+				gpointer user_data)
+{
+	PdSpawnHelperChild *child = (PdSpawnHelperChild *) source;
+	PdChildWatchFunc function = (PdChildWatchFunc) callback;
+
+	g_mutex_lock (&lock);
+	g_hash_table_remove (children, GINT_TO_POINTER (child->pid));
+	g_mutex_unlock (&lock);
+
+	if (function)
+		function (child->pid,
+			  child->status,
+			  child->have_usage ? &child->usage : NULL,
+			  user_data);
+
+	return G_SOURCE_REMOVE;
+}
+
+static GSourceFuncs pd_spawn_helper_child_funcs = {
+	NULL,	/* prepare: ready when the ready time is set */
+	NULL,	/* check */
+	pd_spawn_helper_child_dispatch,
+	NULL
+};
+
+/* Note that a child has exited. Must hold the lock. */
+static void
+pd_spawn_helper_child_exited (PdSpawnHelperChild *child,
+			      gint status,
+			      const struct rusage *usage)
+{
+	GSource *source = (GSource *) child;
+
+	child->exited = TRUE;
+	child->status = status;
+	if (usage) {
+		child->have_usage = TRUE;
+		child->usage = *usage;
+	}
+
+	if (g_source_is_destroyed (source))
+		/* Nobody is watching any more */
+		g_hash_table_remove (children, GINT_TO_POINTER (child->pid));
+	else if (g_source_get_context (source))
+		g_source_set_ready_time (source, 0);
+}
+
+/* Handle an exit report. Must hold the lock. */
+static void
+pd_spawn_helper_exit_report (GVariant *reply)
+{
+	PdSpawnHelperChild *child;
+	GVariant *usage_bytes;
+	struct rusage usage;
+	gconstpointer data;
+	gsize size;
+	gint pid, status;
+
+	g_variant_get (reply, "(yuii@ays)", NULL, NULL, &pid, &status,
+		       &usage_bytes, NULL);
+	data = g_variant_get_fixed_array (usage_bytes, &size, 1);
+	if (size == sizeof (usage))
+		memcpy (&usage, data, sizeof (usage));
+
+	child = g_hash_table_lookup (children, GINT_TO_POINTER (pid));
+	if (child)
+		pd_spawn_helper_child_exited (child, status,
+					      size == sizeof (usage) ?
+					      &usage : NULL);
+
+	g_variant_unref (usage_bytes);
+}
+
+/* Handle the reply to a request. Must hold the lock. */
+static void
+pd_spawn_helper_spawn_report (GVariant *reply)
+{
+	GSList *each;
+	guint32 serial;
+	gchar *message;
+	gint pid;
+
+	g_variant_get (reply, "(yuii@ays)", NULL, &serial, &pid, NULL,
+		       NULL, &message);
+	for (each = pending; each; each = g_slist_next (each)) {
+		PdSpawnHelperPending *request = each->data;
+
+		if (request->serial == serial) {
+			request->replied = TRUE;
+			request->pid = pid;
+			request->message = message;
+
+			/* Its exit is reported through this source. Add
+			 * it now in case the report was read with this. */
+			if (pid > 0) {
+				PdSpawnHelperChild *child;
+
+				child = (PdSpawnHelperChild *)
+					g_source_new (&pd_spawn_helper_child_funcs,
+						      sizeof (PdSpawnHelperChild));
+				child->pid = pid;
+				g_hash_table_insert (children,
+						     GINT_TO_POINTER (pid),
+						     child);
+			}
+
+			return;
+		}
+	}
+
+	/* Whoever asked has given up waiting */
+	g_debug ("[SpawnHelper] Late reply to request %u", serial);
+	g_free (message);
+}
+
+/* Stop using the helper. Must hold the lock. */
+static void
+pd_spawn_helper_lost (void)
+{
+	GHashTableIter iter;
+	gpointer value;
+	GSList *each;
+
+	g_warning ("[SpawnHelper] Lost the spawn helper, "
+		   "starting processes directly");
+
+	if (helper_source)
+		g_source_remove (helper_source);
+	helper_source = 0;
+	close (helper_fd);
+	helper_fd = -1;
+
+	/* Requests still waiting will get no reply */
+	for (each = pending; each; each = g_slist_next (each)) {
+		PdSpawnHelperPending *request = each->data;
+
+		if (request->replied)
+			continue;
+
+		request->replied = TRUE;
+		request->pid = -1;
+	}
+
+	/* The exit statuses of its children are lost with it */
+	g_hash_table_iter_init (&iter, children);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		PdSpawnHelperChild *child = value;
+		GSource *source = value;
+
+		if (child->exited)
+			continue;
+
+		child->exited = TRUE;
+		child->status = 255 << 8;
+		if (g_source_is_destroyed (source))
+			g_hash_table_iter_remove (&iter);
+		else if (g_source_get_context (source))
+			g_source_set_ready_time (source, 0);
+	}
+}
+
+/* Handle each message waiting on the socket. Must hold the lock.
+ * Returns FALSE if the helper has gone. */
+static gboolean
+pd_spawn_helper_read (void)
+{
+	GVariant *reply;
+
+	while ((reply = pd_spawn_helper_receive (helper_fd,
+						 G_VARIANT_TYPE (PD_SPAWN_HELPER_REPLY),
+						 PD_SPAWN_HELPER_REPLY_MAX,
+						 MSG_DONTWAIT,
+						 NULL, NULL)) != NULL) {
+		guchar kind;
+
+		g_variant_get_child (reply, 0, "y", &kind);
+		if (kind == PD_SPAWN_HELPER_EXITED)
+			pd_spawn_helper_exit_report (reply);
+		else if (kind == PD_SPAWN_HELPER_SPAWNED)
+			pd_spawn_helper_spawn_report (reply);
+
+		g_variant_unref (reply);
+	}
+
+	if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return TRUE;
+
+	pd_spawn_helper_lost ();
+	return FALSE;
+}
+
+static gboolean
+pd_spawn_helper_io_cb (gint fd,
+		       GIOCondition condition,
+		       gpointer user_data)
+{
+	gboolean ret = G_SOURCE_CONTINUE;
+	const gchar *watchdog;
+
+	watchdog = pd_watchdog_enter ("[printerd] spawn helper");
+	g_mutex_lock (&lock);
+
+	/* Another thread may have found the helper gone and removed
+	 * this source while it was waiting to run */
+	if (helper_fd != fd || !pd_spawn_helper_read ())
+		ret = G_SOURCE_REMOVE;
+
+	g_mutex_unlock (&lock);
+	pd_watchdog_leave (watchdog);
+	return ret;
+}
+
+static void
+pd_spawn_helper_exit_cb (GPid pid,
+			 gint status,
+			 const struct rusage *usage,
+			 gpointer user_data)
+{
+	g_debug ("[SpawnHelper] PID %d exited with status %d",
+		 pid, status);
+}
+
+/**
+ * pd_spawn_helper_start:
+ * @error: Return location for error or %NULL.
+ *
+ * Start the spawn helper. Until this is called, and if it fails,
+ * pd_spawn_helper_spawn() starts processes directly.
+ *
+ * Returns: %TRUE if the helper was started.
+ */
+gboolean
+pd_spawn_helper_start (GError **error)
+{
+	const gchar *argv[] = { "printerd", "--spawn-helper", NULL };
+	gint child_fds[PD_SPAWN_HELPER_FD + 1] = { -1, -1, -1, -1 };
+	gchar **envp = NULL;
+	gint sock[2];
+	gint sndbuf;
+	socklen_t len = sizeof (sndbuf);
+	GPid pid;
+	gboolean ret = FALSE;
+
+	if (socketpair (AF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0,
+			sock) != 0) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     g_io_error_from_errno (errno),
+			     "Failed to create socket pair: %s",
+			     g_strerror (errno));
+		goto out;
+	}
+
+	child_fds[PD_SPAWN_HELPER_FD] = sock[1];
+	envp = g_get_environ ();
+	ret = pd_spawn (PD_SELF_EXE,
+			(gchar **) argv,
+			envp,
+			child_fds,
+			G_N_ELEMENTS (child_fds),
+			&pid,
+			error);
+	close (sock[1]);
+	if (!ret) {
+		close (sock[0]);
+		goto out;
+	}
+
+	g_mutex_lock (&lock);
+	if (children == NULL)
+		children = g_hash_table_new_full (g_direct_hash,
+						  g_direct_equal,
+						  NULL,
+						  (GDestroyNotify) g_source_unref);
+	helper_fd = sock[0];
+
+	/* A request has to fit in the socket's send buffer */
+	if (getsockopt (helper_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) == 0 &&
+	    sndbuf > 0)
+		helper_request_max = MIN (PD_SPAWN_HELPER_REQUEST_MAX,
+					  (gsize) sndbuf);
+
+	helper_source = g_unix_fd_add (helper_fd,
+				       G_IO_IN | G_IO_HUP | G_IO_ERR,
+				       pd_spawn_helper_io_cb,
+				       NULL);
+	g_source_set_name_by_id (helper_source, "[printerd] spawn helper");
+	g_mutex_unlock (&lock);
+
+	pd_child_watch_add (pid, pd_spawn_helper_exit_cb, NULL);
+	g_debug ("[SpawnHelper] Started as PID %d", pid);
+
+ out:
+	g_strfreev (envp);
+	return ret;
+}
+
+/**
+ * pd_spawn_helper_stop:
+ *
+ * Stop using the spawn helper. It exits when it sees the daemon has
+ * closed its end of the socket.
+ */
+void
+pd_spawn_helper_stop (void)
+{
+	g_mutex_lock (&lock);
+	if (helper_fd != -1) {
+		g_source_remove (helper_source);
+		helper_source = 0;
+		close (helper_fd);
+		helper_fd = -1;
+	}
+	g_mutex_unlock (&lock);
+}
+
+/**
+ * pd_spawn_helper_spawn:
+ * @path: Program to run.
+ * @argv: Its arguments, starting with argv[0].
+ * @envp: Its environment.
+ * @child_fds: File descriptors to give the program, as for pd_spawn().
+ * @n_fds: Number of entries in @child_fds.
+ * @child_pid: (out): Return location for the process ID.
+ * @error: Return location for error or %NULL.
+ *
+ * Like pd_spawn(), but using the spawn helper if it is running. The
+ * caller must use pd_spawn_helper_child_watch_add() to find out when
+ * the process exits, as until then it is not forgotten.
+ *
+ * Returns: %TRUE if the program was started.
+ */
+gboolean
+pd_spawn_helper_spawn (const gchar *path,
+		       gchar **argv,
+		       gchar **envp,
+		       const gint *child_fds,
+		       gint n_fds,
+		       GPid *child_pid,
+		       GError **error)
+{
+	PdSpawnHelperPending waiting = { 0, FALSE, -1, NULL };
+	GVariantBuilder targets;
+	GVariant *request;
+	gint fds[PD_SPAWN_HELPER_MAX_FDS];
+	gint64 deadline;
+	gint n = 0;
+	gint i;
+
+	g_mutex_lock (&lock);
+	if (helper_fd == -1 || n_fds > PD_SPAWN_HELPER_MAX_FDS)
+		goto direct;
+
+	g_variant_builder_init (&targets, G_VARIANT_TYPE ("ai"));
+	for (i = 0; i < n_fds; i++)
+		if (child_fds[i] != -1) {
+			fds[n++] = child_fds[i];
+			g_variant_builder_add (&targets, "i", i);
+		}
+
+	waiting.serial = ++helper_serial;
+	request = g_variant_ref_sink (g_variant_new ("(yv)",
+						     PD_SPAWN_HELPER_RUN,
+						     g_variant_new ("(us^as^asai)",
+								    waiting.serial,
+								    path,
+								    argv,
+								    envp,
+								    &targets)));
+	if (g_variant_get_size (request) > helper_request_max) {
+		g_variant_unref (request);
+		goto direct;
+	}
+
+	if (!pd_spawn_helper_send (helper_fd, request, fds, n)) {
+		gint err = errno;
+
+		g_variant_unref (request);
+
+		/* Only a broken connection means the helper has gone.
+		 * Otherwise, e.g. EMSGSIZE, start this one directly. */
+		if (err == EPIPE || err == ECONNRESET)
+			pd_spawn_helper_lost ();
+		else
+			g_debug ("[SpawnHelper] Starting %s directly: %s",
+				 path, g_strerror (err));
+
+		goto direct;
+	}
+
+	g_variant_unref (request);
+
+	/* Wait for the reply. The lock is released while polling, and
+	 * the reply may be read by whichever thread gets to it first. */
+	pending = g_slist_prepend (pending, &waiting);
+	deadline = g_get_monotonic_time () +
+		PD_SPAWN_HELPER_TIMEOUT * G_TIME_SPAN_MILLISECOND;
+	while (!waiting.replied) {
+		struct pollfd pfd;
+		gint64 remaining;
+
+		remaining = deadline - g_get_monotonic_time ();
+		if (remaining <= 0) {
+			g_warning ("[SpawnHelper] No reply to request %u",
+				   waiting.serial);
+			pd_spawn_helper_lost ();
+			break;
+		}
+
+		pfd.fd = helper_fd;
+		pfd.events = POLLIN;
+		g_mutex_unlock (&lock);
+		poll (&pfd, 1, MIN (remaining / G_TIME_SPAN_MILLISECOND + 1,
+				    PD_SPAWN_HELPER_POLL));
+		g_mutex_lock (&lock);
+
+		if (!waiting.replied && helper_fd != -1)
+			pd_spawn_helper_read ();
+	}
+
+	pending = g_slist_remove (pending, &waiting);
+	if (waiting.pid <= 0) {
+		g_mutex_unlock (&lock);
+		if (waiting.message)
+			g_set_error_literal (error, PD_ERROR, PD_ERROR_FAILED,
+					     waiting.message);
+		else
+			g_set_error (error,
+				     PD_ERROR,
+				     PD_ERROR_FAILED,
+				     "Failed to execute %s: lost spawn helper",
+				     path);
+		g_free (waiting.message);
+		return FALSE;
+	}
+
+	g_free (waiting.message);
+	g_mutex_unlock (&lock);
+
+	*child_pid = waiting.pid;
+	return TRUE;
+
+ direct:
+	g_mutex_unlock (&lock);
+	return pd_spawn (path, argv, envp, child_fds, n_fds, child_pid,
+			 error);
+}
+
+/**
+ * pd_spawn_helper_child_watch_add:
+ * @pid: A process from pd_spawn_helper_spawn().
+ * @function: Function to call when @pid exits.
+ * @user_data: Data to pass to @function.
+ *
+ * Like pd_child_watch_add(), for processes which may have been
+ * started by the spawn helper.
+ *
+ * Returns: The ID of the event source, for g_source_remove().
+ */
+guint
+pd_spawn_helper_child_watch_add (GPid pid,
+				 PdChildWatchFunc function,
+				 gpointer user_data)
+{
+	PdSpawnHelperChild *child = NULL;
+	GSource *source;
+	guint id;
+
+	g_mutex_lock (&lock);
+	if (children)
+		child = g_hash_table_lookup (children, GINT_TO_POINTER (pid));
+
+	if (child == NULL) {
+		/* Started directly */
+		g_mutex_unlock (&lock);
+		return pd_child_watch_add (pid, function, user_data);
+	}
+
+	source = (GSource *) child;
+	g_source_set_callback (source, (GSourceFunc) function, user_data,
+			       NULL);
+	g_source_set_name (source, "[printerd] child watch");
+	id = g_source_attach (source, NULL);
+	if (child->exited)
+		g_source_set_ready_time (source, 0);
+
+	g_mutex_unlock (&lock);
+	return id;
+}
+
+/**
+ * pd_spawn_helper_kill:
+ * @pid: A process from pd_spawn_helper_spawn().
+ * @signum: The signal to send.
+ *
+ * Sends @signum to @pid unless it has exited. Processes started by
+ * the spawn helper are signalled by the helper, as they may already
+ * have been reaped and their PID reused.
+ */
+void
+pd_spawn_helper_kill (GPid pid,
+		      gint signum)
+{
+	PdSpawnHelperChild *child = NULL;
+
+	g_mutex_lock (&lock);
+	if (children)
+		child = g_hash_table_lookup (children, GINT_TO_POINTER (pid));
+
+	if (child == NULL)
+		/* Started directly, so not reaped until we see it exit */
+		kill (pid, signum);
+	else if (!child->exited &&
+		 !pd_spawn_helper_send (helper_fd,
+					g_variant_new ("(yv)",
+						       PD_SPAWN_HELPER_SIGNAL,
+						       g_variant_new (PD_SPAWN_HELPER_SIGNAL_BODY,
+								      pid,
+								      signum)),
+					NULL, 0) &&
+		 (errno == EPIPE || errno == ECONNRESET))
+		pd_spawn_helper_lost ();
+
+	g_mutex_unlock (&lock);
+}
+
+/* ------------------------------------------------------------------ */
+/* Helper side */
+
+static void
+pd_spawn_helper_sigchld_handler (int signum)
+{
+	gint saved_errno = errno;
+	ssize_t ret G_GNUC_UNUSED;
+
+	/* If the pipe is full, a wakeup is already pending */
+	ret = write (sigchld_pipe[1], "", 1);
+	errno = saved_errno;
+}
+
+/* Start the process described by @request */
+static void
+pd_spawn_helper_run (gint sock,
+		     GVariant *request,
+		     const gint *fds,
+		     gint n_fds)
+{
+	gint child_fds[PD_SPAWN_HELPER_MAX_FDS];
+	GVariantIter *targets;
+	GError *error = NULL;
+	const gchar *path;
+	gchar **argv = NULL;
+	gchar **envp = NULL;
+	guint32 serial;
+	GPid pid = -1;
+	gint max = 0;
+	gint target;
+	gint i = 0;
+
+	for (target = 0; target < PD_SPAWN_HELPER_MAX_FDS; target++)
+		child_fds[target] = -1;
+
+	g_variant_get (request, PD_SPAWN_HELPER_RUN_ARGS,
+		       &serial, &path, &argv, &envp, &targets);
+	while (g_variant_iter_next (targets, "i", &target)) {
+		if (i < n_fds &&
+		    target >= 0 && target < PD_SPAWN_HELPER_MAX_FDS) {
+			child_fds[target] = fds[i];
+			if (target >= max)
+				max = target + 1;
+		}
+
+		i++;
+	}
+
+	g_variant_iter_free (targets);
+	if (i != n_fds || argv == NULL || argv[0] == NULL)
+		g_set_error_literal (&error, PD_ERROR, PD_ERROR_FAILED,
+				     "Bad request to spawn helper");
+	else if (pd_spawn (path, argv, envp, child_fds, max, &pid, &error))
+		g_hash_table_add (running, GINT_TO_POINTER (pid));
+
+	pd_spawn_helper_send (sock,
+			      g_variant_new (PD_SPAWN_HELPER_REPLY,
+					     PD_SPAWN_HELPER_SPAWNED,
+					     serial,
+					     error ? -1 : pid,
+					     0,
+					     g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+									NULL, 0, 1),
+					     error ? error->message : ""),
+			      NULL, 0);
+
+	if (error)
+		g_error_free (error);
+	g_strfreev (argv);
+	g_strfreev (envp);
+}
+
+/* Handle @request from the daemon */
+static void
+pd_spawn_helper_handle (gint sock,
+			GVariant *request,
+			const gint *fds,
+			gint n_fds)
+{
+	GVariant *body;
+	guchar kind;
+	gint pid, signum;
+
+	g_variant_get (request, PD_SPAWN_HELPER_REQUEST, &kind, &body);
+	if (kind == PD_SPAWN_HELPER_RUN &&
+	    g_variant_is_of_type (body,
+				  G_VARIANT_TYPE (PD_SPAWN_HELPER_RUN_BODY)))
+		pd_spawn_helper_run (sock, body, fds, n_fds);
+	else if (kind == PD_SPAWN_HELPER_SIGNAL &&
+		 g_variant_is_of_type (body,
+				       G_VARIANT_TYPE (PD_SPAWN_HELPER_SIGNAL_BODY))) {
+		g_variant_get (body, PD_SPAWN_HELPER_SIGNAL_BODY,
+			       &pid, &signum);
+
+		/* Only our own children, which are not yet reaped */
+		if (g_hash_table_contains (running, GINT_TO_POINTER (pid)))
+			kill (pid, signum);
+	}
+
+	g_variant_unref (body);
+}
+
+/* Report each child which has exited. Returns FALSE if the daemon
+ * has gone. */
+static gboolean
+pd_spawn_helper_reap (gint sock)
+{
+	struct rusage usage;
+	gint status;
+	pid_t pid;
+
+	while ((pid = wait4 (-1, &status, WNOHANG, &usage)) > 0) {
+		GVariant *usage_bytes;
+
+		g_hash_table_remove (running, GINT_TO_POINTER (pid));
+
+		usage_bytes = g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+							 &usage,
+							 sizeof (usage),
+							 1);
+		if (!pd_spawn_helper_send (sock,
+					   g_variant_new (PD_SPAWN_HELPER_REPLY,
+							  PD_SPAWN_HELPER_EXITED,
+							  0,
+							  pid,
+							  status,
+							  usage_bytes,
+							  ""),
+					   NULL, 0))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * pd_spawn_helper_main:
+ *
+ * Run as the spawn helper, until the daemon closes its end of the
+ * socket.
+ *
+ * Returns: The exit status.
+ */
+gint
+pd_spawn_helper_main (void)
+{
+	struct sigaction action;
+	struct pollfd pfd[2];
+	gint sock = PD_SPAWN_HELPER_FD;
+	GError *error = NULL;
+	gchar buf[64];
+
+	/* Keep the socket from the processes it starts */
+	if (fcntl (sock, F_SETFD, FD_CLOEXEC) == -1) {
+		g_printerr ("Spawn helper has no socket: %s\n",
+			    g_strerror (errno));
+		return 1;
+	}
+
+	if (!g_unix_open_pipe (sigchld_pipe, FD_CLOEXEC, &error) ||
+	    !g_unix_set_fd_nonblocking (sigchld_pipe[0], TRUE, &error) ||
+	    !g_unix_set_fd_nonblocking (sigchld_pipe[1], TRUE, &error)) {
+		g_printerr ("Spawn helper: %s\n", error->message);
+		g_error_free (error);
+		return 1;
+	}
+
+	memset (&action, 0, sizeof (action));
+	action.sa_handler = pd_spawn_helper_sigchld_handler;
+	action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset (&action.sa_mask);
+	sigaction (SIGCHLD, &action, NULL);
+
+	/* The daemon's controlling terminal is not ours to act on */
+	signal (SIGINT, SIG_IGN);
+
+	running = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+	pfd[0].fd = sock;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = sigchld_pipe[0];
+	pfd[1].events = POLLIN;
+	for (;;) {
+		if (poll (pfd, G_N_ELEMENTS (pfd), -1) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			g_printerr ("Spawn helper: poll: %s\n",
+				    g_strerror (errno));
+			return 1;
+		}
+
+		if (pfd[1].revents) {
+			while (read (sigchld_pipe[0], buf, sizeof (buf)) > 0)
+				;
+			if (!pd_spawn_helper_reap (sock))
+				break;
+		}
+
+		if (pfd[0].revents) {
+			gint fds[PD_SPAWN_HELPER_MAX_FDS];
+			GVariant *request;
+			gint n_fds;
+			gint i;
+
+			request = pd_spawn_helper_receive (sock,
+							   G_VARIANT_TYPE (PD_SPAWN_HELPER_REQUEST),
+							   PD_SPAWN_HELPER_REQUEST_MAX,
+							   0,
+							   fds,
+							   &n_fds);
+			if (request == NULL)
+				/* The daemon has gone */
+				break;
+
+			pd_spawn_helper_handle (sock, request, fds, n_fds);
+			g_variant_unref (request);
+			for (i = 0; i < n_fds; i++)
+				close (fds[i]);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,50 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __PD_SPAWN_HELPER_H__
+#define __PD_SPAWN_HELPER_H__
+
+#include <glib.h>
+
+#include "pd-common.h"
+
+G_BEGIN_DECLS
+
+/* Starts filters and backends from a small helper process, so that
+ * the daemon itself never forks */
+gboolean pd_spawn_helper_start		(GError **error);
+void	 pd_spawn_helper_stop		(void);
+gint	 pd_spawn_helper_main		(void);
+gboolean pd_spawn_helper_spawn		(const gchar *path,
+					 gchar **argv,
+					 gchar **envp,
+					 const gint *child_fds,
+					 gint n_fds,
+					 GPid *child_pid,
+					 GError **error);
+guint	 pd_spawn_helper_child_watch_add (GPid pid,
+					 PdChildWatchFunc function,
+					 gpointer user_data);
+void	 pd_spawn_helper_kill		(GPid pid,
+					 gint signum);
+
+G_END_DECLS
+
+#endif /* __PD_SPAWN_HELPER_H__ */
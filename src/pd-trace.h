@@ -0,0 +1,59 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __PD_TRACE_H__
+#define __PD_TRACE_H__
+
+/*
+ * Static probes (USDT) for the "printerd" provider. Each is a single
+ * no-op instruction until a tracer attaches, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/libexec/printerd:printerd:relay_write
+ *                { @[str(arg1)] = sum(arg2); }'
+ *
+ * Probes and their arguments:
+ *
+ *   job_create	     (job id, printer name)
+ *   job_state	     (job id, new state)
+ *   process_spawn   (job id, role, pid)
+ *   process_exit    (job id, role, wait status)
+ *   relay_read	     (job id, role read from, bytes)
+ *   relay_write     (job id, role written to, bytes)
+ *   spool_start     (job id)
+ *   spool_end	     (job id, bytes spooled)
+ *   auth_start	     (bus name)
+ *   auth_end	     (bus name, authorized)
+ *
+ * The role is the process's part in the job: arranger, transformer,
+ * final-filter or backend.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+# include <sys/sdt.h>
+# define PD_TRACE1(name,a)		DTRACE_PROBE1 (printerd, name, a)
+# define PD_TRACE2(name,a,b)		DTRACE_PROBE2 (printerd, name, a, b)
+# define PD_TRACE3(name,a,b,c)		DTRACE_PROBE3 (printerd, name, a, b, c)
+#else
+# define PD_TRACE1(name,a)		do { } while (0)
+# define PD_TRACE2(name,a,b)		do { } while (0)
+# define PD_TRACE3(name,a,b,c)		do { } while (0)
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* __PD_TRACE_H__ */
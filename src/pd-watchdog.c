@@ -0,0 +1,287 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "pd-metrics.h"
+#include "pd-watchdog.h"
+
+/* How often the probe source is due, in milliseconds */
+#define PD_WATCHDOG_PROBE_INTERVAL	500
+
+/* A main loop iteration taking longer than this, in microseconds,
+ * is recorded as a slow handler */
+#define PD_WATCHDOG_THRESHOLD		(50 * 1000)
+
+/* Signal used to find out which source the main thread is running */
+#define PD_WATCHDOG_SIGNAL		SIGURG
+
+/*
+ * Lag is measured by a timeout source which notes how late it is
+ * dispatched.
+ *
+ * Slow handlers are found by wrapping the main context's poll
+ * function: the time between poll() returning and the next call to
+ * poll() is the time spent dispatching. Meanwhile a watchdog thread
+ * waits for an iteration to last longer than the threshold, then
+ * signals the main thread. The signal handler runs in the main
+ * thread and copies the name of the handler it interrupted, which
+ * is recorded along with the time taken once the iteration
+ * finishes.
+ *
+ * Nothing in GLib may be called from the signal handler, so the
+ * handlers themselves publish their names with pd_watchdog_enter().
+ */
+
+static GMutex lock;
+static GCond cond;
+static gboolean running;
+static GThread *watchdog;
+static pthread_t main_thread;
+static GPollFunc default_poll;
+static guint probe_id;
+static gint64 probe_due;
+
+/* Main thread only */
+static gint64 busy_since;	/* 0 while polling */
+static gint iterations;
+
+/* The iteration being dispatched, or 0 while polling; and whether
+ * the watchdog thread is waiting for it to change */
+static gint busy_iteration;
+static gint waiting;
+
+/* Shared with the signal handler, which runs in the main thread */
+static const gchar *volatile current_name;
+static gint sampling;
+static volatile sig_atomic_t sampled;
+static gchar sample_name[64];
+
+static void
+pd_watchdog_signal_handler (int signum)
+{
+	const gchar *name;
+	gsize i = 0;
+
+	if (!g_atomic_int_compare_and_exchange (&sampling, 1, 0))
+		return;
+
+	name = current_name;
+	if (name == NULL)
+		name = "(unknown)";
+
+	while (name[i] && i < sizeof (sample_name) - 1) {
+		sample_name[i] = name[i];
+		i++;
+	}
+
+	sample_name[i] = '\0';
+	sampled = 1;
+}
+
+static gpointer
+pd_watchdog_thread (gpointer data)
+{
+	gint signalled = 0;
+
+	g_mutex_lock (&lock);
+	while (running) {
+		gint iteration = g_atomic_int_get (&busy_iteration);
+
+		if (iteration == 0 || iteration == signalled) {
+			/* Wait for the next iteration. The main thread
+			 * only wakes us if it sees waiting set, so check
+			 * again after setting it. */
+			g_atomic_int_set (&waiting, TRUE);
+			if (g_atomic_int_get (&busy_iteration) == iteration &&
+			    running)
+				g_cond_wait (&cond, &lock);
+			g_atomic_int_set (&waiting, FALSE);
+			continue;
+		}
+
+		g_cond_wait_until (&cond, &lock,
+				   g_get_monotonic_time () +
+				   PD_WATCHDOG_THRESHOLD);
+		if (!running ||
+		    g_atomic_int_get (&busy_iteration) != iteration)
+			continue;
+
+		/* Main thread has been busy too long */
+		signalled = iteration;
+		g_atomic_int_set (&sampling, 1);
+		pthread_kill (main_thread, PD_WATCHDOG_SIGNAL);
+	}
+
+	g_mutex_unlock (&lock);
+	return NULL;
+}
+
+static gint
+pd_watchdog_poll (GPollFD *ufds,
+		  guint nfds,
+		  gint timeout)
+{
+	gint64 now = g_get_monotonic_time ();
+	gint ret;
+
+	g_atomic_int_set (&busy_iteration, 0);
+
+	/* Stop any sample still on its way */
+	g_atomic_int_set (&sampling, 0);
+
+	if (busy_since && now - busy_since > PD_WATCHDOG_THRESHOLD) {
+		const gchar *name = sampled ? sample_name : "(unknown)";
+
+		g_debug ("[Watchdog] Main loop blocked for %" G_GINT64_FORMAT
+			 "ms in %s", (now - busy_since) / 1000, name);
+		pd_metrics_add_slow_handler (name, now - busy_since);
+	}
+
+	sampled = 0;
+	current_name = NULL;
+	pd_metrics_count (PD_METRICS_MAIN_LOOP_ITERATIONS, NULL, 1);
+
+	busy_since = 0;
+	ret = default_poll (ufds, nfds, timeout);
+	busy_since = g_get_monotonic_time ();
+
+	if (++iterations <= 0)
+		iterations = 1;
+	g_atomic_int_set (&busy_iteration, iterations);
+
+	/* Only take the lock if the watchdog thread is idle */
+	if (g_atomic_int_get (&waiting)) {
+		g_mutex_lock (&lock);
+		g_cond_signal (&cond);
+		g_mutex_unlock (&lock);
+	}
+
+	return ret;
+}
+
+static gboolean
+pd_watchdog_probe_cb (gpointer user_data)
+{
+	gint64 now = g_get_monotonic_time ();
+
+	pd_metrics_observe (PD_METRICS_MAIN_LOOP_LAG, now - probe_due);
+	probe_due = now + PD_WATCHDOG_PROBE_INTERVAL * 1000;
+	return G_SOURCE_CONTINUE;
+}
+
+/**
+ * pd_watchdog_enter:
+ * @name: What the main thread is about to do, e.g. the name of the
+ *   source being dispatched. This must be a static string.
+ *
+ * Name the handler now running in the main thread, so that it can
+ * be identified if it blocks the main loop. This must only be called
+ * from the main thread.
+ *
+ * Returns: The previous name, to pass to pd_watchdog_leave().
+ */
+const gchar *
+pd_watchdog_enter (const gchar *name)
+{
+	const gchar *previous = current_name;
+
+	current_name = name;
+	return previous;
+}
+
+/**
+ * pd_watchdog_leave:
+ * @previous: The value returned by pd_watchdog_enter().
+ *
+ * Note that the handler named by pd_watchdog_enter() has finished.
+ */
+void
+pd_watchdog_leave (const gchar *previous)
+{
+	current_name = previous;
+}
+
+/**
+ * pd_watchdog_start:
+ *
+ * Start watching the default main context. This must be called
+ * from the thread that will run the main loop.
+ */
+void
+pd_watchdog_start (void)
+{
+	GMainContext *context = g_main_context_default ();
+	struct sigaction action;
+	GSource *probe;
+
+	g_return_if_fail (!running);
+
+	main_thread = pthread_self ();
+	memset (&action, 0, sizeof (action));
+	action.sa_handler = pd_watchdog_signal_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset (&action.sa_mask);
+	sigaction (PD_WATCHDOG_SIGNAL, &action, NULL);
+
+	default_poll = g_main_context_get_poll_func (context);
+	g_main_context_set_poll_func (context, pd_watchdog_poll);
+
+	running = TRUE;
+	watchdog = g_thread_new ("watchdog", pd_watchdog_thread, NULL);
+
+	probe = g_timeout_source_new (PD_WATCHDOG_PROBE_INTERVAL);
+	g_source_set_name (probe, "[printerd] watchdog probe");
+	g_source_set_callback (probe, pd_watchdog_probe_cb, NULL, NULL);
+	probe_due = g_get_monotonic_time () + PD_WATCHDOG_PROBE_INTERVAL * 1000;
+	probe_id = g_source_attach (probe, context);
+	g_source_unref (probe);
+}
+
+/**
+ * pd_watchdog_stop:
+ *
+ * Stop watching the main context.
+ */
+void
+pd_watchdog_stop (void)
+{
+	if (!running)
+		return;
+
+	g_source_remove (probe_id);
+	g_main_context_set_poll_func (g_main_context_default (),
+				      default_poll);
+
+	g_mutex_lock (&lock);
+	running = FALSE;
+	g_cond_signal (&cond);
+	g_mutex_unlock (&lock);
+	g_thread_join (watchdog);
+	watchdog = NULL;
+
+	signal (PD_WATCHDOG_SIGNAL, SIG_DFL);
+}
@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Tim Waugh <twaugh@redhat.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __PD_WATCHDOG_H__
+#define __PD_WATCHDOG_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Watches the default main context for dispatch lag and handlers
+ * which block it, recording both in the daemon metrics */
+void	 pd_watchdog_start	(void);
+void	 pd_watchdog_stop	(void);
+
+/* Handlers in the main thread that may take a while say so, so that
+ * they can be named if they block it */
+const gchar	*pd_watchdog_enter	(const gchar *name);
+void		 pd_watchdog_leave	(const gchar *previous);
+
+G_END_DECLS
+
+#endif /* __PD_WATCHDOG_H__ */
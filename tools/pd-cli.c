@@ -259,13 +259,19 @@ print_files (const char *printer_id,
 	GError *error = NULL;
 	gint ret = 1;
 	PdPrinter *pd_printer = NULL;
-	PdJob *pd_job = NULL;
 	gchar *printer_path = NULL;
 	gchar *job_path = NULL;
 	GVariant *unsupported = NULL;
 	GVariantBuilder options;
 	GVariantBuilder attributes;
-	GVariantBuilder start_options;
+	GUnixFDList *fd_list = NULL;
+	gint fd = -1;
+	char **file;
+
+	/* Only one document per job is supported */
+	for (file = files + 1; *file; file++)
+		g_printerr ("Ignoring %s: only one document per job "
+			    "is supported\n", *file);
 
 	/* Get the Printer */
 	printer_path = g_strdup_printf ("/org/freedesktop/printerd/printer/%s",
@@ -285,65 +291,52 @@ print_files (const char *printer_id,
 		goto out;
 	}
 
-	/* Create a job for the printer */
+	fd = open ((const char *) files[0], O_RDONLY);
+	if (fd < 0) {
+		g_printerr ("Error opening file: %s\n",
+			    strerror (errno));
+		goto out;
+	}
+
+	fd_list = g_unix_fd_list_new ();
+	if (g_unix_fd_list_append (fd_list, fd, NULL) == -1) {
+		g_printerr ("Error adding fd to list\n");
+		goto out;
+	}
+
+	/* Create, add the document to and start a job in one call */
 	g_variant_builder_init (&options, G_VARIANT_TYPE ("a{sv}"));
 	g_variant_builder_init (&attributes, G_VARIANT_TYPE ("a{sv}"));
-	if (!pd_printer_call_create_job_sync (pd_printer,
+	if (!pd_printer_call_submit_job_sync (pd_printer,
 					      g_variant_builder_end (&options),
 					      "New job",
 					      g_variant_builder_end (&attributes),
+					      g_variant_new_handle (0),
+					      fd_list,
 					      &job_path,
 					      &unsupported,
-					      NULL,
+					      NULL, /* out_fd_list */
+					      NULL, /* cancellable */
 					      &error)) {
-		g_printerr ("Error creating job: %s\n", error->message);
-		g_error_free (error);
-		goto out;
-	}
-
-	g_debug ("Job created: %s", job_path);
-
-	if (add_documents (strrchr (job_path, '/') + 1,
-			   (const gchar **) files)) {
-		cancel_job (job_path);
-		goto out;
-	}
-
-	/* Now get the job and start it */
-	pd_job = pd_job_proxy_new_for_bus_sync (Bus,
-						G_DBUS_PROXY_FLAGS_NONE,
-						"org.freedesktop.printerd",
-						job_path,
-						NULL,
-						&error);
-	if (!pd_job) {
-		g_printerr ("Error getting job: %s\n", error->message);
+		g_printerr ("Error submitting job: %s\n", error->message);
 		g_error_free (error);
 		goto out;
 	}
 
-	g_variant_builder_init (&start_options, G_VARIANT_TYPE ("a{sv}"));
-	if (!pd_job_call_start_sync (pd_job,
-				     g_variant_builder_end (&start_options),
-				     NULL,
-				     &error)) {
-		g_printerr ("Error starting job: %s\n", error->message);
-		g_error_free (error);
-		goto out;
-	}
-
-	g_debug ("Job started");
+	g_debug ("Job submitted");
 	g_print ("Job path is %s\n", job_path);
 	ret = 0;
  out:
+	if (fd != -1)
+		close (fd);
+	if (fd_list)
+		g_object_unref (fd_list);
 	g_free (printer_path);
 	g_free (job_path);
 	if (unsupported)
 		g_variant_unref (unsupported);
 	if (pd_printer)
 		g_object_unref (pd_printer);
-	if (pd_job)
-		g_object_unref (pd_job);
 	return ret;
 }
 